@@ -0,0 +1,157 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#pragma warning(push, 4)
+
+// arena::s_growth (static)
+//
+// Number of blocks that have been allocated from the heap by all arenas
+std::atomic<uint64_t> arena::s_growth{ 0 };
+
+//---------------------------------------------------------------------------
+// arena Constructor
+//
+// Arguments:
+//
+//	blocksize	- Minimum size of each block allocated from the heap
+
+arena::arena(size_t blocksize) : m_blocksize(blocksize)
+{
+	if(blocksize == 0) throw std::invalid_argument("blocksize");
+}
+
+//---------------------------------------------------------------------------
+// arena Destructor
+
+arena::~arena()
+{
+	while(m_head != nullptr) {
+
+		block_t* next = m_head->next;
+		::operator delete(m_head);
+		m_head = next;
+	}
+}
+
+//---------------------------------------------------------------------------
+// arena::allocate
+//
+// Allocates uninitialized memory from the arena
+//
+// Arguments:
+//
+//	length		- Number of bytes to allocate
+//	alignment	- Required alignment of the memory; must be a power of two
+
+void* arena::allocate(size_t length, size_t alignment)
+{
+	if((alignment == 0) || ((alignment & (alignment - 1)) != 0)) throw std::invalid_argument("alignment");
+	if(length > (SIZE_MAX - sizeof(block_t) - alignment)) throw std::bad_alloc();
+
+	// Try the current block and then any blocks retained from before the last reset
+	while(m_current != nullptr) {
+
+		uintptr_t base = reinterpret_cast<uintptr_t>(m_current + 1);
+		size_t offset = static_cast<size_t>(((base + m_offset + (alignment - 1)) & ~static_cast<uintptr_t>(alignment - 1)) - base);
+
+		if((offset <= m_current->size) && (length <= m_current->size - offset)) {
+
+			m_offset = offset + length;
+			return reinterpret_cast<void*>(base + offset);
+		}
+
+		if(m_current->next == nullptr) break;
+
+		m_current = m_current->next;
+		m_offset = 0;
+	}
+
+	// Grow the arena with a new block at the end; oversized requests get a block of their own
+	// that is kept like any other so the same file doesn't go back to the heap next time
+	size_t size = std::max(m_blocksize, length + alignment);
+	block_t* block = static_cast<block_t*>(::operator new(sizeof(block_t) + size));
+	block->next = nullptr;
+	block->size = size;
+
+	if(m_current != nullptr) m_current->next = block;
+	else m_head = block;
+
+	m_current = block;
+	m_offset = 0;
+	m_capacity += size;
+	++s_growth;
+
+	return allocate(length, alignment);
+}
+
+//---------------------------------------------------------------------------
+// arena::capacity
+//
+// Gets the total size of the blocks owned by the arena
+//
+// Arguments:
+//
+//	NONE
+
+size_t arena::capacity(void) const
+{
+	return m_capacity;
+}
+
+//---------------------------------------------------------------------------
+// arena::growth (static)
+//
+// Gets the number of blocks that have been allocated from the heap by all arenas
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t arena::growth(void)
+{
+	return s_growth.load();
+}
+
+//---------------------------------------------------------------------------
+// arena::reset
+//
+// Releases all allocations without returning the blocks to the heap
+//
+// Arguments:
+//
+//	NONE
+
+void arena::reset(void)
+{
+	m_current = m_head;
+	m_offset = 0;
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,116 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __ARENA_H_
+#define __ARENA_H_
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class arena
+//
+// Implements a bump allocator for short-lived per-file data.  Memory is never
+// released individually; reset() rewinds the arena and keeps the blocks so the
+// next file is served from the same memory without going back to the heap
+
+class arena
+{
+public:
+
+	// Instance Constructor
+	//
+	explicit arena(size_t blocksize);
+
+	// Destructor
+	//
+	~arena();
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// allocate
+	//
+	// Allocates uninitialized memory from the arena
+	void* allocate(size_t length, size_t alignment);
+
+	// allocate
+	//
+	// Allocates an uninitialized array of a trivial type from the arena
+	template<typename _type>
+	_type* allocate(size_t count)
+	{
+		if(count > (SIZE_MAX / sizeof(_type))) throw std::bad_alloc();
+		return static_cast<_type*>(allocate(count * sizeof(_type), alignof(_type)));
+	}
+
+	// capacity
+	//
+	// Gets the total size of the blocks owned by the arena
+	size_t capacity(void) const;
+
+	// growth (static)
+	//
+	// Gets the number of blocks that have been allocated from the heap by all arenas
+	static uint64_t growth(void);
+
+	// reset
+	//
+	// Releases all allocations without returning the blocks to the heap
+	void reset(void);
+
+private:
+
+	arena(arena const&)=delete;
+	arena& operator=(arena const&)=delete;
+
+	// block_t
+	//
+	// Header of each block; the block data immediately follows the header
+	struct block_t
+	{
+		block_t*		next;			// Next block in the arena
+		size_t			size;			// Size of the block data
+	};
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	size_t const				m_blocksize;			// Minimum block size
+	block_t*					m_head = nullptr;		// First block in the arena
+	block_t*					m_current = nullptr;	// Block being allocated from
+	size_t						m_offset = 0;			// Offset into the current block
+	size_t						m_capacity = 0;			// Total size of the blocks
+
+	static std::atomic<uint64_t>	s_growth;			// Number of heap block allocations
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __ARENA_H_
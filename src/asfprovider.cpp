@@ -0,0 +1,252 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "asfprovider.h"
+
+#include <string.h>
+
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+// CONTENT_DESCRIPTION_GUID
+//
+// ASF Content Description Object
+static uint8_t const CONTENT_DESCRIPTION_GUID[] = { 0x33, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C };
+
+// EXTENDED_CONTENT_DESCRIPTION_GUID
+//
+// ASF Extended Content Description Object
+static uint8_t const EXTENDED_CONTENT_DESCRIPTION_GUID[] = { 0x40, 0xA4, 0xD0, 0xD2, 0x07, 0xE3, 0xD2, 0x11, 0x97, 0xF0, 0x00, 0xA0, 0xC9, 0x5E, 0xA8, 0x50 };
+
+// FILE_PROPERTIES_GUID
+//
+// ASF File Properties Object
+static uint8_t const FILE_PROPERTIES_GUID[] = { 0xA1, 0xDC, 0xAB, 0x8C, 0x47, 0xA9, 0xCF, 0x11, 0x8E, 0xE4, 0x00, 0xC0, 0x0C, 0x20, 0x53, 0x65 };
+
+// HEADER_GUID
+//
+// ASF Header Object; always at the start of the file
+static uint8_t const HEADER_GUID[] = { 0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C };
+
+// MAX_HEADER_LENGTH
+//
+// Maximum length of the ASF header object that will be read
+static uint64_t const MAX_HEADER_LENGTH = 16 MiB;
+
+//---------------------------------------------------------------------------
+// asfprovider::accepts
+//
+// Determines if the provider can read a file based on the extension and magic bytes
+//
+// Arguments:
+//
+//	extension	- File extension, including the leading period
+//	magic		- Bytes read from the start of the file
+//	length		- Number of magic bytes available
+
+bool asfprovider::accepts(wchar_t const* extension, uint8_t const* magic, size_t length) const
+{
+	// If the start of the file couldn't be read go by the extension alone
+	if(length < sizeof(HEADER_GUID)) return (_wcsicmp(extension, L".dvr-ms") == 0);
+	return (memcmp(magic, HEADER_GUID, sizeof(HEADER_GUID)) == 0);
+}
+
+//---------------------------------------------------------------------------
+// asfprovider::extensions
+//
+// Gets the file extension(s) the provider reads natively, or null if it reads any file
+//
+// Arguments:
+//
+//	NONE
+
+char const* asfprovider::extensions(void) const
+{
+	return ".dvr-ms";
+}
+
+//---------------------------------------------------------------------------
+// asfprovider::extract (private)
+//
+// Provider specific implementation of load()
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void asfprovider::extract(wchar_t const* path, recording_metadata& metadata)
+{
+	uint8_t						header[30];				// ASF header object
+	uint8_t*					objects = nullptr;		// ASF header child objects
+	size_t						objectslength = 0;		// Length of the child objects
+
+	HANDLE file = open_file(path);
+
+	try {
+
+		// The header object contains all of the metadata objects, read it all in one go
+		read_file(file, 0, header, sizeof(header));
+		if(memcmp(header, HEADER_GUID, sizeof(HEADER_GUID)) != 0) throw string_exception(__func__, ": file is not an ASF file");
+
+		uint64_t headerlength = get_le64(&header[16]);
+		if((headerlength < sizeof(header)) || (headerlength > MAX_HEADER_LENGTH)) throw string_exception(__func__, ": invalid header object length ", headerlength);
+
+		objectslength = static_cast<size_t>(headerlength - sizeof(header));
+		objects = scratch().allocate<uint8_t>(objectslength);
+		read_file(file, sizeof(header), objects, objectslength);
+
+		CloseHandle(file);
+	}
+
+	catch(...) { CloseHandle(file); throw; }
+
+	// Decode the header objects, and keep the ones that are decoded as the raw metadata
+	parse(objects, objectslength, metadata);
+	metadata.format = name();
+
+	for(size_t offset = 0; offset + 24 <= objectslength;) {
+
+		uint8_t const* object = &objects[offset];
+		uint64_t objectlength = get_le64(object + 16);
+		if((objectlength < 24) || (objectlength > objectslength - offset)) break;
+
+		if((memcmp(object, CONTENT_DESCRIPTION_GUID, sizeof(CONTENT_DESCRIPTION_GUID)) == 0) ||
+			(memcmp(object, EXTENDED_CONTENT_DESCRIPTION_GUID, sizeof(EXTENDED_CONTENT_DESCRIPTION_GUID)) == 0) ||
+			(memcmp(object, FILE_PROPERTIES_GUID, sizeof(FILE_PROPERTIES_GUID)) == 0))
+			metadata.raw.append(reinterpret_cast<char const*>(object), static_cast<size_t>(objectlength));
+
+		offset += static_cast<size_t>(objectlength);
+	}
+}
+
+//---------------------------------------------------------------------------
+// asfprovider::name
+//
+// Gets the name of the provider
+//
+// Arguments:
+//
+//	NONE
+
+char const* asfprovider::name(void) const
+{
+	return "dvr-ms";
+}
+
+//---------------------------------------------------------------------------
+// asfprovider::parse (private)
+//
+// Provider specific implementation of decode()
+//
+// Arguments:
+//
+//	data		- Pointer to the header child objects
+//	length		- Length of the header child objects
+//	metadata	- Metadata to be decoded
+
+void asfprovider::parse(uint8_t const* data, size_t length, recording_metadata& metadata)
+{
+	// Each child object is a GUID and a 64-bit length (that includes the GUID and length) followed by the data
+	for(size_t offset = 0; offset + 24 <= length;) {
+
+		uint8_t const* object = &data[offset];
+		uint64_t objectlength = get_le64(object + 16);
+		if((objectlength < 24) || (objectlength > length - offset)) break;
+
+		uint8_t const* payload = object + 24;
+		size_t datalength = static_cast<size_t>(objectlength - 24);
+
+		// Content Description Object: the title is the first of five length-prefixed strings
+		if(memcmp(object, CONTENT_DESCRIPTION_GUID, sizeof(CONTENT_DESCRIPTION_GUID)) == 0) {
+
+			if(datalength >= 10) {
+
+				size_t titlelength = get_le16(payload);
+				if(10 + titlelength <= datalength) set_attribute(metadata, "Title", utf16le_to_utf8(payload + 10, titlelength));
+			}
+		}
+
+		// Extended Content Description Object: a count followed by name/type/value descriptors
+		else if(memcmp(object, EXTENDED_CONTENT_DESCRIPTION_GUID, sizeof(EXTENDED_CONTENT_DESCRIPTION_GUID)) == 0) {
+
+			size_t position = 2;
+			uint16_t count = (datalength >= 2) ? get_le16(payload) : 0;
+
+			for(uint16_t index = 0; (index < count) && (position + 2 <= datalength); index++) {
+
+				size_t namelength = get_le16(payload + position);
+				if(position + 2 + namelength + 4 > datalength) break;
+
+				char const* name = utf16le_to_utf8(payload + position + 2, namelength);
+				position += 2 + namelength;
+
+				uint16_t type = get_le16(payload + position);
+				size_t valuelength = get_le16(payload + position + 2);
+				position += 4;
+				if(position + valuelength > datalength) break;
+
+				uint8_t const* valuedata = payload + position;
+
+				if(type == 0) set_attribute(metadata, name, utf16le_to_utf8(valuedata, valuelength));
+				else if(((type == 2) || (type == 3)) && (valuelength == 4)) set_attribute(metadata, name, (type == 2) ? ((get_le32(valuedata) != 0) ? 1ULL : 0ULL) : get_le32(valuedata));
+				else if((type == 4) && (valuelength == 8)) set_attribute(metadata, name, get_le64(valuedata));
+				else if((type == 5) && (valuelength == 2)) set_attribute(metadata, name, get_le16(valuedata));
+
+				position += valuelength;
+			}
+		}
+
+		// File Properties Object: the play duration includes the preroll (which is in milliseconds)
+		else if(memcmp(object, FILE_PROPERTIES_GUID, sizeof(FILE_PROPERTIES_GUID)) == 0) {
+
+			if(datalength >= 80) {
+
+				uint64_t playduration = get_le64(payload + 40);
+				uint64_t preroll = get_le64(payload + 56) * 10000ULL;
+				set_attribute(metadata, "Duration", (playduration > preroll) ? playduration - preroll : 0);
+			}
+		}
+
+		offset += static_cast<size_t>(objectlength);
+	}
+}
+
+//---------------------------------------------------------------------------
+// asfprovider::priority
+//
+// Gets the static priority of the provider; lower values are tried first
+//
+// Arguments:
+//
+//	NONE
+
+int asfprovider::priority(void) const
+{
+	return 0;		// Native reader of the DVR-MS format; always tried before the fallback providers
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
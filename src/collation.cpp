@@ -0,0 +1,170 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "collation.h"
+
+#include <memory>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#pragma warning(push, 4)
+
+//
+// HELPER FUNCTIONS
+//
+
+// fold_ascii
+//
+// Folds a single ASCII character to upper case to match CompareStringOrdinal
+inline static uint8_t fold_ascii(uint8_t ch)
+{
+	return ((ch >= 'a') && (ch <= 'z')) ? static_cast<uint8_t>(ch - 0x20) : ch;
+}
+
+// compare_unicode
+//
+// Compares UTF-8 strings case-insensitively using the operating system ordinal
+// comparison, which is the same comparison used by the file system
+static int compare_unicode(char const* lhs, int lhslen, char const* rhs, int rhslen)
+{
+	wchar_t				lhsbuffer[MAX_PATH];		// Stack buffer for lhs conversion
+	wchar_t				rhsbuffer[MAX_PATH];		// Stack buffer for rhs conversion
+	std::unique_ptr<wchar_t[]>	lhsheap;			// Heap buffer for long lhs strings
+	std::unique_ptr<wchar_t[]>	rhsheap;			// Heap buffer for long rhs strings
+
+	// The number of UTF-16 code units never exceeds the number of UTF-8 bytes
+	wchar_t* lhswide = lhsbuffer;
+	if(lhslen > MAX_PATH) { lhsheap = std::make_unique<wchar_t[]>(lhslen); lhswide = lhsheap.get(); }
+
+	wchar_t* rhswide = rhsbuffer;
+	if(rhslen > MAX_PATH) { rhsheap = std::make_unique<wchar_t[]>(rhslen); rhswide = rhsheap.get(); }
+
+	int lhscch = (lhslen) ? MultiByteToWideChar(CP_UTF8, 0, lhs, lhslen, lhswide, lhslen) : 0;
+	int rhscch = (rhslen) ? MultiByteToWideChar(CP_UTF8, 0, rhs, rhslen, rhswide, rhslen) : 0;
+
+	switch(CompareStringOrdinal(lhswide, lhscch, rhswide, rhscch, TRUE)) {
+
+		case CSTR_LESS_THAN: return -1;
+		case CSTR_EQUAL: return 0;
+		case CSTR_GREATER_THAN: return 1;
+	}
+
+	// If the strings could not be compared, fall back to a binary comparison
+	int result = memcmp(lhs, rhs, static_cast<size_t>((lhslen < rhslen) ? lhslen : rhslen));
+	return (result != 0) ? result : (lhslen - rhslen);
+}
+
+//---------------------------------------------------------------------------
+// path_collation
+//
+// SQLite collation callback that compares UTF-8 file paths without regard to case
+//
+// Arguments:
+//
+//	context		- Context pointer provided to sqlite3_create_collation (unused)
+//	lhslen		- Length of the left-hand string in bytes
+//	lhs			- Left-hand UTF-8 string (not null-terminated)
+//	rhslen		- Length of the right-hand string in bytes
+//	rhs			- Right-hand UTF-8 string (not null-terminated)
+
+int path_collation(void* /*context*/, int lhslen, void const* lhs, int rhslen, void const* rhs)
+{
+	uint8_t const*		left = reinterpret_cast<uint8_t const*>(lhs);
+	uint8_t const*		right = reinterpret_cast<uint8_t const*>(rhs);
+	int					length = (lhslen < rhslen) ? lhslen : rhslen;
+	int					index = 0;
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+	__m128i const lowera = _mm_set1_epi8('a' - 1);
+	__m128i const lowerz = _mm_set1_epi8('z' + 1);
+	__m128i const caseflag = _mm_set1_epi8(0x20);
+
+	// Compare 16 bytes at a time with lower case ASCII letters folded to upper case; bytes
+	// with the high bit set are negative as signed values and are never folded
+	while((length - index) >= 16) {
+
+		__m128i l = _mm_loadu_si128(reinterpret_cast<__m128i const*>(left + index));
+		__m128i r = _mm_loadu_si128(reinterpret_cast<__m128i const*>(right + index));
+
+		l = _mm_sub_epi8(l, _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(l, lowera), _mm_cmplt_epi8(l, lowerz)), caseflag));
+		r = _mm_sub_epi8(r, _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(r, lowera), _mm_cmplt_epi8(r, lowerz)), caseflag));
+
+		unsigned long mask = static_cast<unsigned long>(_mm_movemask_epi8(_mm_cmpeq_epi8(l, r))) ^ 0xFFFF;
+		if(mask != 0) {
+
+			unsigned long offset = 0;
+			_BitScanForward(&offset, mask);
+			index += static_cast<int>(offset);
+			break;
+		}
+
+		index += 16;
+	}
+
+#endif	// defined(_M_IX86) || defined(_M_X64)
+
+	// Compare the remaining bytes (or the first difference found above) one at a time
+	while((index < length) && (fold_ascii(left[index]) == fold_ascii(right[index]))) ++index;
+
+	// If no differences were found the shorter string sorts first
+	if(index == length) return lhslen - rhslen;
+
+	// If both differing characters are ASCII, the folded comparison matches the ordinal one
+	if((left[index] < 0x80) && (right[index] < 0x80)) return static_cast<int>(fold_ascii(left[index])) - static_cast<int>(fold_ascii(right[index]));
+
+	// Otherwise back up to the beginning of the UTF-8 sequence and compare the remainders
+	while((index > 0) && ((left[index] & 0xC0) == 0x80)) --index;
+	return compare_unicode(reinterpret_cast<char const*>(left + index), lhslen - index, reinterpret_cast<char const*>(right + index), rhslen - index);
+}
+
+//---------------------------------------------------------------------------
+// path_hash
+//
+// Generates a 64-bit FNV-1a hash of a UTF-8 file path with ASCII letters folded to
+// upper case; paths that differ only by ASCII case generate the same hash
+//
+// Arguments:
+//
+//	path		- UTF-8 path to be hashed (not null-terminated)
+//	length		- Length of the path in bytes
+
+uint64_t path_hash(void const* path, int length)
+{
+	uint8_t const*		ch = reinterpret_cast<uint8_t const*>(path);
+	uint64_t			hash = 14695981039346656037ULL;
+
+	for(int index = 0; index < length; index++) {
+
+		hash ^= fold_ascii(ch[index]);
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,115 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "compression.h"
+
+#include <stdexcept>
+
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// compress_buffer
+//
+// Compresses binary data with the Windows XPRESS Huffman compression algorithm; the
+// compressed data records the original length so it can be decompressed in one step
+//
+// Arguments:
+//
+//	data		- Data to be compressed
+//	length		- Length of the data to be compressed
+//	result		- Receives the compressed data
+
+void compress_buffer(void const* data, size_t length, std::string& result)
+{
+	COMPRESSOR_HANDLE		compressor;			// Compressor handle
+	size_t					required = 0;		// Length of the compressed data
+
+	result.clear();
+	if((data == nullptr) && (length > 0)) throw std::invalid_argument("data");
+	if(length == 0) return;
+
+	if(!CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &compressor))
+		throw string_exception(__func__, ": unable to create compressor (", GetLastError(), ")");
+
+	try {
+
+		// Ask for the length of the compressed data first, then compress it into the result
+		if(!Compress(compressor, data, length, nullptr, 0, &required) && (GetLastError() != ERROR_INSUFFICIENT_BUFFER))
+			throw string_exception(__func__, ": unable to compress ", length, " bytes (", GetLastError(), ")");
+
+		result.resize(required);
+		if(!Compress(compressor, data, length, &result[0], result.size(), &required))
+			throw string_exception(__func__, ": unable to compress ", length, " bytes (", GetLastError(), ")");
+
+		result.resize(required);
+		CloseCompressor(compressor);
+	}
+
+	catch(...) { CloseCompressor(compressor); throw; }
+}
+
+//---------------------------------------------------------------------------
+// decompress_buffer
+//
+// Decompresses binary data previously compressed with compress_buffer()
+//
+// Arguments:
+//
+//	data		- Compressed data
+//	length		- Length of the compressed data
+//	result		- Receives the decompressed data
+
+void decompress_buffer(void const* data, size_t length, std::string& result)
+{
+	DECOMPRESSOR_HANDLE		decompressor;		// Decompressor handle
+	size_t					required = 0;		// Length of the decompressed data
+
+	result.clear();
+	if((data == nullptr) && (length > 0)) throw std::invalid_argument("data");
+	if(length == 0) return;
+
+	if(!CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &decompressor)) 
+		throw string_exception(__func__, ": unable to create decompressor (", GetLastError(), ")");
+
+	try {
+
+		// Ask for the original length first, then decompress the data into the result
+		if(!Decompress(decompressor, data, length, nullptr, 0, &required) && (GetLastError() != ERROR_INSUFFICIENT_BUFFER))
+			throw string_exception(__func__, ": unable to decompress ", length, " bytes (", GetLastError(), ")");
+
+		result.resize(required);
+		if(!Decompress(decompressor, data, length, &result[0], result.size(), &required))
+			throw string_exception(__func__, ": unable to decompress ", length, " bytes (", GetLastError(), ")");
+
+		result.resize(required);
+		CloseDecompressor(decompressor);
+	}
+
+	catch(...) { CloseDecompressor(decompressor); throw; }
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -24,12 +24,23 @@
 #include "database.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctype.h>
+#include <deque>
 #include <exception>
 #include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
 
+#include "arena.h"
+#include "collation.h"
+#include "compression.h"
 #include "sqlite_exception.h"
 #include "string_exception.h"
+#include "textdictionary.h"
 
 #pragma warning(push, 4)
 
@@ -41,693 +52,3358 @@
 
 // Check SQLITE_TEMP_STORE
 //
-#if (SQLITE_TEMP_STORE != 3)
-#error SQLITE_TEMP_STORE must be defined and set to 3
+#if (SQLITE_TEMP_STORE != 2)
+#error SQLITE_TEMP_STORE must be defined and set to 2
 #endif
 
+// SCHEMA_VERSION
+//
+// Version of the database schema; tables are rebuilt when the stored version differs
+static int const SCHEMA_VERSION = 9;
+
+// METADATA_VERSION
+//
+// Version of the recording columns decoded from the cached raw metadata.  To add a decoded column, add it
+// to the recording table with alter table and increment this version; the existing recordings are then
+// backfilled from their cached raw metadata by backfill_recording_metadata() rather than read again
+static int const METADATA_VERSION = 1;
+
+// BACKFILL_COLUMNS
+//
+// Assignments of the recording columns added by each METADATA_VERSION, indexed by version; the values are
+// bound by name from the decoded metadata (:episodename, :seriesnumber, :plot, ...).  A recording is only
+// backfilled with the columns added after its raw metadata was cached, version 1 is the original set of
+// columns.  The title and directory must never be backfilled, they can be changed by a rename
+static char const* const BACKFILL_COLUMNS[METADATA_VERSION + 1] = {
+
+	nullptr,		// Version 0: unused
+	nullptr,		// Version 1: original columns, decoded when the recording is discovered
+};
+
+// RECORDING_COLUMNS
+//
+// Column definitions shared by the recording and discover_recording tables
+//
+// recordingkey(pk) | recordingid | title | episodename | seriesnumber | episodenumber | year | directory | plot | channelname | recordingtime | duration | rootid | filesize | filetime | deletetime | trashpath | ishd
+//
+// recordingid and trashpath are relative to the path of the root folder
+static char const RECORDING_COLUMNS[] = "recordingkey integer primary key, recordingid text not null collate path, title text, episodename text, seriesnumber int, "
+	"episodenumber int, year int, directory text, plot text, channelname text, recordingtime int, duration int, "
+	"rootid int not null, filesize int, filetime int, deletetime int, trashpath text collate path, ishd int";
+
+// RECORDING_KEY_LOOKUP
+//
+// From clause that seeks the recording with the full path bound to ?1; the root folder the path belongs to is
+// matched by prefix and the relative path is sought within its key slots, the relative path itself only has to
+// be compared to resolve the rare hash collision between rows in the same slots
+static char const RECORDING_KEY_LOOKUP[] = "root inner join recording on recording.rootid = root.rootid and "
+	"recording.rowid between recording_key(substr(?1, length(root.path) + 1)) and recording_key(substr(?1, length(root.path) + 1)) + 15 and "
+	"recording.recordingid = substr(?1, length(root.path) + 1) where substr(?1, 1, length(root.path)) = root.path";
+
+// RECORDING_KEY_SLOTS
+//
+// Number of keys available to paths with the same hash; must match RECORDING_KEY_LOOKUP
+static int const RECORDING_KEY_SLOTS = 16;
+
+// TRASH_FOLDER
+//
+// Name of the folder, relative to the recording, that deleted recordings are moved into
+static char const TRASH_FOLDER[] = ".trash";
+
+// COPY_DATABASE_RETRIES / COPY_DATABASE_RETRY_DELAY
+//
+// Number of times a busy database copy is retried, and the delay (in milliseconds) between the attempts
+static int const COPY_DATABASE_RETRIES = 20;
+static int const COPY_DATABASE_RETRY_DELAY = 50;
+
+// FOLDER_ACTIVE_WINDOW
+//
+// Files modified within this long of a discovery may still be being written; they are always checked, even
+// when the folder hasn't changed since it was last listed
+static std::chrono::hours const FOLDER_ACTIVE_WINDOW(1);
+
+// LOAD_METADATA_DEADLINE / RETRY_METADATA_DEADLINE
+//
+// Time allowed to load the metadata for a single file, and for a file that timed out before
+static std::chrono::seconds const LOAD_METADATA_DEADLINE(10);
+static std::chrono::seconds const RETRY_METADATA_DEADLINE(30);
+
+// LOAD_METADATA_WINDOW
+//
+// Maximum number of files whose metadata is being loaded at the same time during discovery
+static size_t const LOAD_METADATA_WINDOW = 8;
+
+// BOUNDED_TEMP_CACHE_SIZE
+//
+// Page cache allowed for the temp schema (in KiB) when discovery runs with bounded memory
+static int const BOUNDED_TEMP_CACHE_SIZE = 2048;
+
+// DISCOVERY_ARENA_SIZE
+//
+// Block size of the arena that holds the per-file data of the discovery loop
+static size_t const DISCOVERY_ARENA_SIZE = 16 KiB;
+
+// MIN_DICTIONARY_SAMPLES
+//
+// Minimum number of recordings with a plot required to train the text dictionary
+static int const MIN_DICTIONARY_SAMPLES = 500;
+
+// g_commits
+//
+// Number of write transactions committed by all database connections
+static std::atomic<unsigned long long> g_commits{ 0 };
+
+// g_dictionary
+//
+// Dictionary used to compress the long text fields; shared by all database connections
+// and only ever accessed with std::atomic_load() and std::atomic_store()
+static std::shared_ptr<textdictionary const> g_dictionary;
+
 // FUNCTION PROTOTYPES
 //
-void load_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, scalar_condition<bool> const& cancel);
+bool load_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, enum directory_layout layout, 
+	bool incremental, pathindex const& paths, metadatapipeline& providers, scalar_condition<bool> const& cancel);
+static int64_t get_recording_key(void const* path, int length);
+static std::string get_root_prefix(char const* folder);
+static std::string smb_to_unc(char const* smb);
+static wchar_t const* to_unc_path(char const* path, arena& memory);
+static void to_wstring(char const* psz, int cch, std::wstring& result);
 
 //
 // HELPER FUNCTIONS
 //
 
-// get_filetime
+// assign_recording_key
 //
-// Retrieves a VT_FILETIME property from an IPropertyStore instance
-static FILETIME get_filetime(IPropertyStore* store, PROPERTYKEY const& key)
+// Assigns the key for a relative recording path; statement selects the rowid, recordingid and rootid of
+// the rows occupying the key slots of the path bound to ?1.  If the path already has a key under the
+// same root folder that key is reused, otherwise the first unoccupied slot is assigned
+static int64_t assign_recording_key(sqlite3* instance, sqlite3_stmt* statement, int64_t rootid, char const* path)
 {
-	PROPVARIANT				value;				// PROPVARIANT value
-	FILETIME				result{0, 0};		// Result from this function
+	uint32_t			occupied = 0;				// Bitmask of occupied key slots
+	int					result;						// Result from SQLite function
 
-	assert(store);
-	PropVariantInit(&value);
+	assert((instance) && (statement) && (path));
 
-	// Attempt to retrieve the value from the property store and set the result if successful
-	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_FILETIME)) result = value.filetime;
+	int length = static_cast<int>(strlen(path));
+	int64_t key = get_recording_key(path, length);
 
-	PropVariantClear(&value);
-	return result;
-}
+	result = sqlite3_bind_text(statement, 1, path, length, SQLITE_STATIC);
+	if(result != SQLITE_OK) throw sqlite_exception(result);
 
-// get_lpwstr
-//
-// Retrieves a VT_LPWSTR property from an IPropertyStore instance
-static std::wstring get_lpwstr(IPropertyStore* store, PROPERTYKEY const& key)
-{
-	PROPVARIANT				value;			// PROPVARIANT value
-	std::wstring			result;			// Result from this function
+	try {
 
-	assert(store);
-	PropVariantInit(&value);
+		while((result = sqlite3_step(statement)) == SQLITE_ROW) {
 
-	// Attempt to retrieve the value from the property store and set the result if successful
-	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_LPWSTR)) result = std::wstring(value.pwszVal);
+			int64_t rowid = sqlite3_column_int64(statement, 0);
+			char const* recordingid = reinterpret_cast<char const*>(sqlite3_column_text(statement, 1));
 
-	PropVariantClear(&value);
-	return result;
+			if((sqlite3_column_int64(statement, 2) == rootid) && (path_collation(nullptr, length, path, sqlite3_column_bytes(statement, 1), recordingid) == 0)) {
+
+				sqlite3_reset(statement);
+				return rowid;
+			}
+
+			occupied |= (1U << static_cast<unsigned int>(rowid - key));
+		}
+
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+		sqlite3_reset(statement);
+	}
+
+	catch(...) { sqlite3_reset(statement); throw; }
+
+	for(int slot = 0; slot < RECORDING_KEY_SLOTS; slot++) if((occupied & (1U << slot)) == 0) return key + slot;
+
+	throw string_exception(__func__, ": no key slots are available for recording ", path);
 }
 
-// get_ui4
+// check_active_recordings
 //
-// Retrieves a VT_UI4 property from an IPropertyStore instance
-static uint32_t get_ui4(IPropertyStore* store, PROPERTYKEY const& key)
+// Checks the recordings in a folder that may still be being written against the files; returns false if any of
+// them have changed size or modification time, or can no longer be found
+static bool check_active_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, long long since)
 {
-	PROPVARIANT				value;				// PROPVARIANT value
-	uint32_t				result = 0;			// Result from this function
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	struct __stat64				filestat;				// File information from the VFS
+	bool						unchanged = true;		// Flag if the recordings are unchanged
+	int							result;					// Result from SQLite function
 
-	assert(store);
-	PropVariantInit(&value);
+	assert((instance) && (callbacks) && (folder));
 
-	// Attempt to retrieve the value from the property store and set the result if successful
-	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_UI4)) result = value.ulVal;
+	std::string prefix = get_root_prefix(folder);
 
-	PropVariantClear(&value);
-	return result;
+	auto sql = "select root.path || recording.recordingid, recording.filesize, recording.filetime from root inner join recording on recording.rootid = root.rootid "
+		"where root.path = ?1 and recording.deletetime is null and recording.filetime >= ?2";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_text(statement, 1, prefix.c_str(), -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_int64(statement, 2, since);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		while((unchanged) && ((result = sqlite3_step(statement)) == SQLITE_ROW)) {
+
+			memset(&filestat, 0, sizeof(struct __stat64));
+			unchanged = ((callbacks->StatFile(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)), &filestat) == 0) &&
+				(static_cast<int64_t>(filestat.st_size) == sqlite3_column_int64(statement, 1)) &&
+				(static_cast<int64_t>(filestat.st_mtime) == sqlite3_column_int64(statement, 2)));
+		}
+
+		if((unchanged) && (result != SQLITE_DONE)) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		return unchanged;
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+// commit_hook
+//
+// SQLite commit hook callback used to count committed write transactions
+static int commit_hook(void* /*context*/)
+{
+	++g_commits;
+	return 0;					// Allow the commit to proceed
 }
 
-// get_ui8
+// compress_blob
 //
-// Retrieves a VT_UI8 property from an IPropertyStore instance
-static uint64_t get_ui8(IPropertyStore* store, PROPERTYKEY const& key)
+// SQL scalar function compress_blob(blob) that compresses binary data, null is returned unchanged
+static void compress_blob(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
-	PROPVARIANT				value;				// PROPVARIANT value
-	uint64_t				result = 0;			// Result from this function
+	std::string				compressed;			// Compressed data
 
-	assert(store);
-	PropVariantInit(&value);
+	if(argc != 1) return sqlite3_result_null(context);
+	if(sqlite3_value_type(argv[0]) == SQLITE_NULL) return sqlite3_result_null(context);
 
-	// Attempt to retrieve the value from the property store and set the result if successful
-	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_UI8)) result = value.uhVal.QuadPart;
+	try { compress_buffer(sqlite3_value_blob(argv[0]), static_cast<size_t>(sqlite3_value_bytes(argv[0])), compressed); }
+	catch(std::exception& ex) { return sqlite3_result_error(context, ex.what(), -1); }
 
-	PropVariantClear(&value);
-	return result;
+	sqlite3_result_blob(context, compressed.data(), static_cast<int>(compressed.size()), SQLITE_TRANSIENT);
 }
 
-// smb_to_unc
+// compress_text
 //
-// Converts an smb:// scheme path into a UNC path
-static std::string smb_to_unc(char const* smb)
+// SQL scalar function compress_text(text) that compresses text with the dictionary; the result
+// is a blob if the text was compressed, otherwise the original value is returned unchanged
+static void compress_text(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
-	if(smb == nullptr) return std::string();
+	std::string				compressed;			// Compressed text
 
-	// Check if this is an smb:// path
-	if(_strnicmp(smb, "smb://", 6) == 0) {
+	if(argc != 1) return sqlite3_result_null(context);
 
-		// Repalce smb:// with \\ and replace slashes with backslashes
-		std::string unc = std::string("\\\\") + &smb[6];
-		std::replace(unc.begin(), unc.end(), '/', '\\'); 
-		return unc;
+	std::shared_ptr<textdictionary const> dictionary = std::atomic_load(&g_dictionary);
+	if((dictionary) && (sqlite3_value_type(argv[0]) == SQLITE_TEXT)) {
+
+		char const* text = reinterpret_cast<char const*>(sqlite3_value_text(argv[0]));
+		if(dictionary->compress(text, static_cast<size_t>(sqlite3_value_bytes(argv[0])), compressed))
+			return sqlite3_result_blob(context, compressed.data(), static_cast<int>(compressed.size()), SQLITE_TRANSIENT);
 	}
 
-	else return std::string(smb);
+	sqlite3_result_value(context, argv[0]);
 }
 
-// to_wstring
+// copy_database
 //
-// Converts a UTF-8 character string into a UTF-16 std::wstring
-static std::wstring to_wstring(char const* psz, int cch)
+// Copies the entire contents of one database into another with the online backup API
+static void copy_database(sqlite3* source, sqlite3* destination)
 {
-	if(psz == nullptr) return std::wstring();
+	assert((source) && (destination));
 
-	// Create a buffer big enough to hold the converted string data and convert it
-	int buffercch = MultiByteToWideChar(CP_UTF8, 0, psz, cch, nullptr, 0);
-	auto buffer = std::make_unique<wchar_t[]>(buffercch);
-	MultiByteToWideChar(CP_UTF8, 0, psz, cch, buffer.get(), buffercch);
+	sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+	if(backup == nullptr) throw sqlite_exception(sqlite3_errcode(destination), sqlite3_errmsg(destination));
 
-	// Construct an std::wstring around the converted character data, watch for the API
-	// returning the length including the NULL character when -1 was provided as length
-	return std::wstring(buffer.get(), (cch == -1) ? buffercch - 1 : buffercch);
+	// Copy all of the pages in a single step, retrying for a while if either database is busy.  After a busy
+	// or locked step sqlite3_backup_finish() returns SQLITE_OK, only SQLITE_DONE means the copy is complete
+	int result = sqlite3_backup_step(backup, -1);
+	for(int retries = 0; ((result == SQLITE_BUSY) || (result == SQLITE_LOCKED)) && (retries < COPY_DATABASE_RETRIES); retries++) {
+
+		sqlite3_sleep(COPY_DATABASE_RETRY_DELAY);
+		result = sqlite3_backup_step(backup, -1);
+	}
+
+	int finished = sqlite3_backup_finish(backup);
+	if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(destination));
+	if(finished != SQLITE_OK) throw sqlite_exception(finished, sqlite3_errmsg(destination));
 }
 
+// execute_scalar_int
 //
-// CONNECTIONPOOL IMPLEMENTATION
-//
+// Executes a query that returns a single integer value
+static int64_t execute_scalar_int(sqlite3* instance, char const* sql)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int64_t						value = 0;				// Query result
+	int							result;					// Result from SQLite function
 
-//---------------------------------------------------------------------------
-// connectionpool Constructor
-//
-// Arguments:
-//
-//	connstring		- Database connection string
-//	flags			- Database connection flags
+	assert((instance) && (sql));
 
-connectionpool::connectionpool(char const* connstring, int flags) : m_connstr((connstring) ? connstring : ""), m_flags(flags)
-{
-	sqlite3*		handle = nullptr;		// Initial database connection
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-	if(connstring == nullptr) throw std::invalid_argument("connstring");
+	// An empty result set returns zero
+	result = sqlite3_step(statement);
+	if(result == SQLITE_ROW) value = sqlite3_column_int64(statement, 0);
+	sqlite3_finalize(statement);
 
-	// Create and pool the initial connection now to give the caller an opportunity
-	// to catch any exceptions during initialization of the database
-	handle = open_database(m_connstr.c_str(), m_flags, true);
-	m_connections.push_back(handle);
-	m_queue.push(handle);
+	if((result != SQLITE_ROW) && (result != SQLITE_DONE)) throw sqlite_exception(result, sqlite3_errmsg(instance));
+	return value;
 }
 
-//---------------------------------------------------------------------------
-// connectionpool Destructor
-
-connectionpool::~connectionpool()
+// expand_blob
+//
+// SQL scalar function expand_blob(blob) that decompresses binary data generated by compress_blob(), null
+// is returned unchanged
+static void expand_blob(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
-	// Close all of the connections that were created in the pool
-	for(auto const& iterator : m_connections) close_database(iterator);
+	std::string				expanded;			// Decompressed data
+
+	if(argc != 1) return sqlite3_result_null(context);
+	if(sqlite3_value_type(argv[0]) == SQLITE_NULL) return sqlite3_result_null(context);
+
+	try { decompress_buffer(sqlite3_value_blob(argv[0]), static_cast<size_t>(sqlite3_value_bytes(argv[0])), expanded); }
+	catch(std::exception& ex) { return sqlite3_result_error(context, ex.what(), -1); }
+
+	sqlite3_result_blob(context, expanded.data(), static_cast<int>(expanded.size()), SQLITE_TRANSIENT);
 }
 
-//---------------------------------------------------------------------------
-// connectionpool::acquire
-//
-// Acquires a database connection, opening a new one if necessary
-//
-// Arguments:
+// expand_text
 //
-//	NONE
-
-sqlite3* connectionpool::acquire(void)
+// SQL scalar function expand_text(value) that decompresses a blob generated by compress_text(); any
+// other value is returned unchanged
+static void expand_text(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
-	sqlite3* handle = nullptr;				// Handle to return to the caller
-
-	std::unique_lock<std::mutex> lock(m_lock);
+	std::string				text;				// Decompressed text
 
-	if(m_queue.empty()) {
+	if(argc != 1) return sqlite3_result_null(context);
+	if(sqlite3_value_type(argv[0]) != SQLITE_BLOB) return sqlite3_result_value(context, argv[0]);
 
-		// No connections are available, open a new one using the same flags
-		handle = open_database(m_connstr.c_str(), m_flags, false);
-		m_connections.push_back(handle);
-	}
+	std::shared_ptr<textdictionary const> dictionary = std::atomic_load(&g_dictionary);
+	if(!dictionary) return sqlite3_result_error(context, "expand_text: the text dictionary has not been loaded", -1);
 
-	// At least one connection is available for reuse
-	else { handle = m_queue.front(); m_queue.pop(); }
+	try { dictionary->decompress(sqlite3_value_blob(argv[0]), static_cast<size_t>(sqlite3_value_bytes(argv[0])), text); }
+	catch(std::exception& ex) { return sqlite3_result_error(context, ex.what(), -1); }
 
-	return handle;
+	sqlite3_result_text(context, text.data(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
 }
 
-//---------------------------------------------------------------------------
-// connectionpool::release
-//
-// Releases a database handle acquired from the pool
-//
-// Arguments:
+// get_fingerprint
 //
-//	handle		- Handle to be releases
-
-void connectionpool::release(sqlite3* handle)
+// Generates the 64-bit FNV-1a hash used to match duplicate recordings; the title is combined with the season/episode
+// numbers if present, otherwise the episode name.  The program description is not used, a series often shares one
+// generic synopsis across every episode; recordings without either are never fingerprinted
+static uint64_t get_fingerprint(char const* title, int seriesnumber, int episodenumber, char const* episodename)
 {
-	std::unique_lock<std::mutex> lock(m_lock);
+	uint64_t			hash = 14695981039346656037ULL;		// FNV-1a offset basis
 
-	if(handle == nullptr) throw std::invalid_argument("handle");
+	// Only ASCII letters and digits are considered and are folded to lower case, anything
+	// outside of ASCII is kept as-is so that non-Latin titles still generate a usable key
+	auto append = [&](char const* str) -> size_t {
 
-	m_queue.push(handle);
-}
+		size_t length = 0;
+		for(char const* ch = str; (ch) && (*ch); ch++) {
 
-//---------------------------------------------------------------------------
-// close_database
-//
-// Closes a SQLite database handle
-//
-// Arguments:
-//
-//	instance	- Database instance handle to be closed
+			unsigned char uch = static_cast<unsigned char>(*ch);
+			if((uch < 0x80) && (!isalnum(uch))) continue;
 
-void close_database(sqlite3* instance)
-{
-	if(instance) sqlite3_close(instance);
+			hash = (hash ^ ((uch < 0x80) ? static_cast<unsigned char>(tolower(uch)) : uch)) * 1099511628211ULL;
+			++length;
+		}
+
+		return length;
+	};
+
+	if(append(title) == 0) return 0;
+	hash = (hash ^ 0x1F) * 1099511628211ULL;
+
+	if((seriesnumber > 0) && (episodenumber > 0)) {
+
+		std::string episode = "s" + std::to_string(seriesnumber) + "e" + std::to_string(episodenumber);
+		append(episode.c_str());
+		return hash;
+	}
+
+	return (append(episodename) > 0) ? hash : 0;
 }
 
-//---------------------------------------------------------------------------
-// delete_recording
-//
-// Deletes a recording from the database instance
-//
-// Arguments:
+// get_folder_mtime
 //
-//	instance		- Database instance
-//	callbacks		- addoncallbacks instance
-//	recordingid		- Recording ID (CmdURL) of the item to delete
-
-void delete_recording(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* recordingid)
+// Retrieves the modification time of a folder when it was last listed, or zero if it hasn't been
+static long long get_folder_mtime(sqlite3* instance, char const* folderid)
 {
 	sqlite3_stmt*				statement;				// SQL statement to execute
+	long long					mtime = 0;				// Cached modification time
 	int							result;					// Result from SQLite function
-	bool						deletefile = false;		// Flag to delete the file itself
 
-	if((instance == nullptr) || (callbacks == nullptr) || (recordingid == nullptr)) return;
+	assert((instance) && (folderid));
 
-	// Prepare a query to delete the recording from the database
-	auto sql = "delete from recording where recordingid like ?1";
+	auto sql = "select mtime from folder where folderid = ?1";
 	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
 	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
 	try {
 
 		// Bind the query parameter(s)
-		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		result = sqlite3_bind_text(statement, 1, folderid, -1, SQLITE_STATIC);
 		if(result != SQLITE_OK) throw sqlite_exception(result);
 
-		// Execute the query - no result set is expected
+		// Execute the scalar query; a missing row leaves the modification time at zero
 		result = sqlite3_step(statement);
-		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
-		if(result != SQLITE_DONE) throw sqlite_exception(result);
-
-		sqlite3_finalize(statement);			// Finalize the SQLite statement
+		if(result == SQLITE_ROW) mtime = sqlite3_column_int64(statement, 0);
+		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-		// If the query deleted any rows from the database, also remove the file
-		deletefile = (sqlite3_changes(instance) > 0);
+		sqlite3_finalize(statement);
+		return mtime;
 	}
 
-	catch (...) { sqlite3_finalize(statement); throw; }
-
-	// Attempt to delete the actual file if it was removed from the database
-	if((deletefile) && (!callbacks->DeleteFile(recordingid)))
-		throw string_exception(__func__, ": unable to delete recorded TV file ", recordingid);
+	catch(...) { sqlite3_finalize(statement); throw; }
 }
 
-//---------------------------------------------------------------------------
-// discover_recordings
-//
-// Reloads the information about the available recordings
-//
-// Arguments:
+// get_pragma_int
 //
-//	instance	- SQLite database instance
-//	callbacks	- addoncallbacks instance
-//	folder		- Location of the recorded TV files
-//	cancel		- Condition variable used to cancel the operation
-//	changed		- Flag indicating if the data has changed
-
-void discover_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, scalar_condition<bool> const& cancel, bool& changed)
+// Retrieves the value of a pragma that returns a single integer
+static int64_t get_pragma_int(sqlite3* instance, char const* pragma)
 {
-	changed = false;							// Initialize [out] argument
+	assert((instance) && (pragma));
 
-	if(instance == nullptr) throw std::invalid_argument("instance");
-	if(callbacks == nullptr) throw std::invalid_argument("callbacks");
-	
-	// Clone the recording table schema into a temporary table
-	execute_non_query(instance, "drop table if exists discover_recording");
-	execute_non_query(instance, "create temp table discover_recording as select * from recording limit 0");
+	return execute_scalar_int(instance, (std::string("pragma ") + pragma).c_str());
+}
 
-	try {
+// get_reconcile_time
+//
+// Retrieves the time a folder was last fully reconciled with the catalog, or zero if it hasn't been
+static long long get_reconcile_time(sqlite3* instance, char const* folderid)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	long long					reconciletime = 0;		// Time of the last reconcile
+	int							result;					// Result from SQLite function
 
-		// Loading the discover_recording temp table is horrible; broken out into a helper function
-		load_recordings(instance, callbacks, folder, cancel);
-		
-		// This requires a multi-step operation against the recording table; start a transaction
-		execute_non_query(instance, "begin immediate transaction");
+	assert((instance) && (folderid));
 
-		try {
+	auto sql = "select reconciletime from reconcile where folderid = ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-			// Delete any entries in the main recording table that are no longer present in the data
-			if(execute_non_query(instance, "delete from recording where recordingid not in (select recordingid from discover_recording)") > 0) changed = true;
+	try {
 
-			// Insert entries in the main recording table that are new (not checking for differences here)
-			if(execute_non_query(instance, "insert into recording select * from discover_recording where lower(recordingid) not in (select lower(recordingid) from recording)") > 0) changed = true;
+		// Bind the query parameter(s)
+		result = sqlite3_bind_text(statement, 1, folderid, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
 
-			// Commit the database transaction
-			execute_non_query(instance, "commit transaction");
-		}
-		
-		// Rollback the transaction on any exception
-		catch(...) { try_execute_non_query(instance, "rollback transaction"); throw; }
+		// Execute the scalar query; a missing row leaves the time at zero
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) reconciletime = sqlite3_column_int64(statement, 0);
+		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-		// Drop the temporary table
-		execute_non_query(instance, "drop table discover_recording");
+		sqlite3_finalize(statement);
+		return reconciletime;
 	}
 
-	// Drop the temporary table on any exception
-	catch(...) { execute_non_query(instance, "drop table discover_recording"); throw; }
+	catch(...) { sqlite3_finalize(statement); throw; }
 }
 
-//---------------------------------------------------------------------------
-// enumerate_recordings
-//
-// Enumerates the available recordings
-//
-// Arguments:
+// get_recording_key
 //
-//	instance	- Database instance
-//	callback	- Callback function
+// Generates the first key for a recording path; the low bits are left clear to number the slots
+// available to paths with the same hash, and the high bit is left clear to keep the key positive
+static int64_t get_recording_key(void const* path, int length)
+{
+	return static_cast<int64_t>(path_hash(path, length) & (0x7FFFFFFFFFFFFFFFULL & ~static_cast<uint64_t>(RECORDING_KEY_SLOTS - 1)));
+}
 
-void enumerate_recordings(sqlite3* instance, enumerate_recordings_callback callback)
+// get_recording_root
+//
+// Gets the identifier of the root folder with the specified path prefix, adding it if necessary
+static int64_t get_recording_root(sqlite3* instance, char const* prefix)
 {
-	sqlite3_stmt*				statement;			// SQL statement to execute
-	int							result;				// Result from SQLite function
-	
-	if((instance == nullptr) || (callback == nullptr)) return;
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int64_t						rootid = 0;				// Root folder identifier
+	int							result;					// Result from SQLite function
 
-	// recordingid | title | episodename | seriesnumber | episodenumber | year | streamurl | directory | plot | channelname | recordingtime | duration
-	auto sql = "select recordingid, title, episodename, seriesnumber, episodenumber, year, streamurl, directory, plot, "
-		"channelname, recordingtime, duration from recording";
+	assert((instance) && (prefix));
 
+	auto sql = "insert or ignore into root(path) values(?1)";
 	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
 	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
 	try {
 
+		result = sqlite3_bind_text(statement, 1, prefix, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	sql = "select rootid from root where path = ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_text(statement, 1, prefix, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) rootid = sqlite3_column_int64(statement, 0);
+		else throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		return rootid;
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+// get_relative_path
+//
+// Gets the portion of a path relative to a root folder prefix, or nullptr if it's not in that folder
+static char const* get_relative_path(char const* path, std::string const& prefix)
+{
+	assert(path);
+
+	size_t length = strlen(path);
+	if(length < prefix.size()) return nullptr;
+
+	int prefixlen = static_cast<int>(prefix.size());
+	return (path_collation(nullptr, prefixlen, path, prefixlen, prefix.data()) == 0) ? path + prefix.size() : nullptr;
+}
+
+// get_renamed_path
+//
+// Generates the new path for a recording file after its title has been changed
+static std::string get_renamed_path(char const* recordingid, char const* title)
+{
+	assert((recordingid) && (title));
+
+	std::string path(recordingid);
+
+	size_t separator = path.find_last_of("/\\");
+	if(separator == std::string::npos) throw string_exception(__func__, ": invalid recording path ", recordingid);
+
+	// Media Center names the files [TITLE]_[CHANNEL]_[YYYY]_[MM]_[DD]_[HH]_[MM]_[SS].wtv; keep everything after
+	// the title so that the new file name still sorts and reads the same way, otherwise just keep the extension
+	size_t suffix = path.size();
+	for(int count = 0; count < 7; count++) {
+
+		suffix = (suffix > separator + 1) ? path.find_last_of('_', suffix - 1) : std::string::npos;
+		if((suffix == std::string::npos) || (suffix <= separator)) { suffix = path.find_last_of('.'); break; }
+	}
+
+	if((suffix == std::string::npos) || (suffix <= separator)) suffix = path.size();
+
+	// Replace any characters that can't be used in a file name
+	std::string filename(title);
+	for(auto& ch : filename) if((static_cast<unsigned char>(ch) < 0x20) || (strchr("\\/:*?\"<>|", ch) != nullptr)) ch = '_';
+
+	// Trailing periods and spaces are not allowed at the end of a file name
+	filename.erase(filename.find_last_not_of(". ") + 1);
+	if(filename.empty()) throw string_exception(__func__, ": invalid recording title ", title);
+
+	return path.substr(0, separator + 1) + filename + path.substr(suffix);
+}
+
+// get_root_prefix
+//
+// Generates the path prefix of a root folder; the prefix always ends with a separator so that
+// the full path of a recording is the prefix followed by the relative path
+static std::string get_root_prefix(char const* folder)
+{
+	assert(folder);
+
+	std::string prefix(folder);
+	if(prefix.empty()) return prefix;
+
+	char last = prefix.back();
+	if((last != '/') && (last != '\\')) prefix.push_back((prefix.find("://") != std::string::npos) ? '/' : '\\');
+
+	return prefix;
+}
+
+// get_trash_path
+//
+// Generates the path a recording file is moved to when it's deleted
+static std::string get_trash_path(char const* recordingid, time_t deletetime, std::string& trashfolder)
+{
+	assert(recordingid);
+
+	std::string path(recordingid);
+
+	// The trash folder is created alongside the recording file so that it's on the same volume
+	size_t separator = path.find_last_of("/\\");
+	if(separator == std::string::npos) throw string_exception(__func__, ": invalid recording path ", recordingid);
+
+	trashfolder = path.substr(0, separator + 1) + TRASH_FOLDER;
+
+	// Prefix the file name with the deletion time in case the same file name gets deleted more than once
+	return trashfolder + path[separator] + std::to_string(static_cast<long long>(deletetime)) + "-" + path.substr(separator + 1);
+}
+
+// load_dictionary
+//
+// Loads the text dictionary stored in the database, if one has been trained
+static void load_dictionary(sqlite3* instance)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
+
+	assert(instance);
+
+	result = sqlite3_prepare_v2(instance, "select words from dictionary where dictionaryid = 1", -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		std::shared_ptr<textdictionary const> dictionary;
+		if(sqlite3_step(statement) == SQLITE_ROW)
+			dictionary = std::make_shared<textdictionary>(sqlite3_column_blob(statement, 0), static_cast<size_t>(sqlite3_column_bytes(statement, 0)));
+
+		std::atomic_store(&g_dictionary, dictionary);
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+// merge_discover_recordings
+//
+// Applies the discover_recording table to the recording table with a merge join of both tables in
+// key order; only the keys of the changed recordings are staged, in temp tables that can spill
+static bool merge_discover_recordings(sqlite3* instance)
+{
+	sqlite3_stmt*				recordings = nullptr;	// Cursor over the recording table
+	sqlite3_stmt*				discovered = nullptr;	// Cursor over the discover_recording table
+	sqlite3_stmt*				stagedelete = nullptr;	// Stages a recording to be deleted
+	sqlite3_stmt*				stageinsert = nullptr;	// Stages a discovered recording to be inserted
+	int							result;					// Result from SQLite function
+	bool						changed = false;		// Flag if the recording table changed
+
+	assert(instance);
+
+	execute_non_query(instance, "create temp table discover_delete(rowid integer primary key)");
+	execute_non_query(instance, "create temp table discover_insert(rowid integer primary key)");
+
+	// Drops the staging tables; called on both the success and the failure path
+	auto drop_staging = [&]() -> void {
+
+		try_execute_non_query(instance, "drop table discover_insert");
+		try_execute_non_query(instance, "drop table discover_delete");
+	};
+
+	try {
+
+		// Prepares one of the statements; sqlite3_finalize() accepts the ones left null on failure
+		auto prepare = [&](char const* sql, sqlite3_stmt** statement) -> void {
+
+			result = sqlite3_prepare_v2(instance, sql, -1, statement, nullptr);
+			if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+		};
+
+		// Both cursors walk the tables in key order; a path is assigned the same key in both tables
+		prepare("select rowid, filesize, filetime, deletetime from recording order by rowid", &recordings);
+		prepare("select rowid, filesize, filetime from discover_recording order by rowid", &discovered);
+		prepare("insert into discover_delete values(?1)", &stagedelete);
+		prepare("insert into discover_insert values(?1)", &stageinsert);
+
+		// Steps one of the cursors, returns false once it has been exhausted
+		auto step = [&](sqlite3_stmt* statement) -> bool {
+
+			result = sqlite3_step(statement);
+			if((result != SQLITE_ROW) && (result != SQLITE_DONE)) throw sqlite_exception(result, sqlite3_errmsg(instance));
+			return (result == SQLITE_ROW);
+		};
+
+		// Stages a rowid into one of the staging tables
+		auto stage = [&](sqlite3_stmt* statement, sqlite3_int64 rowid) -> void {
+
+			sqlite3_bind_int64(statement, 1, rowid);
+			result = sqlite3_step(statement);
+			sqlite3_reset(statement);
+			if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+		};
+
+		bool haverecording = step(recordings);
+		bool havediscovered = step(discovered);
+
+		while(haverecording || havediscovered) {
+
+			int compare = 0;
+
+			// An exhausted cursor sorts after everything remaining in the other one
+			if(!haverecording) compare = 1;
+			else if(!havediscovered) compare = -1;
+			else {
+
+				sqlite3_int64 lhs = sqlite3_column_int64(recordings, 0);
+				sqlite3_int64 rhs = sqlite3_column_int64(discovered, 0);
+				compare = (lhs < rhs) ? -1 : ((lhs > rhs) ? 1 : 0);
+			}
+
+			bool deleted = (haverecording) && (sqlite3_column_type(recordings, 3) != SQLITE_NULL);
+
+			// Recording is no longer present; recordings in the trash are not listed
+			if(compare < 0) {
+
+				if(!deleted) stage(stagedelete, sqlite3_column_int64(recordings, 0));
+				haverecording = step(recordings);
+			}
+
+			// Recording is new
+			else if(compare > 0) {
+
+				stage(stageinsert, sqlite3_column_int64(discovered, 0));
+				havediscovered = step(discovered);
+			}
+
+			// Recording is present in both; replace it if the file itself has changed (filesize and filetime
+			// are compared with the same semantics as IS NOT, a null only matches another null)
+			else {
+
+				if((!deleted) && ((sqlite3_column_type(recordings, 1) != sqlite3_column_type(discovered, 1)) ||
+					(sqlite3_column_int64(recordings, 1) != sqlite3_column_int64(discovered, 1)) ||
+					(sqlite3_column_type(recordings, 2) != sqlite3_column_type(discovered, 2)) ||
+					(sqlite3_column_int64(recordings, 2) != sqlite3_column_int64(discovered, 2)))) {
+
+					stage(stagedelete, sqlite3_column_int64(recordings, 0));
+					stage(stageinsert, sqlite3_column_int64(discovered, 0));
+				}
+
+				haverecording = step(recordings);
+				havediscovered = step(discovered);
+			}
+		}
+
+		sqlite3_finalize(stageinsert);			// Finalize the SQLite statement
+		sqlite3_finalize(stagedelete);			// Finalize the SQLite statement
+		sqlite3_finalize(discovered);			// Finalize the SQLite statement
+		sqlite3_finalize(recordings);			// Finalize the SQLite statement
+	}
+
+	catch(...) { sqlite3_finalize(stageinsert); sqlite3_finalize(stagedelete); sqlite3_finalize(discovered); sqlite3_finalize(recordings); drop_staging(); throw; }
+
+	try {
+
+		// With both cursors closed the staged changes can be applied with key lookups
+		if(execute_non_query(instance, "delete from recording where rowid in (select rowid from discover_delete)") > 0) changed = true;
+		if(execute_non_query(instance, "insert into recording select * from discover_recording where rowid in (select rowid from discover_insert)") > 0) changed = true;
+
+		drop_staging();
+	}
+
+	catch(...) { drop_staging(); throw; }
+
+	return changed;
+}
+
+// move_file
+//
+// Renames a file, which must remain on the same volume
+static void move_file(char const* from, char const* to)
+{
+	std::wstring			widefrom;			// UTF-16 source path
+	std::wstring			wideto;				// UTF-16 destination path
+
+	assert((from) && (to));
+
+	// Convert smb:// paths into unc paths; won't affect local paths (like "D:\")
+	std::string uncfrom = smb_to_unc(from);
+	std::string uncto = smb_to_unc(to);
+	to_wstring(uncfrom.data(), static_cast<int>(uncfrom.size()), widefrom);
+	to_wstring(uncto.data(), static_cast<int>(uncto.size()), wideto);
+
+	// MOVEFILE_COPY_ALLOWED is not specified; this is only ever expected to be a rename
+	if(!MoveFileExW(widefrom.c_str(), wideto.c_str(), 0))
+		throw string_exception(__func__, ": unable to move file ", from, " to ", to, " (", GetLastError(), ")");
+}
+
+// recording_directory
+//
+// SQL scalar function recording_directory(title, seriesnumber, layout) that generates the
+// Kodi directory for a recording; Kodi uses forward slashes to separate the levels
+static void recording_directory(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+	if((argc != 3) || (sqlite3_value_type(argv[0]) == SQLITE_NULL)) return sqlite3_result_null(context);
+
+	char const* title = reinterpret_cast<char const*>(sqlite3_value_text(argv[0]));
+	int seriesnumber = sqlite3_value_int(argv[1]);
+	enum directory_layout layout = static_cast<enum directory_layout>(sqlite3_value_int(argv[2]));
+
+	if(layout == directory_layout::none) return sqlite3_result_text(context, "", 0, SQLITE_STATIC);
+
+	// A slash in the title would be treated as another directory level
+	std::string directory(title);
+	std::replace(directory.begin(), directory.end(), '/', '-');
+
+	// Recordings without a season number remain in the series folder
+	if((layout == directory_layout::season) && (seriesnumber > 0)) directory.append("/Season ").append(std::to_string(seriesnumber));
+
+	sqlite3_result_text(context, directory.data(), static_cast<int>(directory.size()), SQLITE_TRANSIENT);
+}
+
+// recording_key
+//
+// SQL scalar function recording_key(path) that generates the first key for a recording path
+static void recording_key(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+	if((argc != 1) || (sqlite3_value_type(argv[0]) == SQLITE_NULL)) return sqlite3_result_null(context);
+
+	// sqlite3_value_text() has to be called before sqlite3_value_bytes() for the length to be of the UTF-8 text
+	unsigned char const* path = sqlite3_value_text(argv[0]);
+	sqlite3_result_int64(context, get_recording_key(path, sqlite3_value_bytes(argv[0])));
+}
+
+// set_folder_mtime
+//
+// Replaces the modification time of the listed folder; a zero modification time is not cached
+static void set_folder_mtime(sqlite3* instance, char const* folderid, long long mtime)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
+
+	assert((instance) && (folderid));
+
+	// Only one folder is discovered at a time, remove anything that was previously cached
+	execute_non_query(instance, "delete from folder");
+	if(mtime == 0) return;
+
+	auto sql = "insert into folder values(?1, ?2)";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_text(statement, 1, folderid, -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_int64(statement, 2, mtime);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result);
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+// set_reconcile_time
+//
+// Replaces the time the folder was last fully reconciled with the catalog; a zero time is not cached
+static void set_reconcile_time(sqlite3* instance, char const* folderid, long long reconciletime)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
+
+	assert((instance) && (folderid));
+
+	// Only one folder is discovered at a time, remove anything that was previously cached
+	execute_non_query(instance, "delete from reconcile");
+	if(reconciletime == 0) return;
+
+	auto sql = "insert into reconcile values(?1, ?2)";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_text(statement, 1, folderid, -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_int64(statement, 2, reconciletime);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result);
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+// smb_to_unc
+//
+// Converts an smb:// scheme path into a UNC path
+static std::string smb_to_unc(char const* smb)
+{
+	if(smb == nullptr) return std::string();
+
+	// Check if this is an smb:// path
+	if(_strnicmp(smb, "smb://", 6) == 0) {
+
+		// Repalce smb:// with \\ and replace slashes with backslashes
+		std::string unc = std::string("\\\\") + &smb[6];
+		std::replace(unc.begin(), unc.end(), '/', '\\'); 
+		return unc;
+	}
+
+	else return std::string(smb);
+}
+
+// to_unc_path
+//
+// Converts a UTF-8 path into a null-terminated UTF-16 path allocated from an arena; smb:// paths
+// are converted into UNC paths, local paths (like "D:\") are only converted to UTF-16
+static wchar_t const* to_unc_path(char const* path, arena& memory)
+{
+	assert(path);
+
+	// Replace smb:// with \\ and replace the slashes with backslashes
+	bool smb = (_strnicmp(path, "smb://", 6) == 0);
+	if(smb) path += 6;
+
+	// The length returned by the API includes the NULL character when -1 is provided as the length
+	int cch = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+	if(cch <= 0) throw string_exception(__func__, ": unable to convert path ", path, " to UTF-16");
+
+	wchar_t* result = memory.allocate<wchar_t>(static_cast<size_t>(cch) + 2);
+	wchar_t* converted = (smb) ? result + 2 : result;
+
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, converted, cch);
+	if(smb) {
+
+		result[0] = result[1] = L'\\';
+		for(wchar_t* current = converted; *current != L'\0'; current++) if(*current == L'/') *current = L'\\';
+	}
+
+	return result;
+}
+
+// to_wstring
+//
+// Converts a UTF-8 character string into a UTF-16 std::wstring, the existing
+// capacity of the string is reused if it is large enough
+static void to_wstring(char const* psz, int cch, std::wstring& result)
+{
+	result.clear();
+	if((psz == nullptr) || (cch == 0)) return;
+
+	// Size the string to hold the converted data and convert it in place, watch for the API
+	// returning the length including the NULL character when -1 was provided as length
+	int buffercch = MultiByteToWideChar(CP_UTF8, 0, psz, cch, nullptr, 0);
+	if(buffercch <= 0) return;
+
+	result.resize(buffercch);
+	MultiByteToWideChar(CP_UTF8, 0, psz, cch, &result[0], buffercch);
+	if(cch == -1) result.resize(buffercch - 1);
+}
+
+//
+// CONNECTIONPOOL IMPLEMENTATION
+//
+
+//---------------------------------------------------------------------------
+// connectionpool Constructor
+//
+// Arguments:
+//
+//	connstring		- Database connection string
+//	flags			- Database connection flags
+
+connectionpool::connectionpool(char const* connstring, int flags) : m_connstr((connstring) ? connstring : ""), m_flags(flags)
+{
+	sqlite3*		handle = nullptr;		// Initial database connection
+
+	if(connstring == nullptr) throw std::invalid_argument("connstring");
+
+	// Create and pool the initial connection now to give the caller an opportunity
+	// to catch any exceptions during initialization of the database
+	handle = open_database(m_connstr.c_str(), m_flags, true);
+	m_connections.push_back(handle);
+	m_queue.push(handle);
+}
+
+//---------------------------------------------------------------------------
+// connectionpool Destructor
+
+connectionpool::~connectionpool()
+{
+	// Close all of the connections that were created in the pool
+	for(auto const& iterator : m_connections) close_database(iterator);
+}
+
+//---------------------------------------------------------------------------
+// connectionpool::acquire
+//
+// Acquires a database connection, opening a new one if necessary
+//
+// Arguments:
+//
+//	NONE
+
+sqlite3* connectionpool::acquire(void)
+{
+	sqlite3* handle = nullptr;				// Handle to return to the caller
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	if(m_queue.empty()) {
+
+		// No connections are available, open a new one using the same flags
+		handle = open_database(m_connstr.c_str(), m_flags, false);
+		m_connections.push_back(handle);
+	}
+
+	// At least one connection is available for reuse
+	else { handle = m_queue.front(); m_queue.pop(); }
+
+	return handle;
+}
+
+//---------------------------------------------------------------------------
+// connectionpool::release
+//
+// Releases a database handle acquired from the pool
+//
+// Arguments:
+//
+//	handle		- Handle to be releases
+
+void connectionpool::release(sqlite3* handle)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	if(handle == nullptr) throw std::invalid_argument("handle");
+
+	m_queue.push(handle);
+}
+
+//---------------------------------------------------------------------------
+// backfill_recording_metadata
+//
+// Decodes the recording columns added since the raw metadata was cached; the cached raw metadata is
+// decoded again by the provider that loaded it rather than reading every recording file again
+//
+// Arguments:
+//
+//	instance	- Database instance
+//	providers	- Metadata provider pipeline
+
+int backfill_recording_metadata(sqlite3* instance, metadatapipeline& providers)
+{
+	sqlite3_stmt*				statement = nullptr;	// SQL statement to execute
+	sqlite3_stmt*				update = nullptr;		// SQL statement to update a recording
+	recording_metadata			metadata;				// Metadata decoded from the raw metadata
+	int							backfilled = 0;			// Number of recordings updated
+	int							result;					// Result from SQLite function
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	// Nothing to do if all of the raw metadata was cached with the current version
+	if(execute_scalar_int(instance, (std::string("select exists(select 1 from rawmetadata where version < ") + std::to_string(METADATA_VERSION) + ")").c_str()) == 0) return 0;
+
+	// Binds a decoded value to the update statement if the assignments for the version refer to it
+	auto bind_text = [&](char const* name, std::string const& value) -> void {
+
+		int index = sqlite3_bind_parameter_index(update, name);
+		if(index != 0) sqlite3_bind_text(update, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+	};
+
+	auto bind_int = [&](char const* name, int value) -> void {
+
+		int index = sqlite3_bind_parameter_index(update, name);
+		if(index != 0) sqlite3_bind_int(update, index, value);
+	};
+
+	// This is a multi-step operation against the recording table; start a transaction
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		for(int version = 1; version < METADATA_VERSION; version++) {
+
+			// Collect the assignments of the columns added after this version
+			std::string assignments;
+			for(int added = version + 1; added <= METADATA_VERSION; added++) {
+
+				if(BACKFILL_COLUMNS[added] == nullptr) continue;
+				if(!assignments.empty()) assignments.append(", ");
+				assignments.append(BACKFILL_COLUMNS[added]);
+			}
+
+			if(assignments.empty()) continue;
+
+			auto sql = "select recordingkey, format, expand_blob(data) from rawmetadata where version = ?1";
+			result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+			if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			auto updatesql = "update recording set " + assignments + " where rowid = :recordingkey";
+			result = sqlite3_prepare_v2(instance, updatesql.c_str(), -1, &update, nullptr);
+			if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			result = sqlite3_bind_int(statement, 1, version);
+			if(result != SQLITE_OK) throw sqlite_exception(result);
+
+			while((result = sqlite3_step(statement)) == SQLITE_ROW) {
+
+				char const* format = reinterpret_cast<char const*>(sqlite3_column_text(statement, 1));
+				void const* data = sqlite3_column_blob(statement, 2);
+				size_t length = static_cast<size_t>(sqlite3_column_bytes(statement, 2));
+
+				// Raw metadata that can't be decoded anymore leaves the recording as it is
+				try { if((format == nullptr) || (!providers.decode(format, data, length, metadata))) continue; }
+				catch(std::exception&) { continue; }
+
+				sqlite3_bind_int64(update, sqlite3_bind_parameter_index(update, ":recordingkey"), sqlite3_column_int64(statement, 0));
+				bind_text(":episodename", metadata.episodename);
+				bind_int(":seriesnumber", metadata.seriesnumber);
+				bind_int(":episodenumber", metadata.episodenumber);
+				bind_int(":year", metadata.year);
+				bind_text(":plot", metadata.plot);
+				bind_text(":channelname", metadata.channelname);
+				bind_int(":recordingtime", metadata.recordingtime);
+				bind_int(":duration", metadata.duration);
+				bind_int(":ishd", (metadata.ishd) ? 1 : 0);
+
+				result = sqlite3_step(update);
+				sqlite3_reset(update);
+				if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+				backfilled += sqlite3_changes(instance);
+			}
+
+			if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			sqlite3_finalize(update);
+			sqlite3_finalize(statement);
+			update = statement = nullptr;
+		}
+
+		// The raw metadata that couldn't be decoded is marked as well, it would fail the same way next time
+		execute_non_query(instance, (std::string("update rawmetadata set version = ") + std::to_string(METADATA_VERSION) + " where version < " + std::to_string(METADATA_VERSION)).c_str());
+
+		execute_non_query(instance, "commit transaction");
+	}
+
+	catch(...) { sqlite3_finalize(update); sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
+
+	return backfilled;
+}
+
+//---------------------------------------------------------------------------
+// backup_database
+//
+// Persists the contents of a database instance to a database file
+//
+// Arguments:
+//
+//	instance		- Database instance to be persisted
+//	connstring		- Destination database connection string
+//	flags			- Destination database open flags (see sqlite3_open_v2)
+
+void backup_database(sqlite3* instance, char const* connstring, int flags)
+{
+	sqlite3*			destination = nullptr;		// Destination database instance
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if(connstring == nullptr) throw std::invalid_argument("connstring");
+
+	int result = sqlite3_open_v2(connstring, &destination, flags, nullptr);
+	if(result != SQLITE_OK) { sqlite3_close(destination); throw sqlite_exception(result); }
+
+	sqlite3_busy_timeout(destination, 30000);
+
+	try { copy_database(instance, destination); }
+	catch(...) { sqlite3_close(destination); throw; }
+
+	sqlite3_close(destination);
+}
+
+//---------------------------------------------------------------------------
+// check_recording_metadata
+//
+// Verifies that the metadata needed to identify a recording was decoded from the file
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	recordingkey	- Recording key
+
+void check_recording_metadata(sqlite3* instance, int64_t recordingkey)
+{
+	sqlite3_stmt*				statement;				// Database query statement
+	int							result;					// Result from SQLite function call
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	auto sql = "select length(title) from recording where rowid = ?1 and deletetime is null";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_int64(statement, 1, recordingkey);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// A recording that was deleted or has no title can't be identified by the jobs that depend on this one
+		result = sqlite3_step(statement);
+		if((result != SQLITE_ROW) && (result != SQLITE_DONE)) throw sqlite_exception(result, sqlite3_errmsg(instance));
+		if((result == SQLITE_DONE) || (sqlite3_column_int(statement, 0) == 0)) throw string_exception(__func__, ": recording ", recordingkey, " has no title");
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// close_database
+//
+// Closes a SQLite database handle
+//
+// Arguments:
+//
+//	instance	- Database instance handle to be closed
+
+void close_database(sqlite3* instance)
+{
+	if(instance) sqlite3_close(instance);
+}
+
+//---------------------------------------------------------------------------
+// compact_database
+//
+// Releases a slice of the free pages in the database and refreshes the query planner statistics
+//
+// Arguments:
+//
+//	instance	- Database instance
+//	maxpages	- Maximum number of free pages to release
+
+int compact_database(sqlite3* instance, int maxpages)
+{
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	// Nothing can be released unless the database is in incremental auto_vacuum mode
+	if(get_pragma_int(instance, "auto_vacuum") != 2) return 0;
+
+	int64_t before = get_pragma_int(instance, "freelist_count");
+	if(before > 0) execute_non_query(instance, (std::string("pragma incremental_vacuum(") + std::to_string(maxpages) + ")").c_str());
+
+	// Only run the optimizer once the free pages have all been released
+	int64_t after = get_pragma_int(instance, "freelist_count");
+	if(after == 0) execute_non_query(instance, "pragma optimize");
+
+	return static_cast<int>(before - after);
+}
+
+//---------------------------------------------------------------------------
+// delete_duplicate_recordings
+//
+// Moves all but the best copy of each duplicate recording into the trash
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	paths			- Index of known recording paths to be updated
+//	cancel			- Condition variable used to cancel the operation
+
+int delete_duplicate_recordings(sqlite3* instance, pathindex& paths, scalar_condition<bool> const& cancel)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	std::vector<std::pair<int64_t, std::string>> recordings;	// Recordings to be deleted
+	int							deleted = 0;			// Number of recordings deleted
+	int							result;					// Result from SQLite function
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	auto sql = "select recording.rowid, root.path || recording.recordingid from duplicate inner join recording on recording.rowid = duplicate.recordingkey "
+		"inner join root on root.rootid = recording.rootid where duplicate.keep = 0";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		while(sqlite3_step(statement) == SQLITE_ROW)
+			recordings.emplace_back(sqlite3_column_int64(statement, 0), reinterpret_cast<char const*>(sqlite3_column_text(statement, 1)));
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	sql = "delete from duplicate where recordingkey = ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		for(auto const& recording : recordings) {
+
+			// Check if the operation should be cancelled prior to deleting the next recording
+			if(cancel.test(true)) break;
+
+			// The recordings go into the trash the same way as any other deletion so they can be restored
+			delete_recording(instance, recording.second.c_str());
+			paths.remove(recording.second.c_str());
+
+			sqlite3_bind_int64(statement, 1, recording.first);
+			result = sqlite3_step(statement);
+			sqlite3_reset(statement);
+			if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			++deleted;
+		}
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	return deleted;
+}
+
+//---------------------------------------------------------------------------
+// delete_recording
+//
+// Deletes a recording by moving it into the trash
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	recordingid		- Recording ID (CmdURL) of the item to delete
+
+void delete_recording(sqlite3* instance, char const* recordingid)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
+	std::string					trashfolder;			// Trash folder path
+	std::wstring				widefolder;				// UTF-16 trash folder path
+
+	if((instance == nullptr) || (recordingid == nullptr)) return;
+
+	time_t deletetime = time(nullptr);
+	std::string trashpath = get_trash_path(recordingid, deletetime, trashfolder);
+
+	// Prepare a query to flag the recording as deleted in the database; the trash path is stored relative to the root folder
+	auto sql = std::string("update recording set deletetime = ?2, trashpath = substr(?3, length((select path from root where root.rootid = recording.rootid)) + 1) "
+		"where rowid = (select recording.rowid from ") + RECORDING_KEY_LOOKUP + ") and deletetime is null";
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	// The file is moved while the transaction is open so that the two operations succeed or fail together
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_int64(statement, 2, static_cast<sqlite3_int64>(deletetime));
+		if(result == SQLITE_OK) result = sqlite3_bind_text(statement, 3, trashpath.c_str(), -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result);
+
+		sqlite3_finalize(statement);			// Finalize the SQLite statement
+		statement = nullptr;
+
+		// If the recording was flagged as deleted, move the file into the trash folder
+		if(sqlite3_changes(instance) > 0) {
+
+			// Create the (hidden) trash folder if it doesn't already exist; this waits until the recording has been
+			// found so that an unknown or already deleted recording doesn't leave an empty trash folder behind
+			std::string uncfolder = smb_to_unc(trashfolder.c_str());
+			to_wstring(uncfolder.data(), static_cast<int>(uncfolder.size()), widefolder);
+			if(CreateDirectoryW(widefolder.c_str(), nullptr)) SetFileAttributesW(widefolder.c_str(), FILE_ATTRIBUTE_HIDDEN);
+			else if(GetLastError() != ERROR_ALREADY_EXISTS) throw string_exception(__func__, ": unable to create trash folder ", trashfolder.c_str());
+
+			move_file(recordingid, trashpath.c_str());
+
+			// If the transaction can't be committed, put the file back where it was
+			try { execute_non_query(instance, "commit transaction"); }
+			catch(...) { move_file(trashpath.c_str(), recordingid); throw; }
+		}
+
+		// A recording that is already in the trash is deleted permanently; queue the file to be purged
+		else {
+
+			std::string const purgesql[] = {
+
+				std::string("insert or ignore into purge select root.path || recording.trashpath from ") + RECORDING_KEY_LOOKUP +
+					" and recording.deletetime is not null and recording.trashpath is not null",
+				std::string("delete from recording where rowid = (select recording.rowid from ") + RECORDING_KEY_LOOKUP + " and recording.deletetime is not null)",
+			};
+
+			for(auto const& purgequery : purgesql) {
+
+				result = sqlite3_prepare_v2(instance, purgequery.c_str(), -1, &statement, nullptr);
+				if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+				result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+				if(result != SQLITE_OK) throw sqlite_exception(result);
+
+				result = sqlite3_step(statement);
+				if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+				sqlite3_finalize(statement);
+				statement = nullptr;
+			}
+
+			execute_non_query(instance, "commit transaction");
+		}
+	}
+
+	catch(...) { sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
+}
+
+//---------------------------------------------------------------------------
+// discover_recordings
+//
+// Reloads the information about the available recordings
+//
+// Arguments:
+//
+//	instance	- SQLite database instance
+//	callbacks	- addoncallbacks instance
+//	folder		- Location of the recorded TV files
+//	layout		- Directory layout to generate for the recordings
+//	bounded		- Flag to stage the discovered recordings on disk with bounded memory
+//	reconcile	- Interval between full reconciles of the catalog in seconds, or zero to always reconcile
+//	paths		- Index of known recording paths; updated if the data has changed
+//	providers	- Metadata provider pipeline
+//	cancel		- Condition variable used to cancel the operation
+//	changed		- Flag indicating if the data has changed
+
+void discover_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, enum directory_layout layout, 
+	bool bounded, int reconcile, pathindex& paths, metadatapipeline& providers, scalar_condition<bool> const& cancel, bool& changed)
+{
+	struct __stat64				folderstat;				// Folder information from the VFS
+	long long					foldermtime = 0;		// Folder modification time (if available)
+
+	changed = false;							// Initialize [out] argument
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if(callbacks == nullptr) throw std::invalid_argument("callbacks");
+
+	if(folder == nullptr) folder = "";
+
+	// A full reconcile checks every listed file against the catalog.  Between reconciles only the new files are
+	// added; recordings that changed or disappeared are found when they're accessed, see validate_recording()
+	long long now = static_cast<long long>(time(nullptr));
+	bool incremental = (reconcile > 0) && ((now - get_reconcile_time(instance, folder)) < reconcile);
+
+	// Get the modification time of the folder before it's listed, so that a file added during the listing is seen next time
+	memset(&folderstat, 0, sizeof(struct __stat64));
+	if((*folder != '\0') && (callbacks->StatFile(folder, &folderstat) == 0)) foldermtime = static_cast<long long>(folderstat.st_mtime);
+
+	// If the folder hasn't changed since it was completely listed, the catalog already holds its listing.  A file rewritten in
+	// place doesn't change the modification time of its folder, so the recordings that may still be being written are checked
+	// against the files; if one of them has changed the folder is reconciled to reload it.  A reconcile that is due is never skipped
+	if((foldermtime != 0) && ((reconcile == 0) || (incremental)) && (get_folder_mtime(instance, folder) == foldermtime)) {
+
+		long long since = now - static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(FOLDER_ACTIVE_WINDOW).count());
+		if(check_active_recordings(instance, callbacks, folder, since)) return;
+
+		incremental = false;
+	}
+
+	// In bounded memory mode the temp tables are backed by a file and given a small page cache; the pages of
+	// the staged recordings spill to disk rather than growing with the size of the library.  Changing the
+	// temp_store drops any existing temp tables, it's reset to the default once discovery has finished
+	if(bounded) {
+
+		execute_non_query(instance, "pragma temp_store = file");
+		execute_non_query(instance, (std::string("pragma temp.cache_size = -") + std::to_string(BOUNDED_TEMP_CACHE_SIZE)).c_str());
+	}
+
+	// Create a temporary table with the same schema as the recording table
+	execute_non_query(instance, "drop table if exists discover_recording");
+	execute_non_query(instance, (std::string("create temp table discover_recording(") + RECORDING_COLUMNS + ")").c_str());
+
+	// Create a temporary table for the raw metadata of the recordings that are loaded rather than copied
+	execute_non_query(instance, "drop table if exists discover_rawmetadata");
+	execute_non_query(instance, "create temp table discover_rawmetadata(recordingkey integer primary key, format text, data blob)");
+
+	try {
+
+		// Loading the discover_recording temp table is horrible; broken out into a helper function
+		bool complete = load_recordings(instance, callbacks, folder, layout, incremental, paths, providers, cancel);
+		
+		// This requires a multi-step operation against the recording table; start a transaction
+		execute_non_query(instance, "begin immediate transaction");
+
+		try {
+
+			// An incremental discovery only loaded the new files, there is nothing to diff
+			if(incremental) {
+
+				if(execute_non_query(instance, "insert into recording select * from discover_recording where rowid not in (select rowid from recording)") > 0) changed = true;
+			}
+
+			// In bounded memory mode the tables are diffed by walking both of them in key order
+			else if(bounded) changed = merge_discover_recordings(instance);
+
+			else {
+
+				// Delete any entries in the main recording table that are no longer present in the data; recordings in the trash are not listed
+				if(execute_non_query(instance, "delete from recording where deletetime is null and rowid not in (select rowid from discover_recording)") > 0) changed = true;
+
+				// Delete any entries in the main recording table where the file itself has changed so they will be replaced
+				if(execute_non_query(instance, "delete from recording where rowid in (select recording.rowid from recording inner join discover_recording "
+					"on discover_recording.rowid = recording.rowid where recording.deletetime is null and (recording.filesize is not discover_recording.filesize or "
+					"recording.filetime is not discover_recording.filetime))") > 0) changed = true;
+
+				// Insert entries in the main recording table that are new (not checking for differences here)
+				if(execute_non_query(instance, "insert into recording select * from discover_recording where rowid not in (select rowid from recording)") > 0) changed = true;
+			}
+
+			// Replace the cached raw metadata of the recordings that were loaded, and forget the raw metadata of the recordings that are gone
+			execute_non_query(instance, "delete from rawmetadata where recordingkey in (select recordingkey from discover_rawmetadata)");
+			execute_non_query(instance, (std::string("insert into rawmetadata select recordingkey, format, ") + std::to_string(METADATA_VERSION) + ", data from discover_rawmetadata "
+				"where data is not null and recordingkey in (select rowid from recording where deletetime is null)").c_str());
+			execute_non_query(instance, "delete from rawmetadata where recordingkey not in (select rowid from recording)");
+			execute_non_query(instance, "delete from usertitle where recordingkey not in (select rowid from recording)");
+
+			// The background jobs of the recordings that were loaded are run again against the new file
+			execute_non_query(instance, "delete from job where recordingkey in (select recordingkey from discover_rawmetadata)");
+			execute_non_query(instance, "delete from job where recordingkey not in (select rowid from recording)");
+			execute_non_query(instance, "delete from fingerprint where recordingkey in (select recordingkey from discover_rawmetadata)");
+			execute_non_query(instance, "delete from fingerprint where recordingkey not in (select rowid from recording)");
+
+			// Forget about root folders that no longer have any recordings
+			execute_non_query(instance, "delete from root where rootid not in (select rootid from recording)");
+
+			// Remember when the folder was reconciled, and forget about any other folders; if any file could not
+			// be processed the reconcile is not recorded so the next discovery reconciles the folder again
+			if(!incremental) set_reconcile_time(instance, folder, (complete) ? now : 0);
+
+			// Remember the modification time of the listed folder the same way, a folder with any file that could
+			// not be processed is listed again by the next discovery
+			set_folder_mtime(instance, folder, (complete) ? foldermtime : 0);
+
+			// Commit the database transaction
+			execute_non_query(instance, "commit transaction");
+		}
+		
+		// Rollback the transaction on any exception
+		catch(...) { try_execute_non_query(instance, "rollback transaction"); throw; }
+
+		// Drop the temporary tables
+		execute_non_query(instance, "drop table discover_rawmetadata");
+		execute_non_query(instance, "drop table discover_recording");
+		if(bounded) execute_non_query(instance, "pragma temp_store = default");
+
+		// Reload the index of known recording paths to match the committed data
+		if(changed) load_pathindex(instance, paths);
+	}
+
+	// Drop the temporary tables on any exception
+	catch(...) {
+
+		execute_non_query(instance, "drop table discover_rawmetadata");
+		execute_non_query(instance, "drop table discover_recording");
+		if(bounded) try_execute_non_query(instance, "pragma temp_store = default");
+		throw;
+	}
+}
+
+//---------------------------------------------------------------------------
+// empty_recording_trash
+//
+// Removes all deleted recordings from the database and queues their files to be purged
+//
+// Arguments:
+//
+//	instance	- Database instance
+
+int empty_recording_trash(sqlite3* instance)
+{
+	int					changes = 0;			// Number of recordings removed
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		execute_non_query(instance, "insert or ignore into purge select root.path || trashpath from recording inner join root using(rootid) where deletetime is not null and trashpath is not null");
+		changes = execute_non_query(instance, "delete from recording where deletetime is not null");
+
+		execute_non_query(instance, "commit transaction");
+	}
+
+	catch(...) { try_execute_non_query(instance, "rollback transaction"); throw; }
+
+	return changes;
+}
+
+//---------------------------------------------------------------------------
+// enumerate_duplicate_recordings
+//
+// Enumerates the duplicate recordings found by the last call to find_duplicate_recordings
+//
+// Arguments:
+//
+//	instance	- Database instance
+//	callback	- Callback function
+
+void enumerate_duplicate_recordings(sqlite3* instance, enumerate_duplicate_recordings_callback callback)
+{
+	sqlite3_stmt*				statement;			// SQL statement to execute
+	int							result;				// Result from SQLite function
+	std::string					recordingid;		// Full path of the recording
+	
+	if((instance == nullptr) || (callback == nullptr)) return;
+
+	// fingerprint | keep | recordingid | title | episodename | channelname | recordingtime | duration | filesize | ishd | root
+	auto sql = "select duplicate.fingerprint, duplicate.keep, recording.recordingid, recording.title, expand_text(recording.episodename), recording.channelname, "
+		"recording.recordingtime, recording.duration, recording.filesize, recording.ishd, root.path from duplicate inner join recording on recording.rowid = duplicate.recordingkey "
+		"inner join root on root.rootid = recording.rootid where recording.deletetime is null order by recording.title, duplicate.fingerprint, duplicate.keep desc";
+
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Execute the query and iterate over all returned rows
+		while(sqlite3_step(statement) == SQLITE_ROW) {
+
+			// The full path is rebuilt from the root folder into the same buffer for every row
+			recordingid.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 10))).append(reinterpret_cast<char const*>(sqlite3_column_text(statement, 2)));
+
+			struct duplicate_recording item;
+			item.fingerprint = static_cast<uint64_t>(sqlite3_column_int64(statement, 0));
+			item.keep = (sqlite3_column_int(statement, 1) != 0);
+			item.recordingid = recordingid.c_str();
+			item.title = reinterpret_cast<char const*>(sqlite3_column_text(statement, 3));
+			item.episodename = reinterpret_cast<char const*>(sqlite3_column_text(statement, 4));
+			item.channelname = reinterpret_cast<char const*>(sqlite3_column_text(statement, 5));
+			item.recordingtime = sqlite3_column_int(statement, 6);
+			item.duration = sqlite3_column_int(statement, 7);
+			item.filesize = static_cast<uint64_t>(sqlite3_column_int64(statement, 8));
+			item.ishd = (sqlite3_column_int(statement, 9) != 0);
+
+			callback(item);						// Invoke caller-supplied callback
+		}
+	
+		sqlite3_finalize(statement);			// Finalize the SQLite statement
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// enumerate_recording_jobs
+//
+// Enumerates the recordings that have background jobs which have not finished, along with the jobs that have
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	names			- Comma-separated names of the jobs to be run
+//	maxrecordings	- Maximum number of recordings to enumerate
+//	callback		- Callback function
+
+void enumerate_recording_jobs(sqlite3* instance, char const* names, int maxrecordings, enumerate_recording_jobs_callback callback)
+{
+	sqlite3_stmt*				statement;			// SQL statement to execute
+	int							result;				// Result from SQLite function
+	std::string					path;				// Full path of the recording
+
+	if((instance == nullptr) || (names == nullptr) || (callback == nullptr)) return;
+
+	// Count the number of jobs in the list; names are never empty and never contain a comma
+	int jobs = 1;
+	for(char const* name = names; *name; name++) if(*name == ',') ++jobs;
+
+	// recordingkey | root | recordingid | name | failed
+	// A recording with no finished jobs has a single row with a null name; rows for jobs not in the list are ignored by the caller
+	auto sql = "select pending.recordingkey, root.path, recording.recordingid, job.name, job.failed from "
+		"(select recordingkey from recording where deletetime is null and (select count(*) from job where job.recordingkey = recording.recordingkey and "
+		"instr(',' || ?1 || ',', ',' || job.name || ',') > 0) < ?2 order by recordingkey limit ?3) as pending "
+		"inner join recording on recording.recordingkey = pending.recordingkey inner join root on root.rootid = recording.rootid "
+		"left outer join job on job.recordingkey = pending.recordingkey order by pending.recordingkey";
+
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_text(statement, 1, names, -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_int(statement, 2, jobs);
+		if(result == SQLITE_OK) result = sqlite3_bind_int(statement, 3, maxrecordings);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query and iterate over all returned rows
+		while(sqlite3_step(statement) == SQLITE_ROW) {
+
+			path.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 1))).append(reinterpret_cast<char const*>(sqlite3_column_text(statement, 2)));
+
+			struct recording_job item;
+			item.recordingkey = sqlite3_column_int64(statement, 0);
+			item.path = path.c_str();
+			item.name = reinterpret_cast<char const*>(sqlite3_column_text(statement, 3));
+			item.failed = (sqlite3_column_int(statement, 4) != 0);
+
+			callback(item);						// Invoke caller-supplied callback
+		}
+
+		sqlite3_finalize(statement);			// Finalize the SQLite statement
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// enumerate_recordings
+//
+// Enumerates the available recordings
+//
+// Arguments:
+//
+//	instance	- Database instance
+//	deleted		- Flag to enumerate the deleted recordings rather than the active ones
+//	callback	- Callback function
+
+void enumerate_recordings(sqlite3* instance, bool deleted, enumerate_recordings_callback callback)
+{
+	sqlite3_stmt*				statement;			// SQL statement to execute
+	int							result;				// Result from SQLite function
+	std::string					recordingid;		// Full path of the recording
+	std::string					streamurl;			// Full path of the recording file
+	
+	if((instance == nullptr) || (callback == nullptr)) return;
+
+	// root | recordingid | title | episodename | seriesnumber | episodenumber | year | streamurl | directory | plot | channelname | recordingtime | duration
+	// The compressed text fields are only expanded here as each row is materialized
+	auto sql = "select root.path, recordingid, title, expand_text(episodename), seriesnumber, episodenumber, year, coalesce(trashpath, recordingid), directory, "
+		"expand_text(plot), channelname, recordingtime, duration from recording inner join root using(rootid) where (deletetime is not null) = ?1";
+
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_int(statement, 1, (deleted) ? 1 : 0);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query and iterate over all returned rows
+		while(sqlite3_step(statement) == SQLITE_ROW) {
+
+			// The full paths are rebuilt from the root folder into the same buffers for every row
+			char const* root = reinterpret_cast<char const*>(sqlite3_column_text(statement, 0));
+			recordingid.assign(root).append(reinterpret_cast<char const*>(sqlite3_column_text(statement, 1)));
+			streamurl.assign(root).append(reinterpret_cast<char const*>(sqlite3_column_text(statement, 7)));
+
+			struct recording item;
+			item.recordingid = recordingid.c_str();
+			item.title = reinterpret_cast<char const*>(sqlite3_column_text(statement, 2));
+			item.episodename = reinterpret_cast<char const*>(sqlite3_column_text(statement, 3));
+			item.seriesnumber = sqlite3_column_int(statement, 4);
+			item.episodenumber = sqlite3_column_int(statement, 5);
+			item.year = sqlite3_column_int(statement, 6);
+			item.streamurl = streamurl.c_str();
+			item.directory = reinterpret_cast<char const*>(sqlite3_column_text(statement, 8));
+			item.plot = reinterpret_cast<char const*>(sqlite3_column_text(statement, 9));
+			item.channelname = reinterpret_cast<char const*>(sqlite3_column_text(statement, 10));
+			item.recordingtime = sqlite3_column_int(statement, 11);
+			item.duration = sqlite3_column_int(statement, 12);
+
+			callback(item);						// Invoke caller-supplied callback
+		}
+	
+		sqlite3_finalize(statement);			// Finalize the SQLite statement
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// execute_non_query
+//
+// Executes a non-query against the database
+//
+// Arguments:
+//
+//	instance	- Database instance
+//	sql			- SQL non-query to execute
+
+int execute_non_query(sqlite3* instance, char const* sql)
+{
+	char*		errmsg = nullptr;		// Error message from SQLite
+	int			result;					// Result from SQLite function call
+	
+	try {
+	
+		// Attempt to execute the statement and throw the error on failure
+		result = sqlite3_exec(instance, sql, nullptr, nullptr, &errmsg);
+		if(result != SQLITE_OK) throw sqlite_exception(result, errmsg);
+
+		// Return the number of changes made by the preceeding query
+		return sqlite3_changes(instance);
+	}
+
+	catch(...) { if(errmsg) sqlite3_free(errmsg); throw; }
+}
+
+//---------------------------------------------------------------------------
+// find_duplicate_recordings
+//
+// Groups the recordings by fingerprint to find any that have been recorded more than once
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	cancel			- Condition variable used to cancel the operation
+
+int find_duplicate_recordings(sqlite3* instance, scalar_condition<bool> const& cancel)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
+	int							duplicates = 0;			// Number of redundant copies
+
+	// candidate
+	//
+	// Information used to choose the copy of a recording to keep
+	struct candidate {
+
+		int64_t			rowid;
+		bool			ishd;
+		int				duration;
+		int64_t			filesize;
+	};
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	std::unordered_map<uint64_t, std::vector<candidate>> groups;
+
+	// Build the hash table of fingerprints from a single pass over the catalog; the fingerprints are generated by the
+	// background jobs, recordings that haven't been through the jobs yet are picked up by a later pass
+	auto sql = "select recording.rowid, fingerprint.fingerprint, ishd, duration, filesize from recording inner join fingerprint "
+		"on fingerprint.recordingkey = recording.rowid where deletetime is null";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		while(sqlite3_step(statement) == SQLITE_ROW) {
+
+			groups[static_cast<uint64_t>(sqlite3_column_int64(statement, 1))].push_back({ sqlite3_column_int64(statement, 0),
+				(sqlite3_column_int(statement, 2) != 0), sqlite3_column_int(statement, 3), sqlite3_column_int64(statement, 4) });
+		}
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	if(cancel.test(true)) throw string_exception(__func__, ": operation cancelled");
+
+	// Replace the previous results with the groups that contain more than one recording
+	sql = "insert into duplicate values(?3, ?1, ?2)";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		execute_non_query(instance, "delete from duplicate");
+
+		for(auto& group : groups) {
+
+			if(group.second.size() < 2) continue;
+
+			// The best copy is the HD one, then the longest, then the largest
+			auto best = std::max_element(group.second.begin(), group.second.end(), [](candidate const& lhs, candidate const& rhs) -> bool {
+
+				if(lhs.ishd != rhs.ishd) return rhs.ishd;
+				if(lhs.duration != rhs.duration) return lhs.duration < rhs.duration;
+				return lhs.filesize < rhs.filesize;
+			});
+
+			for(auto iterator = group.second.begin(); iterator != group.second.end(); iterator++) {
+
+				sqlite3_bind_int64(statement, 1, static_cast<sqlite3_int64>(group.first));
+				sqlite3_bind_int(statement, 2, (iterator == best) ? 1 : 0);
+				sqlite3_bind_int64(statement, 3, iterator->rowid);
+
+				result = sqlite3_step(statement);
+				sqlite3_reset(statement);
+				if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+			}
+
+			duplicates += static_cast<int>(group.second.size() - 1);
+		}
+
+		sqlite3_finalize(statement);
+		execute_non_query(instance, "commit transaction");
+	}
+
+	catch(...) { sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
+
+	return duplicates;
+}
+
+//---------------------------------------------------------------------------
+// fingerprint_recording
+//
+// Generates and stores the fingerprint used to match a recording against its duplicates
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	recordingkey	- Recording key
+
+void fingerprint_recording(sqlite3* instance, int64_t recordingkey)
+{
+	sqlite3_stmt*				statement;				// Database query statement
+	uint64_t					fingerprint = 0;		// Generated fingerprint
+	int							result;					// Result from SQLite function call
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	auto sql = "select title, seriesnumber, episodenumber, expand_text(episodename) from recording where rowid = ?1 and deletetime is null";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_int64(statement, 1, recordingkey);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) fingerprint = get_fingerprint(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)), sqlite3_column_int(statement, 1),
+			sqlite3_column_int(statement, 2), reinterpret_cast<char const*>(sqlite3_column_text(statement, 3)));
+		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	// Recordings without enough information to identify them are never considered duplicates, and a
+	// recording that was deleted while the job was running is skipped rather than leaving an orphaned row
+	sql = (fingerprint == 0) ? "delete from fingerprint where recordingkey = ?1" :
+		"insert or replace into fingerprint select ?1, ?2 where exists(select 1 from recording where rowid = ?1)";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_int64(statement, 1, recordingkey);
+		if((result == SQLITE_OK) && (fingerprint != 0)) result = sqlite3_bind_int64(statement, 2, static_cast<sqlite3_int64>(fingerprint));
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// get_commit_count
+//
+// Gets the number of write transactions committed by all database connections
+//
+// Arguments:
+//
+//	NONE
+
+unsigned long long get_commit_count(void)
+{
+	return g_commits.load();
+}
+
+//---------------------------------------------------------------------------
+// get_database_size
+//
+// Gets the size of the database and the number of unused pages it contains
+//
+// Arguments:
+//
+//	instance	- Database instance
+//	size		- Receives the size of the database, in bytes
+//	freepages	- Receives the number of pages on the freelist
+
+void get_database_size(sqlite3* instance, uint64_t& size, uint64_t& freepages)
+{
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	size = static_cast<uint64_t>(get_pragma_int(instance, "page_count") * get_pragma_int(instance, "page_size"));
+	freepages = static_cast<uint64_t>(get_pragma_int(instance, "freelist_count"));
+}
+
+//---------------------------------------------------------------------------
+// get_recording_count
+//
+// Gets the number of available recordings in the database
+//
+// Arguments:
+//
+//	instance	- SQLite database instance
+//	deleted		- Flag to count the deleted recordings rather than the active ones
+
+int get_recording_count(sqlite3* instance, bool deleted)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							count = 0;				// Number of recordings
+	int							result;					// Result from SQLite function
+
+	if(instance == nullptr) return 0;
+
+	auto sql = "select count(*) from recording where (deletetime is not null) = ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_int(statement, 1, (deleted) ? 1 : 0);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the scalar query
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) count = sqlite3_column_int(statement, 0);
+		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		return count;
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// get_recording_stream_url
+//
+// Gets the playback URL for a recording
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	recordingid		- Recording identifier (command url)
+
+std::string get_recording_stream_url(sqlite3* instance, char const* recordingid)
+{
+	sqlite3_stmt*				statement;				// Database query statement
+	std::string					streamurl;				// Generated stream URL
+	int							result;					// Result from SQLite function call
+
+	if((instance == nullptr) || (recordingid == nullptr)) return streamurl;
+
+	// Prepare a scalar result query to generate a stream URL for the specified recording
+	auto sql = std::string("select root.path, coalesce(recording.trashpath, recording.recordingid) from ") + RECORDING_KEY_LOOKUP;
+
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameters
+		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+		
+		// Execute the scalar query
+		result = sqlite3_step(statement);
+
+		// There should be a single SQLITE_ROW returned from the initial step
+		if(result == SQLITE_ROW) streamurl.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0))).append(reinterpret_cast<char const*>(sqlite3_column_text(statement, 1)));
+		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		return streamurl;
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// load_pathindex
+//
+// Loads the index of known recording paths from the database
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	paths			- Index of known recording paths to be (re)loaded
+
+void load_pathindex(sqlite3* instance, pathindex& paths)
+{
+	sqlite3_stmt*				statement;			// SQL statement to execute
+	int							result;				// Result from SQLite function
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	// rowid | recordingid | filesize | filetime
+	auto sql = "select rowid, root.path || recordingid, filesize, filetime from recording inner join root using(rootid) where deletetime is null";
+
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		paths.clear();
+
 		// Execute the query and iterate over all returned rows
 		while(sqlite3_step(statement) == SQLITE_ROW) {
 
-			struct recording item;
-			item.recordingid = reinterpret_cast<char const*>(sqlite3_column_text(statement, 0));
-			item.title = reinterpret_cast<char const*>(sqlite3_column_text(statement, 1));
-			item.episodename = reinterpret_cast<char const*>(sqlite3_column_text(statement, 2));
-			item.seriesnumber = sqlite3_column_int(statement, 3);
-			item.episodenumber = sqlite3_column_int(statement, 4);
-			item.year = sqlite3_column_int(statement, 5);
-			item.streamurl = reinterpret_cast<char const*>(sqlite3_column_text(statement, 6));
-			item.directory = reinterpret_cast<char const*>(sqlite3_column_text(statement, 7));
-			item.plot = reinterpret_cast<char const*>(sqlite3_column_text(statement, 8));
-			item.channelname = reinterpret_cast<char const*>(sqlite3_column_text(statement, 9));
-			item.recordingtime = sqlite3_column_int(statement, 10);
-			item.duration = sqlite3_column_int(statement, 11);
+			char const* recordingid = reinterpret_cast<char const*>(sqlite3_column_text(statement, 1));
+			if(recordingid == nullptr) continue;
+
+			paths.insert(recordingid, static_cast<uint64_t>(sqlite3_column_int64(statement, 2)), sqlite3_column_int64(statement, 3), 
+				sqlite3_column_int64(statement, 0));
+		}
+
+		sqlite3_finalize(statement);			// Finalize the SQLite statement
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// load_recordings
+//
+// Loads the available MCE recordings into the discover_recording table
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	callbacks		- addoncallbacks instance
+//	folder			- Location of the recorded TV files
+//	incremental		- Flag to only load the files that are not already known
+//	paths			- Index of known recording paths
+//	providers		- Metadata provider pipeline
+//	cancel			- Condition variable used to cancel the operation
+//
+// Returns true if every file in the folder was processed successfully
+
+bool load_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, enum directory_layout layout, 
+	bool incremental, pathindex const& paths, metadatapipeline& providers, scalar_condition<bool> const& cancel)
+{
+	sqlite3_stmt*				statement;			// SQL statement to execute
+	sqlite3_stmt*				copystatement;		// SQL statement to copy an unchanged recording
+	sqlite3_stmt*				keystatement;		// SQL statement to find the keys used by a path hash
+	sqlite3_stmt*				rawstatement;		// SQL statement to cache the raw metadata
+	VFSDirEntry*				files;				// Enumerated files in the directory
+	unsigned int				numfiles;			// Number of files enumerated in the directory
+	int							result;				// Result from SQLite function
+	bool						complete = true;	// Flag if all files were processed
+	arena						scratch(DISCOVERY_ARENA_SIZE);	// Per-file memory, reset for each file
+	recording_metadata			metadata;			// Metadata loaded from the file
+	std::vector<unsigned int>	retry;				// Files that timed out
+	std::deque<std::pair<unsigned int, metadatapipeline::pending_load>>	inflight;	// Files being loaded, in key order
+
+	if (instance == nullptr) throw std::invalid_argument("instance");
+	if (callbacks == nullptr) throw std::invalid_argument("callbacks");
+
+	// If the folder name is null or empty, there is nothing to discover; leave the temp table empty
+	if ((folder == nullptr) || (*folder == '\0')) return complete;
+
+	// The recordings are stored relative to the root folder being discovered
+	std::string prefix = get_root_prefix(folder);
+	int64_t rootid = get_recording_root(instance, prefix.c_str());
+
+	// recordingkey | recordingid | title | episodename | seriesnumber | episodenumber | year | directory | plot | channelname | recordingtime | duration | rootid | filesize | filetime | deletetime | trashpath | ishd
+	// A title the recording was renamed to takes precedence over the title in the file's metadata
+	auto sql = "insert into discover_recording values(?17, ?1, coalesce((select title from usertitle where recordingkey = ?17), ?2), compress_text(?3), ?4, ?5, ?6, "
+		"recording_directory(coalesce((select title from usertitle where recordingkey = ?17), ?2), ?4, ?8), compress_text(?9), ?10, ?11, ?12, ?13, ?14, ?15, null, null, ?16)";
+
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if (result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	// Recordings that are unchanged since the last discovery are copied from the main table
+	// The path index only compares path hashes; the path itself is matched as well so that a hash collision can't copy the
+	// row of another recording, if no row is copied the file is loaded instead
+	auto copysql = "insert into discover_recording select * from recording where rowid = ?1 and rootid = ?2 and recordingid = ?3";
+
+	result = sqlite3_prepare_v2(instance, copysql, -1, &copystatement, nullptr);
+	if (result != SQLITE_OK) { sqlite3_finalize(statement); throw sqlite_exception(result, sqlite3_errmsg(instance)); }
+
+	// New and changed recordings are assigned a key that isn't used by another path in either table
+	auto keysql = "select rowid, recordingid, rootid from recording where rowid between recording_key(?1) and recording_key(?1) + 15 "
+		"union all select rowid, recordingid, rootid from discover_recording where rowid between recording_key(?1) and recording_key(?1) + 15";
+
+	result = sqlite3_prepare_v2(instance, keysql, -1, &keystatement, nullptr);
+	if (result != SQLITE_OK) { sqlite3_finalize(copystatement); sqlite3_finalize(statement); throw sqlite_exception(result, sqlite3_errmsg(instance)); }
+
+	// The raw metadata of new and changed recordings is cached so that columns added later can be decoded without reading the files
+	auto rawsql = "insert or replace into discover_rawmetadata values(?1, ?2, compress_blob(?3))";
+
+	result = sqlite3_prepare_v2(instance, rawsql, -1, &rawstatement, nullptr);
+	if (result != SQLITE_OK) { sqlite3_finalize(keystatement); sqlite3_finalize(copystatement); sqlite3_finalize(statement); throw sqlite_exception(result, sqlite3_errmsg(instance)); }
+
+	try {
+
+		// directory layout and root folder; sqlite3_reset() does not clear the bindings so these only need to be bound once
+		sqlite3_bind_int(statement, 8, static_cast<int>(layout));
+		sqlite3_bind_int64(statement, 13, rootid);
+		sqlite3_bind_int64(copystatement, 2, rootid);
+
+		// Attempt to get a list of all the recording files with an extension known to the metadata providers
+		if (!callbacks->GetDirectory(folder, providers.extensions(), &files, &numfiles)) throw string_exception(__func__, ": cannot enumerate the contents of folder ", folder);
+
+		// Inserts a recording into the discover_recording table from the loaded metadata
+		auto insert_recording = [&](VFSDirEntry const& file) -> void {
+
+			// The listing only contains files in the root folder, but check rather than store a mangled path
+			char const* relative = get_relative_path(file.path, prefix);
+			if (relative == nullptr) throw string_exception(__func__, ": file is not located in folder ", folder);
+
+			// recordingkey
+			int64_t key = assign_recording_key(instance, keystatement, rootid, relative);
+			sqlite3_bind_int64(statement, 17, key);
+
+			// recordingid
+			sqlite3_bind_text(statement, 1, relative, -1, SQLITE_STATIC);
+
+			// title
+			sqlite3_bind_text(statement, 2, metadata.title.data(), static_cast<int>(metadata.title.size()), SQLITE_STATIC);
+
+			// episodename
+			sqlite3_bind_text(statement, 3, metadata.episodename.data(), static_cast<int>(metadata.episodename.size()), SQLITE_STATIC);
+
+			// seriesnumber
+			sqlite3_bind_int(statement, 4, metadata.seriesnumber);
+
+			// episodenumber
+			sqlite3_bind_int(statement, 5, metadata.episodenumber);
+
+			// year
+			sqlite3_bind_int(statement, 6, metadata.year);
+
+			// plot
+			sqlite3_bind_text(statement, 9, metadata.plot.data(), static_cast<int>(metadata.plot.size()), SQLITE_STATIC);
+
+			// channelname
+			sqlite3_bind_text(statement, 10, metadata.channelname.data(), static_cast<int>(metadata.channelname.size()), SQLITE_STATIC);
+
+			// recordingTime
+			sqlite3_bind_int(statement, 11, metadata.recordingtime);
+
+			// duration
+			sqlite3_bind_int(statement, 12, metadata.duration);
+
+			// filesize
+			sqlite3_bind_int64(statement, 14, static_cast<sqlite3_int64>(file.size));
+
+			// filetime
+			sqlite3_bind_int64(statement, 15, static_cast<sqlite3_int64>(file.date_time));
+
+			// ishd
+			sqlite3_bind_int(statement, 16, (metadata.ishd) ? 1 : 0);
+
+			// This is a non-query, it's not expected to return any rows
+			result = sqlite3_step(statement);
+			if (result != SQLITE_DONE) throw string_exception("non-query failed or returned an unexpected result set");
+
+			// Providers that can't decode their raw metadata don't provide any; a null row still replaces any stale raw metadata
+			sqlite3_bind_int64(rawstatement, 1, key);
+			if (metadata.format != nullptr) {
+
+				sqlite3_bind_text(rawstatement, 2, metadata.format, -1, SQLITE_STATIC);
+				sqlite3_bind_blob(rawstatement, 3, metadata.raw.data(), static_cast<int>(metadata.raw.size()), SQLITE_STATIC);
+			}
+
+			else { sqlite3_bind_null(rawstatement, 2); sqlite3_bind_null(rawstatement, 3); }
+
+			result = sqlite3_step(rawstatement);
+			sqlite3_reset(rawstatement);
+			if (result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+		};
+
+		// Logs a file that failed to process; the folder won't be considered up to date
+		auto log_failure = [&](VFSDirEntry const& file, char const* reason) -> void {
+
+			std::string message = std::string("Unable to process file ") + file.path + ": " + reason;
+			callbacks->Log(ADDON::addon_log_t::LOG_ERROR, message.c_str());
+			complete = false;
+		};
+
+		// Starts loading a single recording on the I/O worker pool, returns null if the load could not be started
+		auto begin_recording = [&](VFSDirEntry const& file, std::chrono::milliseconds deadline) -> metadatapipeline::pending_load {
+
+			// Nothing allocated for the previous file is referenced anymore, the pipeline keeps its own copy of the path
+			scratch.reset();
+			size_t capacity = scratch.capacity();
+
+			try {
+
+				// Convert smb:// paths into unc paths; won't affect local paths (like "D:\")
+				wchar_t const* widepath = to_unc_path(file.path, scratch);
+
+				// Once the arena has been sized by the first file, the path of every other file should fit in the blocks
+				// it already owns; log any file that still had to allocate from the heap so a regression is visible
+				if((capacity != 0) && (scratch.capacity() != capacity)) {
+
+					std::string message = std::string("Discovery arena grew by ") + std::to_string(scratch.capacity() - capacity) + " bytes for file " + file.path;
+					callbacks->Log(ADDON::addon_log_t::LOG_DEBUG, message.c_str());
+				}
+
+				// Load the metadata with the cheapest provider able to read the file; a file on an unresponsive
+				// share is abandoned at the deadline rather than stalling the rest of the discovery
+				return providers.begin_load(widepath, deadline);
+			}
+
+			catch (std::exception& ex) { log_failure(file, ex.what()); }
+
+			return nullptr;
+		};
+
+		// Waits for a recording to load and inserts it, returns false if the deadline expired
+		auto end_recording = [&](VFSDirEntry const& file, metadatapipeline::pending_load const& pending) -> bool {
+
+			bool loaded = true;
+
+			// Log an error message if any one file fails to process, but keep going ...
+			try { if (pending) { loaded = providers.end_load(pending, metadata); if (loaded) insert_recording(file); } }
+			catch (std::exception& ex) { log_failure(file, ex.what()); }
+
+			// Reset the prepared statement so that it can be executed again
+			result = sqlite3_reset(statement);
+			if (result != SQLITE_OK) throw sqlite_exception(result);
+
+			return loaded;
+		};
+
+		// Waits for the oldest in-flight recording; files that time out go into the retry queue to be tried
+		// again once everything else has been loaded
+		auto complete_recording = [&]() -> void {
+
+			std::pair<unsigned int, metadatapipeline::pending_load> front = std::move(inflight.front());
+			inflight.pop_front();
+
+			if (!end_recording(files[front.first], front.second)) retry.push_back(front.first);
+		};
+
+		try {
+
+			// Visit the files in the same order as the discover_recording keys so the table is appended to rather
+			// than split all over; when the temp store is a file each page is written out once and evicted
+			std::vector<std::pair<int64_t, unsigned int>> order;
+			order.reserve(numfiles);
+			for (unsigned int index = 0; index < numfiles; index++) {
+
+				// If the current file entry is a folder, skip it -- this isn't recursive
+				if (files[index].folder) continue;
+
+				char const* relative = get_relative_path(files[index].path, prefix);
+				if (relative == nullptr) relative = files[index].path;
+				order.emplace_back(get_recording_key(relative, static_cast<int>(strlen(relative))), index);
+			}
+
+			std::sort(order.begin(), order.end());
+
+			// Iterate over each recording file in the target directory to load the metadata
+			for (auto const& entry : order) {
+
+				unsigned int index = entry.second;
+
+				// Check if the operation should be cancelled prior to loading the next file
+				if (cancel.test(true)) throw string_exception(__func__, ": operation cancelled");
+
+				// Between full reconciles only new files are loaded; the known files are validated as they're accessed
+				int64_t rowid = 0;
+				pathindex::status status = paths.check(files[index].path, files[index].size, static_cast<int64_t>(files[index].date_time), rowid);
+				if (incremental && (status != pathindex::status::unknown)) continue;
+
+				// If the file size and modification time haven't changed, copy the existing metadata
+				if (status == pathindex::status::unchanged) {
+
+					sqlite3_bind_int64(copystatement, 1, rowid);
+					sqlite3_bind_text(copystatement, 3, get_relative_path(files[index].path, prefix), -1, SQLITE_STATIC);
+					result = sqlite3_step(copystatement);
+					sqlite3_reset(copystatement);
+
+					// If the row was copied move on to the next file, otherwise fall through and reload it
+					if ((result == SQLITE_DONE) && (sqlite3_changes(instance) > 0)) continue;
+				}
+
+				// Discovery is bound by the latency of the share rather than the work done per file; keep a window of
+				// files loading at the same time and insert them in key order as the oldest one completes
+				if (inflight.size() >= LOAD_METADATA_WINDOW) complete_recording();
+				inflight.emplace_back(index, begin_recording(files[index], std::chrono::duration_cast<std::chrono::milliseconds>(LOAD_METADATA_DEADLINE)));
+			}
+
+			while (!inflight.empty()) complete_recording();
+
+			// Give the files that timed out one more chance with a longer deadline
+			for (unsigned int index : retry) {
+
+				if (cancel.test(true)) throw string_exception(__func__, ": operation cancelled");
+				if (end_recording(files[index], begin_recording(files[index], std::chrono::duration_cast<std::chrono::milliseconds>(RETRY_METADATA_DEADLINE)))) continue;
+
+				// If the file was already known keep the existing metadata rather than dropping it from the catalog, the
+				// file will be tried again during the next discovery
+				int64_t rowid = 0;
+				if (paths.check(files[index].path, files[index].size, static_cast<int64_t>(files[index].date_time), rowid) != pathindex::status::unknown) {
+
+					sqlite3_bind_int64(copystatement, 1, rowid);
+					sqlite3_bind_text(copystatement, 3, get_relative_path(files[index].path, prefix), -1, SQLITE_STATIC);
+					sqlite3_step(copystatement);
+					sqlite3_reset(copystatement);
+				}
+
+				std::string message = std::string("Unable to process file ") + files[index].path + ": metadata could not be loaded before the deadline";
+				callbacks->Log(ADDON::addon_log_t::LOG_ERROR, message.c_str());
+				complete = false;
+			}
+
+			// Release the file listing returned via callbacks->GetDirectory()
+			callbacks->FreeDirectory(files, numfiles);
+		}
+
+		catch (...) { callbacks->FreeDirectory(files, numfiles); throw; }
+
+		sqlite3_finalize(rawstatement);			// Finalize the SQLite statement
+		sqlite3_finalize(keystatement);			// Finalize the SQLite statement
+		sqlite3_finalize(copystatement);		// Finalize the SQLite statement
+		sqlite3_finalize(statement);			// Finalize the SQLite statement
+	}
+
+	catch (...) { sqlite3_finalize(rawstatement); sqlite3_finalize(keystatement); sqlite3_finalize(copystatement); sqlite3_finalize(statement); throw; }
+
+	return complete;
+}
+
+//---------------------------------------------------------------------------
+// move_recording_root
+//
+// Points the recordings of a root folder at a new location without rediscovering them; the recordings
+// are stored relative to the root folder so only the root itself needs to change.  The next discovery
+// of the new location keeps any recording with the same relative path, size and modification time
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	from			- Previous location of the recorded TV files
+//	to				- New location of the recorded TV files
+
+bool move_recording_root(sqlite3* instance, char const* from, char const* to)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
 
-			callback(item);						// Invoke caller-supplied callback
-		}
-	
-		sqlite3_finalize(statement);			// Finalize the SQLite statement
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if((from == nullptr) || (*from == '\0') || (to == nullptr) || (*to == '\0')) return false;
+
+	std::string fromprefix = get_root_prefix(from);
+	std::string toprefix = get_root_prefix(to);
+
+	// If the new location is already a root folder its recordings are kept as they are
+	auto sql = "update or ignore root set path = ?2 where path = ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_text(statement, 1, fromprefix.c_str(), -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_text(statement, 2, toprefix.c_str(), -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		return (sqlite3_changes(instance) > 0);
 	}
 
 	catch(...) { sqlite3_finalize(statement); throw; }
 }
 
 //---------------------------------------------------------------------------
-// execute_non_query
+// open_database
 //
-// Executes a non-query against the database
+// Opens the SQLite database instance
 //
 // Arguments:
 //
-//	instance	- Database instance
-//	sql			- SQL non-query to execute
+//	connstring		- Database connection string
+//	flags			- Database open flags (see sqlite3_open_v2)
 
-int execute_non_query(sqlite3* instance, char const* sql)
+sqlite3* open_database(char const* connstring, int flags)
 {
-	char*		errmsg = nullptr;		// Error message from SQLite
-	int			result;					// Result from SQLite function call
+	return open_database(connstring, flags, false);
+}
+
+//---------------------------------------------------------------------------
+// open_database
+//
+// Opens the SQLite database instance
+//
+// Arguments:
+//
+//	connstring		- Database connection string
+//	flags			- Database open flags (see sqlite3_open_v2)
+//	initialize		- Flag indicating database schema should be (re)initialized
+
+sqlite3* open_database(char const* connstring, int flags, bool initialize)
+{
+	sqlite3*			instance = nullptr;			// SQLite database instance
+
+	// Create the SQLite database using the provided connection string
+	int result = sqlite3_open_v2(connstring, &instance, flags, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result);
+
+	// set the connection to report extended error codes
+	//
+	sqlite3_extended_result_codes(instance, -1);
+
+	// set a busy_timeout handler for this connection
+	//
+	sqlite3_busy_timeout(instance, 30000);
+
+	// set a commit hook to track when the database has been changed
+	//
+	sqlite3_commit_hook(instance, commit_hook, nullptr);
 	
 	try {
-	
-		// Attempt to execute the statement and throw the error on failure
-		result = sqlite3_exec(instance, sql, nullptr, nullptr, &errmsg);
-		if(result != SQLITE_OK) throw sqlite_exception(result, errmsg);
 
-		// Return the number of changes made by the preceeding query
-		return sqlite3_changes(instance);
+		// register the case-insensitive path collation used by the schema; this has to
+		// be done for every connection before any of the tables are accessed
+		//
+		result = sqlite3_create_collation_v2(instance, "path", SQLITE_UTF8, nullptr, path_collation, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// register the function that generates the directory of a recording
+		//
+		result = sqlite3_create_function_v2(instance, "recording_directory", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, recording_directory, nullptr, nullptr, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// register the function that generates the first key for a recording path
+		//
+		result = sqlite3_create_function_v2(instance, "recording_key", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, recording_key, nullptr, nullptr, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// register the functions that compress and expand the long text fields
+		//
+		result = sqlite3_create_function_v2(instance, "compress_text", 1, SQLITE_UTF8, nullptr, compress_text, nullptr, nullptr, nullptr);
+		if(result == SQLITE_OK) result = sqlite3_create_function_v2(instance, "expand_text", 1, SQLITE_UTF8, nullptr, expand_text, nullptr, nullptr, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// register the functions that compress and expand the cached raw metadata
+		//
+		result = sqlite3_create_function_v2(instance, "compress_blob", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, compress_blob, nullptr, nullptr, nullptr);
+		if(result == SQLITE_OK) result = sqlite3_create_function_v2(instance, "expand_blob", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, expand_blob, nullptr, nullptr, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// switch the database to write-ahead logging
+		//
+		execute_non_query(instance, "pragma journal_mode=wal");
+
+		// Only execute schema creation steps if the database is being initialized; the caller needs
+		// to ensure that this is set for only one connection otherwise locking issues can occur
+		//
+		if(initialize) {
+
+			// The tables only cache information discovered from the recorded TV folder; if the schema
+			// version has changed drop them and let the next discovery repopulate them from scratch
+			if(get_pragma_int(instance, "user_version") != SCHEMA_VERSION) {
+
+				execute_non_query(instance, "drop table if exists recording");
+				execute_non_query(instance, "drop table if exists root");
+				execute_non_query(instance, "drop table if exists folder");
+				execute_non_query(instance, "drop table if exists purge");
+				execute_non_query(instance, "drop table if exists duplicate");
+				execute_non_query(instance, "drop table if exists dictionary");
+				execute_non_query(instance, "drop table if exists rawmetadata");
+				execute_non_query(instance, "drop table if exists job");
+				execute_non_query(instance, "drop table if exists fingerprint");
+				execute_non_query(instance, "drop table if exists usertitle");
+				execute_non_query(instance, "drop table if exists reconcile");
+				execute_non_query(instance, (std::string("pragma user_version = ") + std::to_string(SCHEMA_VERSION)).c_str());
+
+				// Switch new and migrated databases to incremental auto_vacuum so that the free pages left behind by
+				// discovery can be released a slice at a time; an existing database only changes mode after a vacuum
+				if(get_pragma_int(instance, "auto_vacuum") != 2) {
+
+					execute_non_query(instance, "pragma auto_vacuum = incremental");
+					execute_non_query(instance, "vacuum");
+				}
+			}
+
+			// table: recording
+			//
+			// recordingkey(pk) | recordingid | title | episodename | seriesnumber | episodenumber | year | directory | plot | channelname | recordingtime | duration | rootid | filesize | filetime | deletetime | trashpath | ishd
+			execute_non_query(instance, (std::string("create table if not exists recording(") + RECORDING_COLUMNS + ")").c_str());
+			execute_non_query(instance, "create index if not exists recording_directory_index on recording(directory)");
+
+			// table: root
+			//
+			// rootid(pk) | path
+			execute_non_query(instance, "create table if not exists root(rootid integer primary key, path text unique not null collate path)");
+
+			// table: folder
+			//
+			// folderid(pk) | mtime
+			execute_non_query(instance, "create table if not exists folder(folderid text primary key not null collate path, mtime int not null)");
+
+			// table: reconcile
+			//
+			// folderid(pk) | reconciletime
+			execute_non_query(instance, "create table if not exists reconcile(folderid text primary key not null collate path, reconciletime int not null)");
+
+			// table: purge
+			//
+			// path(pk)
+			execute_non_query(instance, "create table if not exists purge(path text primary key not null collate path)");
+
+			// table: duplicate
+			//
+			// recordingkey(pk) | fingerprint | keep
+			execute_non_query(instance, "create table if not exists duplicate(recordingkey integer primary key, fingerprint int not null, keep int not null)");
+
+			// table: dictionary
+			//
+			// dictionaryid(pk) | words
+			execute_non_query(instance, "create table if not exists dictionary(dictionaryid int primary key not null, words blob not null)");
+
+			// table: rawmetadata
+			//
+			// recordingkey(pk) | format | version | data
+			execute_non_query(instance, "create table if not exists rawmetadata(recordingkey integer primary key, format text not null, version int not null, data blob not null)");
+
+			// table: job
+			//
+			// recordingkey(pk) | name(pk) | failed
+			execute_non_query(instance, "create table if not exists job(recordingkey int not null, name text not null, failed int not null, primary key(recordingkey, name)) without rowid");
+
+			// table: fingerprint
+			//
+			// recordingkey(pk) | fingerprint
+			execute_non_query(instance, "create table if not exists fingerprint(recordingkey integer primary key, fingerprint int not null)");
+
+			// table: usertitle
+			//
+			// recordingkey(pk) | title
+			execute_non_query(instance, "create table if not exists usertitle(recordingkey integer primary key, title text not null)");
+
+			// Load the text dictionary, if one has been trained, for use by all connections
+			load_dictionary(instance);
+		}
 	}
 
-	catch(...) { if(errmsg) sqlite3_free(errmsg); throw; }
+	// Close the database instance on any thrown exceptions
+	catch(...) { sqlite3_close(instance); throw; }
+
+	return instance;
 }
 
 //---------------------------------------------------------------------------
-// get_recording_count
+// purge_recordings
 //
-// Gets the number of available recordings in the database
+// Moves expired recordings out of the trash and deletes a batch of purged files
 //
 // Arguments:
 //
-//	instance	- SQLite database instance
+//	instance		- Database instance
+//	callbacks		- addoncallbacks instance
+//	maxage			- Maximum age of a deleted recording, in seconds
+//	batchsize		- Maximum number of files to delete
+//	cancel			- Condition variable used to cancel the operation
+
+int purge_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, int maxage, int batchsize, 
+	scalar_condition<bool> const& cancel)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	std::vector<std::string>	paths;					// Paths of files to be purged
+	int							purged = 0;				// Number of files purged
+	int							result;					// Result from SQLite function
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if(callbacks == nullptr) throw std::invalid_argument("callbacks");
+
+	// Move any deleted recordings that have expired out of the trash and into the purge queue
+	std::string expired = "deletetime is not null and deletetime < (strftime('%s', 'now') - " + std::to_string(maxage) + ")";
+
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		execute_non_query(instance, ("insert or ignore into purge select root.path || trashpath from recording inner join root using(rootid) where trashpath is not null and " + expired).c_str());
+		execute_non_query(instance, ("delete from recording where " + expired).c_str());
+
+		execute_non_query(instance, "commit transaction");
+	}
+
+	catch(...) { try_execute_non_query(instance, "rollback transaction"); throw; }
+
+	// Select the next batch of files to be purged
+	auto sql = "select path from purge limit ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_int(statement, 1, batchsize);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		while(sqlite3_step(statement) == SQLITE_ROW) 
+			paths.emplace_back(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)));
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	sql = "delete from purge where path = ?1";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		for(auto const& path : paths) {
+
+			// Check if the operation should be cancelled prior to deleting the next file
+			if(cancel.test(true)) break;
+
+			// If the file can't be deleted and still exists, leave it in the queue to try again later
+			if((!callbacks->DeleteFile(path.c_str())) && (callbacks->FileExists(path.c_str(), false))) {
+
+				std::string message = std::string("Unable to purge deleted recording ") + path;
+				callbacks->Log(ADDON::addon_log_t::LOG_ERROR, message.c_str());
+				continue;
+			}
+
+			sqlite3_bind_text(statement, 1, path.c_str(), -1, SQLITE_STATIC);
+			result = sqlite3_step(statement);
+			sqlite3_reset(statement);
+			if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			++purged;
+		}
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	return purged;
+}
+
+//---------------------------------------------------------------------------
+// rename_recording
+//
+// Changes the title of a recording and renames the underlying file to match
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	recordingid		- Recording ID (CmdURL) of the item to rename
+//	title			- New title for the recording
+//	layout			- Directory layout used to regenerate the directory
+//	paths			- Index of known recording paths to be updated
+
+void rename_recording(sqlite3* instance, char const* recordingid, char const* title, enum directory_layout layout, pathindex& paths)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
+
+	if((instance == nullptr) || (recordingid == nullptr) || (title == nullptr)) return;
+
+	std::string newpath = get_renamed_path(recordingid, title);
+	bool movefile = (path_collation(nullptr, static_cast<int>(strlen(recordingid)), recordingid, static_cast<int>(newpath.size()), newpath.data()) != 0);
+
+	// Prepare a query to get the information needed to update the path index
+	auto sql = std::string("select recording.rowid, recording.filesize, recording.filetime, recording.rootid, root.path from ") + RECORDING_KEY_LOOKUP +
+		" and recording.deletetime is null";
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	// The file is moved while the transaction is open so that the two operations succeed or fail together
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result == SQLITE_DONE) throw string_exception(__func__, ": recording ", recordingid, " was not found");
+		if(result != SQLITE_ROW) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		int64_t rowid = sqlite3_column_int64(statement, 0);
+		uint64_t filesize = static_cast<uint64_t>(sqlite3_column_int64(statement, 1));
+		int64_t filetime = sqlite3_column_int64(statement, 2);
+		int64_t rootid = sqlite3_column_int64(statement, 3);
+		std::string root(reinterpret_cast<char const*>(sqlite3_column_text(statement, 4)));
+
+		sqlite3_finalize(statement);
+		statement = nullptr;
+
+		// The renamed file stays in the same folder, so it remains relative to the same root folder
+		char const* relative = get_relative_path(newpath.c_str(), root);
+		if(relative == nullptr) throw string_exception(__func__, ": renamed path ", newpath.c_str(), " is not located in folder ", root.c_str());
+
+		// The key is derived from the path; if the new path hashes to different key slots it needs a new key
+		int64_t newkey = rowid;
+		if((rowid & ~static_cast<int64_t>(RECORDING_KEY_SLOTS - 1)) != get_recording_key(relative, static_cast<int>(strlen(relative)))) {
+
+			sql = "select rowid, recordingid, rootid from recording where rowid between recording_key(?1) and recording_key(?1) + 15";
+			result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+			if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			newkey = assign_recording_key(instance, statement, rootid, relative);
+
+			sqlite3_finalize(statement);
+			statement = nullptr;
+		}
+
+		// Update the recording and any fields derived from the title or path
+		sql = "update recording set rowid = ?5, recordingid = ?1, title = ?2, directory = recording_directory(?2, seriesnumber, ?4) where rowid = ?3";
+		result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		result = sqlite3_bind_text(statement, 1, relative, -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_text(statement, 2, title, -1, SQLITE_STATIC);
+		if(result == SQLITE_OK) result = sqlite3_bind_int64(statement, 3, rowid);
+		if(result == SQLITE_OK) result = sqlite3_bind_int(statement, 4, static_cast<int>(layout));
+		if(result == SQLITE_OK) result = sqlite3_bind_int64(statement, 5, newkey);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		statement = nullptr;
+
+		// Move any duplicate detection result, the cached raw metadata and a previous title override over to the new key
+		if(newkey != rowid) {
+
+			execute_non_query(instance, (std::string("update duplicate set recordingkey = ") + std::to_string(newkey) + " where recordingkey = " + std::to_string(rowid)).c_str());
+			execute_non_query(instance, (std::string("update or replace rawmetadata set recordingkey = ") + std::to_string(newkey) + " where recordingkey = " + std::to_string(rowid)).c_str());
+			execute_non_query(instance, (std::string("update or replace usertitle set recordingkey = ") + std::to_string(newkey) + " where recordingkey = " + std::to_string(rowid)).c_str());
+		}
+
+		// The title in the file's metadata is left alone; keep the new title as an override so that
+		// reloading the metadata when the file changes or is rediscovered doesn't put the old title back
+		sql = "insert or replace into usertitle values(?1, ?2)";
+		result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+		if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		result = sqlite3_bind_int64(statement, 1, newkey);
+		if(result == SQLITE_OK) result = sqlite3_bind_text(statement, 2, title, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		statement = nullptr;
+
+		// The fingerprint is generated from the title, run the background jobs again against the renamed recording
+		execute_non_query(instance, (std::string("delete from job where recordingkey = ") + std::to_string(rowid)).c_str());
+		execute_non_query(instance, (std::string("delete from fingerprint where recordingkey = ") + std::to_string(rowid)).c_str());
+
+		if(movefile) move_file(recordingid, newpath.c_str());
+
+		// If the transaction can't be committed, put the file back where it was
+		try { execute_non_query(instance, "commit transaction"); }
+		catch(...) { if(movefile) move_file(newpath.c_str(), recordingid); throw; }
+
+		// A rename doesn't change the file size or modification time, the next discovery will see it as unchanged
+		paths.remove(recordingid);
+		paths.insert(newpath.c_str(), filesize, filetime, newkey);
+	}
+
+	catch(...) { sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
+}
+
+//---------------------------------------------------------------------------
+// restore_database
+//
+// Replaces the contents of a database instance with those of a database file
+//
+// Arguments:
+//
+//	instance		- Database instance to be restored
+//	connstring		- Source database connection string
+//	flags			- Source database open flags (see sqlite3_open_v2)
+
+void restore_database(sqlite3* instance, char const* connstring, int flags)
+{
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if(connstring == nullptr) throw std::invalid_argument("connstring");
 
-int get_recording_count(sqlite3* instance)
-{
-	if(instance == nullptr) return 0;
+	// Open the source database with initialization so that its schema is brought up to date
+	sqlite3* source = open_database(connstring, flags, true);
+
+	try { copy_database(source, instance); }
+	catch(...) { close_database(source); throw; }
 
-	return 0;
+	close_database(source);
 }
 
 //---------------------------------------------------------------------------
-// get_recording_stream_url
+// set_recording_jobs
 //
-// Gets the playback URL for a recording
+// Records the background jobs that have finished for the recordings
 //
 // Arguments:
 //
 //	instance		- Database instance
-//	recordingid		- Recording identifier (command url)
+//	jobs			- Finished jobs to be recorded
 
-std::string get_recording_stream_url(sqlite3* instance, char const* recordingid)
+void set_recording_jobs(sqlite3* instance, std::vector<struct finished_job> const& jobs)
 {
-	sqlite3_stmt*				statement;				// Database query statement
-	std::string					streamurl;				// Generated stream URL
-	int							result;					// Result from SQLite function call
+	sqlite3_stmt*				statement;			// SQL statement to execute
+	int							result;				// Result from SQLite function
 
-	if((instance == nullptr) || (recordingid == nullptr)) return streamurl;
+	if((instance == nullptr) || (jobs.empty())) return;
 
-	// Prepare a scalar result query to generate a stream URL for the specified recording
-	auto sql = "select streamurl from recording where recordingid like ?1";
+	// A recording that was deleted while the job was running is skipped rather than leaving an orphaned row
+	auto sql = "insert or replace into job select ?1, ?2, ?3 where exists(select 1 from recording where rowid = ?1)";
 
 	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
 	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
+	execute_non_query(instance, "begin immediate transaction");
+
 	try {
 
-		// Bind the query parameters
-		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
-		if(result != SQLITE_OK) throw sqlite_exception(result);
-		
-		// Execute the scalar query
-		result = sqlite3_step(statement);
+		for(auto const& job : jobs) {
 
-		// There should be a single SQLITE_ROW returned from the initial step
-		if(result == SQLITE_ROW) streamurl.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)));
-		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+			sqlite3_bind_int64(statement, 1, job.recordingkey);
+			sqlite3_bind_text(statement, 2, job.name, -1, SQLITE_STATIC);
+			sqlite3_bind_int(statement, 3, (job.failed) ? 1 : 0);
+
+			result = sqlite3_step(statement);
+			sqlite3_reset(statement);
+			if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+		}
 
 		sqlite3_finalize(statement);
-		return streamurl;
+		execute_non_query(instance, "commit transaction");
 	}
 
-	catch(...) { sqlite3_finalize(statement); throw; }
+	catch(...) { sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
 }
 
 //---------------------------------------------------------------------------
-// load_recordings
+// train_text_dictionary
 //
-// Loads the available MCE recordings into the discover_recording table
+// Trains the text dictionary from the catalog and compresses the existing text fields
 //
 // Arguments:
 //
-//	instance		- Database instance
-//	callbacks		- addoncallbacks instance
-//	folder			- Location of the recorded TV files
-//	cancel			- Condition variable used to cancel the operation
+//	instance	- Database instance
+//	before		- Receives the average size of the text fields per row before compression
+//	after		- Receives the average size of the text fields per row after compression
 
-void load_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, scalar_condition<bool> const& cancel)
+bool train_text_dictionary(sqlite3* instance, uint64_t& before, uint64_t& after)
 {
-	sqlite3_stmt*				statement;			// SQL statement to execute
-	VFSDirEntry*				files;				// Enumerated files in the directory
-	unsigned int				numfiles;			// Number of files enumerated in the directory
-	int							result;				// Result from SQLite function
-	HRESULT						hresult;			// Result from COM/OLE function call
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	textdictionary::trainer		trainer;				// Dictionary trainer
+	std::string					longest;				// Longest sampled plot
+	int							samples = 0;			// Number of plots sampled
+	int							result;					// Result from SQLite function
 
-	if (instance == nullptr) throw std::invalid_argument("instance");
-	if (callbacks == nullptr) throw std::invalid_argument("callbacks");
+	before = after = 0;
 
-	// If the folder name is null or empty, there is nothing to discover; leave the temp table empty
-	if ((folder == nullptr) || (*folder == '\0')) return;
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	// The dictionary is only trained once, it's discarded with the rest of the catalog on a schema change
+	if(std::atomic_load(&g_dictionary)) return false;
 
-	// recordingid | title | episodename | seriesnumber | episodenumber | year | streamurl | directory | plot | channelname | recordingtime | duration
-	auto sql = "insert into discover_recording values(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12)";
+	// The average size of the text fields is reported before and after compression
+	auto sizesql = "select coalesce(avg(coalesce(length(cast(plot as blob)), 0) + coalesce(length(cast(episodename as blob)), 0)), 0) from recording";
 
+	auto sql = "select plot, episodename from recording where typeof(plot) = 'text'";
 	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
-	if (result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
 	try {
 
-		// Attempt to get a list of all the .wtv files in the target directory
-		if (!callbacks->GetDirectory(folder, ".wtv", &files, &numfiles)) throw string_exception(__func__, ": cannot enumerate the contents of folder ", folder);
-
-		try {
-
-			// Iterate over each .wtv file in the target directory to load the metadata
-			for (unsigned int index = 0; index < numfiles; index++) {
-
-				IShellItem2*		shellitem = nullptr;			// IShellItem2 instance pointer
-				IPropertyStore*		store = nullptr;				// IPropertyStore instance pointer
-
-				// If the current file entry is a folder, skip it -- this isn't recursive
-				if (files[index].folder) continue;
-
-				// Check if the operation should be cancelled prior to loading the next file
-				if (cancel.test(true)) throw string_exception(__func__, ": operation cancelled");
-
-				try {
-
-					// Convert smb:// paths into unc paths; won't affect local paths (like "D:\")
-					std::string filepath = smb_to_unc(files[index].path);
-					std::wstring widepath = to_wstring(filepath.data(), static_cast<int>(filepath.size()));
+		while(sqlite3_step(statement) == SQLITE_ROW) {
 
-					// Create an IShellItem2 instance from the current path (UTF-16)
-					hresult = SHCreateItemFromParsingName(widepath.c_str(), nullptr, IID_IShellItem2, reinterpret_cast<void**>(&shellitem));
-					if (FAILED(hresult)) throw string_exception("SHCreateItemFromParsingName() failed");
+			trainer.add(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)), static_cast<size_t>(sqlite3_column_bytes(statement, 0)));
+			trainer.add(reinterpret_cast<char const*>(sqlite3_column_text(statement, 1)), static_cast<size_t>(sqlite3_column_bytes(statement, 1)));
+			++samples;
 
-					// Query for the GPS_DEFAULT IPropertyStore instance; always done with IShellItem2 afterwards
-					hresult = shellitem->GetPropertyStore(GETPROPERTYSTOREFLAGS::GPS_DEFAULT, IID_IPropertyStore, reinterpret_cast<void**>(&store));
-					shellitem->Release();
-					if (FAILED(hresult)) throw string_exception("shellitem->GetPropertyStore() failed");
+			if(static_cast<size_t>(sqlite3_column_bytes(statement, 0)) > longest.size())
+				longest.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)), static_cast<size_t>(sqlite3_column_bytes(statement, 0)));
+		}
 
-					try {
+		sqlite3_finalize(statement);
+	}
 
-						// recordingid
-						sqlite3_bind_text(statement, 1, files[index].path, -1, SQLITE_STATIC);
+	catch(...) { sqlite3_finalize(statement); throw; }
 
-						// title
-						std::wstring title = get_lpwstr(store, PKEY_Title);
-						sqlite3_bind_text16(statement, 2, title.c_str(), -1, SQLITE_STATIC);
+	// Wait until the catalog is large enough for the dictionary to be representative
+	if(samples < MIN_DICTIONARY_SAMPLES) return false;
 
-						// episodename
-						std::wstring episodename = get_lpwstr(store, PKEY_RecordedTV_EpisodeName);
-						sqlite3_bind_text16(statement, 3, episodename.c_str(), -1, SQLITE_STATIC);
+	std::string words = trainer.serialize();
+	std::shared_ptr<textdictionary const> dictionary = std::make_shared<textdictionary>(words.data(), words.size());
 
-						// seriesnumber
-						sqlite3_bind_int(statement, 4, static_cast<int>(get_ui4(store, PKEY_Media_SeasonNumber)));
+	// Compresses and expands text with the new dictionary, returns false if the text doesn't come back unchanged
+	auto roundtrip = [&](std::string const& text) -> bool {
 
-						// episodenumber
-						sqlite3_bind_int(statement, 5, static_cast<int>(get_ui4(store, PKEY_Media_EpisodeNumber)));
+		std::string compressed, expanded;
+		if(!dictionary->compress(text.data(), text.size(), compressed)) return true;
 
-						// year
-						FILETIME originalbroadcastdate = get_filetime(store, PKEY_RecordedTV_OriginalBroadcastDate);
-						SYSTEMTIME storiginalbroadcastdate;
-						FileTimeToSystemTime(&originalbroadcastdate, &storiginalbroadcastdate);
-						sqlite3_bind_int(statement, 6, static_cast<int>(storiginalbroadcastdate.wYear));
+		dictionary->decompress(compressed.data(), compressed.size(), expanded);
+		return (expanded == text);
+	};
 
-						// streamurl
-						sqlite3_bind_text(statement, 7, files[index].path, -1, SQLITE_STATIC);
+	// Check the edge cases before the dictionary is adopted: empty text, text outside of ASCII and
+	// text longer than the dictionary itself, made by repeating the longest sampled plot
+	std::string longer;
+	while((!longest.empty()) && (longer.size() <= words.size())) longer.append(longest).append(" ");
 
-						// directory
-						sqlite3_bind_text16(statement, 8, title.c_str(), -1, SQLITE_STATIC);
+	if(!roundtrip(std::string()) || !roundtrip(u8"Caf\u00e9 \u2014 \u65e5\u672c\u8a9e \u0422\u0435\u0441\u0442 \U0001F4FA") || !roundtrip(longer))
+		throw string_exception(__func__, ": trained text dictionary failed to round-trip the sample text");
 
-						// plot
-						std::wstring programdescription = get_lpwstr(store, PKEY_RecordedTV_ProgramDescription);
-						sqlite3_bind_text16(statement, 9, programdescription.c_str(), -1, SQLITE_STATIC);
+	sql = "insert into dictionary values(1, ?1)";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-						// channelname
-						std::wstring stationname = get_lpwstr(store, PKEY_RecordedTV_StationName);
-						sqlite3_bind_text16(statement, 10, stationname.c_str(), -1, SQLITE_STATIC);
+	execute_non_query(instance, "begin immediate transaction");
 
-						// recordingTime
-						FILETIME recordingtime = get_filetime(store, PKEY_RecordedTV_RecordingTime);
-						ULARGE_INTEGER ulrectime = { recordingtime.dwLowDateTime, recordingtime.dwHighDateTime };
-						sqlite3_bind_int(statement, 11, static_cast<int>(ulrectime.QuadPart / 10000000ULL - 11644473600ULL));
+	try {
 
-						// duration
-						uint64_t duration = get_ui8(store, PKEY_Media_Duration);
-						sqlite3_bind_int(statement, 12, static_cast<int>(duration / 10000000));
+		before = static_cast<uint64_t>(execute_scalar_int(instance, sizesql));
 
-						// This is a non-query, it's not expected to return any rows
-						result = sqlite3_step(statement);
-						if (result != SQLITE_DONE) throw string_exception("non-query failed or returned an unexpected result set");
+		result = sqlite3_bind_blob(statement, 1, words.data(), static_cast<int>(words.size()), SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
 
-						store->Release();							// Release IPropertyStore
-					}
+		result = sqlite3_step(statement);
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-					catch (...) { store->Release(); throw; }
-				}
+		sqlite3_finalize(statement);
+		statement = nullptr;
 
-				catch (std::exception& ex) {
+		// The dictionary has to be visible to the compress_text() function before the existing rows
+		// are compressed; if the transaction fails it's removed again
+		std::atomic_store(&g_dictionary, dictionary);
 
-					// Log an error message if any one file fails to process, but keep going ...
-					std::string message = std::string("Unable to process file ") + files[index].path + ": " + ex.what();
-					callbacks->Log(ADDON::addon_log_t::LOG_ERROR, message.c_str());
-				}
+		// Every existing row has to round-trip before any of them are compressed
+		int64_t mismatched = execute_scalar_int(instance, "select count(*) from recording where expand_text(compress_text(plot)) is not plot or "
+			"expand_text(compress_text(episodename)) is not episodename");
+		if(mismatched != 0) throw string_exception(__func__, ": trained text dictionary failed to round-trip ", mismatched, " recording(s)");
 
-				// Reset the prepared statement so that it can be executed again
-				result = sqlite3_reset(statement);
-				if (result != SQLITE_OK) throw sqlite_exception(result);
-			}
+		execute_non_query(instance, "update recording set plot = compress_text(plot), episodename = compress_text(episodename)");
+		after = static_cast<uint64_t>(execute_scalar_int(instance, sizesql));
 
-			// Release the file listing returned via callbacks->GetDirectory()
-			callbacks->FreeDirectory(files, numfiles);
-		}
+		execute_non_query(instance, "commit transaction");
+	}
 
-		catch (...) { callbacks->FreeDirectory(files, numfiles); throw; }
+	catch(...) { 
+		
+		sqlite3_finalize(statement); 
+		try_execute_non_query(instance, "rollback transaction"); 
+		std::atomic_store(&g_dictionary, std::shared_ptr<textdictionary const>());
+		throw; 
 	}
 
-	catch (...) { sqlite3_finalize(statement); throw; }
+	return true;
 }
 
 //---------------------------------------------------------------------------
-// open_database
+// try_execute_non_query
 //
-// Opens the SQLite database instance
+// Executes a non-query against the database and eats any exceptions
 //
 // Arguments:
 //
-//	connstring		- Database connection string
-//	flags			- Database open flags (see sqlite3_open_v2)
+//	instance	- Database instance
+//	sql			- SQL non-query to execute
 
-sqlite3* open_database(char const* connstring, int flags)
+bool try_execute_non_query(sqlite3* instance, char const* sql)
 {
-	return open_database(connstring, flags, false);
+	try { execute_non_query(instance, sql); }
+	catch(...) { return false; }
+
+	return true;
 }
 
 //---------------------------------------------------------------------------
-// open_database
+// undelete_recording
 //
-// Opens the SQLite database instance
+// Restores a deleted recording from the trash
 //
 // Arguments:
 //
-//	connstring		- Database connection string
-//	flags			- Database open flags (see sqlite3_open_v2)
-//	initialize		- Flag indicating database schema should be (re)initialized
+//	instance		- Database instance
+//	recordingid		- Recording ID (CmdURL) of the item to restore
 
-sqlite3* open_database(char const* connstring, int flags, bool initialize)
+void undelete_recording(sqlite3* instance, char const* recordingid)
 {
-	sqlite3*			instance = nullptr;			// SQLite database instance
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	std::string					trashpath;				// Current location of the file
+	int							result;					// Result from SQLite function
 
-	// Create the SQLite database using the provided connection string
-	int result = sqlite3_open_v2(connstring, &instance, flags, nullptr);
-	if(result != SQLITE_OK) throw sqlite_exception(result);
+	if((instance == nullptr) || (recordingid == nullptr)) return;
 
-	// set the connection to report extended error codes
-	//
-	sqlite3_extended_result_codes(instance, -1);
+	// Prepare a query to get the location of the file in the trash
+	auto sql = std::string("select root.path || recording.trashpath from ") + RECORDING_KEY_LOOKUP + " and recording.deletetime is not null";
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-	// set a busy_timeout handler for this connection
-	//
-	sqlite3_busy_timeout(instance, 30000);
-	
 	try {
 
-		// switch the database to write-ahead logging
-		//
-		execute_non_query(instance, "pragma journal_mode=wal");
+		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
 
-		// Only execute schema creation steps if the database is being initialized; the caller needs
-		// to ensure that this is set for only one connection otherwise locking issues can occur
-		//
-		if(initialize) {
+		result = sqlite3_step(statement);
+		if((result == SQLITE_ROW) && (sqlite3_column_type(statement, 0) != SQLITE_NULL)) 
+			trashpath.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 0)));
+		else if((result != SQLITE_ROW) && (result != SQLITE_DONE)) throw sqlite_exception(result, sqlite3_errmsg(instance));
 
-			// table: recording
-			//
-			// recordingid(pk) | title | episodename | seriesnumber | episodenumber | year | streamurl | directory | plot | channelname | recordingtime | duration
-			execute_non_query(instance, "create table if not exists recording(recordingid text primary key not null, "
-				"title text, episodename text, seriesnumber int, episodenumber int, year int, streamurl text, directory text, "
-				"plot text, channelname text, recordingtime int, duration int)");
-		}
+		sqlite3_finalize(statement);
 	}
 
-	// Close the database instance on any thrown exceptions
-	catch(...) { sqlite3_close(instance); throw; }
+	catch(...) { sqlite3_finalize(statement); throw; }
 
-	return instance;
+	if(trashpath.empty()) return;				// Recording is not in the trash
+
+	// Prepare a query to clear the deleted flag of the recording
+	sql = std::string("update recording set deletetime = null, trashpath = null where rowid = (select recording.rowid from ") + RECORDING_KEY_LOOKUP + ")";
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	// The file is moved while the transaction is open so that the two operations succeed or fail together
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result);
+
+		sqlite3_finalize(statement);
+		statement = nullptr;
+
+		move_file(trashpath.c_str(), recordingid);
+
+		// If the transaction can't be committed, put the file back into the trash
+		try { execute_non_query(instance, "commit transaction"); }
+		catch(...) { move_file(recordingid, trashpath.c_str()); throw; }
+	}
+
+	catch(...) { sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
 }
 
 //---------------------------------------------------------------------------
-// try_execute_non_query
+// update_recording_directories
 //
-// Executes a non-query against the database and eats any exceptions
+// Regenerates the directory of every recording after the layout has been changed
 //
 // Arguments:
 //
 //	instance	- Database instance
-//	sql			- SQL non-query to execute
+//	layout		- Directory layout to apply
 
-bool try_execute_non_query(sqlite3* instance, char const* sql)
+int update_recording_directories(sqlite3* instance, enum directory_layout layout)
 {
-	try { execute_non_query(instance, sql); }
-	catch(...) { return false; }
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	int							result;					// Result from SQLite function
 
-	return true;
+	if(instance == nullptr) throw std::invalid_argument("instance");
+
+	// Only rows where the directory actually differs are written
+	auto sql = "update recording set directory = recording_directory(title, seriesnumber, ?1) "
+		"where directory is not recording_directory(title, seriesnumber, ?1)";
+	result = sqlite3_prepare_v2(instance, sql, -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		// Bind the query parameter(s)
+		result = sqlite3_bind_int(statement, 1, static_cast<int>(layout));
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		// Execute the query - no result set is expected
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) throw string_exception(__func__, ": unexpected result set returned from non-query");
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		return sqlite3_changes(instance);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+}
+
+//---------------------------------------------------------------------------
+// validate_recording
+//
+// Checks that a recording still matches its file, and updates or removes it from the catalog if it doesn't
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	callbacks		- addoncallbacks instance
+//	recordingid		- Recording ID (CmdURL) of the item to validate
+//	layout			- Directory layout used to regenerate the directory
+//	paths			- Index of known recording paths to be updated
+//	providers		- Metadata provider pipeline
+//	deadline		- Time allowed to load the metadata of a changed file
+
+enum recording_validation validate_recording(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* recordingid,
+	enum directory_layout layout, pathindex& paths, metadatapipeline& providers, std::chrono::milliseconds deadline)
+{
+	sqlite3_stmt*				statement;				// SQL statement to execute
+	struct __stat64				filestat;				// File information from the VFS
+	std::string					root;					// Root folder of the recording
+	int64_t						rowid = 0;				// Recording key
+	int64_t						filesize = 0;			// Cataloged file size
+	int64_t						filetime = 0;			// Cataloged file modification time
+	int							result;					// Result from SQLite function
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if(callbacks == nullptr) throw std::invalid_argument("callbacks");
+	if(recordingid == nullptr) throw std::invalid_argument("recordingid");
+
+	// Recordings in the trash have already been moved, there is nothing to validate
+	auto sql = std::string("select recording.rowid, root.path, recording.filesize, recording.filetime from ") + RECORDING_KEY_LOOKUP + " and recording.deletetime is null";
+
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	try {
+
+		result = sqlite3_bind_text(statement, 1, recordingid, -1, SQLITE_STATIC);
+		if(result != SQLITE_OK) throw sqlite_exception(result);
+
+		result = sqlite3_step(statement);
+		if(result == SQLITE_ROW) {
+
+			rowid = sqlite3_column_int64(statement, 0);
+			root.assign(reinterpret_cast<char const*>(sqlite3_column_text(statement, 1)));
+			filesize = sqlite3_column_int64(statement, 2);
+			filetime = sqlite3_column_int64(statement, 3);
+		}
+
+		else if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+	}
+
+	catch(...) { sqlite3_finalize(statement); throw; }
+
+	if(rowid == 0) return recording_validation::unchanged;
+
+	memset(&filestat, 0, sizeof(struct __stat64));
+	if(callbacks->StatFile(recordingid, &filestat) != 0) {
+
+		// If the root folder can't be reached either the share is down, not the recording gone; leave it alone
+		if(!callbacks->DirectoryExists(root.c_str())) return recording_validation::unchanged;
+
+		execute_non_query(instance, "begin immediate transaction");
+
+		try {
+
+			std::string key = std::to_string(rowid);
+			execute_non_query(instance, ("delete from recording where rowid = " + key).c_str());
+			execute_non_query(instance, ("delete from rawmetadata where recordingkey = " + key).c_str());
+			execute_non_query(instance, ("delete from job where recordingkey = " + key).c_str());
+			execute_non_query(instance, ("delete from fingerprint where recordingkey = " + key).c_str());
+			execute_non_query(instance, ("delete from duplicate where recordingkey = " + key).c_str());
+			execute_non_query(instance, ("delete from usertitle where recordingkey = " + key).c_str());
+
+			execute_non_query(instance, "commit transaction");
+		}
+
+		catch(...) { try_execute_non_query(instance, "rollback transaction"); throw; }
+
+		paths.remove(recordingid);
+		return recording_validation::removed;
+	}
+
+	if((static_cast<int64_t>(filestat.st_size) == filesize) && (static_cast<int64_t>(filestat.st_mtime) == filetime)) return recording_validation::unchanged;
+
+	// The file has changed; load the metadata again the same way discovery would have.  If that takes too long
+	// the recording is left as it is, the next full reconcile of the folder will pick up the change
+	arena scratch(DISCOVERY_ARENA_SIZE);
+	recording_metadata metadata;
+	if(!providers.load(to_unc_path(recordingid, scratch), metadata, deadline)) return recording_validation::unchanged;
+
+	// recordingkey | title | episodename | seriesnumber | episodenumber | year | layout | plot | channelname | recordingtime | duration | ishd | filesize | filetime
+	// A title the recording was renamed to takes precedence over the title in the file's metadata
+	sql = "update recording set title = coalesce((select title from usertitle where recordingkey = ?1), ?2), episodename = compress_text(?3), seriesnumber = ?4, "
+		"episodenumber = ?5, year = ?6, directory = recording_directory(coalesce((select title from usertitle where recordingkey = ?1), ?2), ?4, ?7), "
+		"plot = compress_text(?8), channelname = ?9, recordingtime = ?10, duration = ?11, ishd = ?12, filesize = ?13, filetime = ?14 where rowid = ?1";
+
+	result = sqlite3_prepare_v2(instance, sql.c_str(), -1, &statement, nullptr);
+	if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+	execute_non_query(instance, "begin immediate transaction");
+
+	try {
+
+		sqlite3_bind_int64(statement, 1, rowid);
+		sqlite3_bind_text(statement, 2, metadata.title.data(), static_cast<int>(metadata.title.size()), SQLITE_STATIC);
+		sqlite3_bind_text(statement, 3, metadata.episodename.data(), static_cast<int>(metadata.episodename.size()), SQLITE_STATIC);
+		sqlite3_bind_int(statement, 4, metadata.seriesnumber);
+		sqlite3_bind_int(statement, 5, metadata.episodenumber);
+		sqlite3_bind_int(statement, 6, metadata.year);
+		sqlite3_bind_int(statement, 7, static_cast<int>(layout));
+		sqlite3_bind_text(statement, 8, metadata.plot.data(), static_cast<int>(metadata.plot.size()), SQLITE_STATIC);
+		sqlite3_bind_text(statement, 9, metadata.channelname.data(), static_cast<int>(metadata.channelname.size()), SQLITE_STATIC);
+		sqlite3_bind_int(statement, 10, metadata.recordingtime);
+		sqlite3_bind_int(statement, 11, metadata.duration);
+		sqlite3_bind_int(statement, 12, (metadata.ishd) ? 1 : 0);
+		sqlite3_bind_int64(statement, 13, static_cast<sqlite3_int64>(filestat.st_size));
+		sqlite3_bind_int64(statement, 14, static_cast<sqlite3_int64>(filestat.st_mtime));
+
+		result = sqlite3_step(statement);
+		if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+		sqlite3_finalize(statement);
+		statement = nullptr;
+
+		// Replace the cached raw metadata, and run the background jobs again against the new file
+		std::string key = std::to_string(rowid);
+		execute_non_query(instance, ("delete from rawmetadata where recordingkey = " + key).c_str());
+		execute_non_query(instance, ("delete from job where recordingkey = " + key).c_str());
+		execute_non_query(instance, ("delete from fingerprint where recordingkey = " + key).c_str());
+
+		if(metadata.format != nullptr) {
+
+			auto rawsql = "insert into rawmetadata values(?1, ?2, ?3, compress_blob(?4))";
+
+			result = sqlite3_prepare_v2(instance, rawsql, -1, &statement, nullptr);
+			if(result != SQLITE_OK) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			sqlite3_bind_int64(statement, 1, rowid);
+			sqlite3_bind_text(statement, 2, metadata.format, -1, SQLITE_STATIC);
+			sqlite3_bind_int(statement, 3, METADATA_VERSION);
+			sqlite3_bind_blob(statement, 4, metadata.raw.data(), static_cast<int>(metadata.raw.size()), SQLITE_STATIC);
+
+			result = sqlite3_step(statement);
+			if(result != SQLITE_DONE) throw sqlite_exception(result, sqlite3_errmsg(instance));
+
+			sqlite3_finalize(statement);
+			statement = nullptr;
+		}
+
+		execute_non_query(instance, "commit transaction");
+	}
+
+	catch(...) { sqlite3_finalize(statement); try_execute_non_query(instance, "rollback transaction"); throw; }
+
+	paths.insert(recordingid, static_cast<uint64_t>(filestat.st_size), static_cast<int64_t>(filestat.st_mtime), rowid);
+	return recording_validation::updated;
 }
 
 //---------------------------------------------------------------------------
@@ -24,6 +24,7 @@
 #define __DATABASE_H_
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -34,6 +35,8 @@
 #include <libXBMC_addon.h>
 #include <kodi_vfs_types.h>
 
+#include "metadatapipeline.h"
+#include "pathindex.h"
 #include "scalar_condition.h"
 
 #pragma warning(push, 4)				// Enable maximum compiler warnings
@@ -42,6 +45,16 @@
 // DATA TYPES
 //---------------------------------------------------------------------------
 
+// directory_layout
+//
+// Defines the folder hierarchy presented to Kodi for the recordings
+enum class directory_layout {
+
+	none		= 0,			// All recordings in the root folder
+	series		= 1,			// [Title]
+	season		= 2,			// [Title]/Season [N]
+};
+
 // recording
 //
 // Information about a single recording enumerated from the database
@@ -66,6 +79,64 @@ struct recording {
 // Callback function passed to enumerate_recordings
 using enumerate_recordings_callback = std::function<void(struct recording const& recording)>;
 
+// duplicate_recording
+//
+// Information about a single duplicate recording enumerated from the database
+struct duplicate_recording {
+
+	uint64_t			fingerprint;
+	bool				keep;
+	char const*			recordingid;
+	char const*			title;
+	char const*			episodename;
+	char const*			channelname;
+	int					recordingtime;
+	int					duration;
+	uint64_t			filesize;
+	bool				ishd;
+};
+
+// enumerate_duplicate_recordings_callback
+//
+// Callback function passed to enumerate_duplicate_recordings
+using enumerate_duplicate_recordings_callback = std::function<void(struct duplicate_recording const& duplicate)>;
+
+// recording_job
+//
+// Information about a recording with background jobs that have not finished
+struct recording_job {
+
+	int64_t				recordingkey;
+	char const*			path;
+	char const*			name;			// Name of a finished job, or null if none have finished
+	bool				failed;
+};
+
+// enumerate_recording_jobs_callback
+//
+// Callback function passed to enumerate_recording_jobs
+using enumerate_recording_jobs_callback = std::function<void(struct recording_job const& job)>;
+
+// finished_job
+//
+// Information about a background job that has finished for a recording
+struct finished_job {
+
+	int64_t				recordingkey;
+	char const*			name;
+	bool				failed;
+};
+
+// recording_validation
+//
+// Result of checking a recording against its file
+enum class recording_validation {
+
+	unchanged	= 0,			// The recording still matches its file
+	updated		= 1,			// The file changed and the recording was reloaded
+	removed		= 2,			// The file is gone and the recording was removed
+};
+
 //---------------------------------------------------------------------------
 // connectionpool
 //
@@ -150,52 +221,163 @@ private:
 // FUNCTION PROTOTYPES
 //---------------------------------------------------------------------------
 
+// backfill_recording_metadata
+//
+// Decodes the recording columns added since the raw metadata was cached
+int backfill_recording_metadata(sqlite3* instance, metadatapipeline& providers);
+
+// backup_database
+//
+// Persists the contents of a database instance to a database file
+void backup_database(sqlite3* instance, char const* connstring, int flags);
+
+// check_recording_metadata
+//
+// Verifies that the metadata needed to identify a recording was decoded from the file
+void check_recording_metadata(sqlite3* instance, int64_t recordingkey);
+
 // close_database
 //
-// Creates a SQLite database instance handle
+// Closes a SQLite database instance handle
 void close_database(sqlite3* instance);
 
+// compact_database
+//
+// Releases a slice of the free pages in the database and refreshes the query planner statistics
+int compact_database(sqlite3* instance, int maxpages);
+
+// delete_duplicate_recordings
+//
+// Moves all but the best copy of each duplicate recording into the trash
+int delete_duplicate_recordings(sqlite3* instance, pathindex& paths, scalar_condition<bool> const& cancel);
+
 // delete_recording
 //
-// Deletes a recording from the database instance
-void delete_recording(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* recordingid);
+// Deletes a recording by moving it into the trash
+void delete_recording(sqlite3* instance, char const* recordingid);
 
 // discover_recordings
 //
 // Reloads the information about the available recordings
-void discover_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, scalar_condition<bool> const& cancel, bool& changed);
+void discover_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* folder, enum directory_layout layout, bool bounded, int reconcile, pathindex& paths, metadatapipeline& providers, scalar_condition<bool> const& cancel, bool& changed);
+
+// empty_recording_trash
+//
+// Removes all deleted recordings from the database and queues their files to be purged
+int empty_recording_trash(sqlite3* instance);
+
+// enumerate_duplicate_recordings
+//
+// Enumerates the duplicate recordings found by the last call to find_duplicate_recordings
+void enumerate_duplicate_recordings(sqlite3* instance, enumerate_duplicate_recordings_callback callback);
+
+// enumerate_recording_jobs
+//
+// Enumerates the recordings that have background jobs which have not finished, along with the jobs that have
+void enumerate_recording_jobs(sqlite3* instance, char const* names, int maxrecordings, enumerate_recording_jobs_callback callback);
 
 // enumerate_recordings
 //
-// Enumerates the available recordings
-void enumerate_recordings(sqlite3* instance, enumerate_recordings_callback callback);
+// Enumerates the available or deleted recordings
+void enumerate_recordings(sqlite3* instance, bool deleted, enumerate_recordings_callback callback);
 
 // execute_non_query
 //
 // executes a non-query against the database
 int execute_non_query(sqlite3* instance, char const* sql);
 
+// find_duplicate_recordings
+//
+// Groups the recordings by fingerprint to find any that have been recorded more than once
+int find_duplicate_recordings(sqlite3* instance, scalar_condition<bool> const& cancel);
+
+// fingerprint_recording
+//
+// Generates and stores the fingerprint used to match a recording against its duplicates
+void fingerprint_recording(sqlite3* instance, int64_t recordingkey);
+
+// get_commit_count
+//
+// Gets the number of write transactions committed by all database connections
+unsigned long long get_commit_count(void);
+
+// get_database_size
+//
+// Gets the size of the database and the number of unused pages it contains
+void get_database_size(sqlite3* instance, uint64_t& size, uint64_t& freepages);
+
 // get_recording_count
 //
 // Gets the number of available recordings in the database
-int get_recording_count(sqlite3* instance);
+int get_recording_count(sqlite3* instance, bool deleted);
 
 // get_recording_stream_url
 //
 // Gets the playback URL for a recording
 std::string get_recording_stream_url(sqlite3* instance, char const* recordingid);
 
+// load_pathindex
+//
+// Loads the index of known recording paths from the database
+void load_pathindex(sqlite3* instance, pathindex& paths);
+
+// move_recording_root
+//
+// Points the recordings of a root folder at a new location without rediscovering them
+bool move_recording_root(sqlite3* instance, char const* from, char const* to);
+
 // open_database
 //
 // Opens a handle to the backend SQLite database
 sqlite3* open_database(char const* connstring, int flags);
 sqlite3* open_database(char const* connstring, int flags, bool initialize);
 
+// purge_recordings
+//
+// Moves expired recordings out of the trash and deletes a batch of purged files
+int purge_recordings(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, int maxage, int batchsize, scalar_condition<bool> const& cancel);
+
+// rename_recording
+//
+// Changes the title of a recording and renames the underlying file to match
+void rename_recording(sqlite3* instance, char const* recordingid, char const* title, enum directory_layout layout, pathindex& paths);
+
+// restore_database
+//
+// Replaces the contents of a database instance with those of a database file
+void restore_database(sqlite3* instance, char const* connstring, int flags);
+
+// set_recording_jobs
+//
+// Records the background jobs that have finished for the recordings
+void set_recording_jobs(sqlite3* instance, std::vector<struct finished_job> const& jobs);
+
+// train_text_dictionary
+//
+// Trains the text dictionary from the catalog and compresses the existing text fields
+bool train_text_dictionary(sqlite3* instance, uint64_t& before, uint64_t& after);
+
 // try_execute_non_query
 //
 // executes a non-query against the database but eats any exceptions
 bool try_execute_non_query(sqlite3* instance, char const* sql);
 
+// undelete_recording
+//
+// Restores a deleted recording from the trash
+void undelete_recording(sqlite3* instance, char const* recordingid);
+
+// update_recording_directories
+//
+// Regenerates the directory of every recording after the layout has been changed
+int update_recording_directories(sqlite3* instance, enum directory_layout layout);
+
+// validate_recording
+//
+// Checks that a recording still matches its file, and updates or removes it from the catalog if it doesn't
+enum recording_validation validate_recording(sqlite3* instance, std::unique_ptr<ADDON::CHelper_libXBMC_addon> const& callbacks, char const* recordingid,
+	enum directory_layout layout, pathindex& paths, metadatapipeline& providers, std::chrono::milliseconds deadline);
+
 //---------------------------------------------------------------------------
 
 #pragma warning(pop)
@@ -0,0 +1,367 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "iopool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+// HEDGE_PERCENTILE
+//
+// Latency percentile after which a hedged attempt is started
+static size_t const HEDGE_PERCENTILE = 95;
+
+// MAX_LATENCY_SAMPLES
+//
+// Number of recent task latencies used to calculate the percentile
+static size_t const MAX_LATENCY_SAMPLES = 256;
+
+// MIN_HEDGE_DELAY
+//
+// Minimum time before a hedged attempt is started
+static std::chrono::milliseconds const MIN_HEDGE_DELAY(250);
+
+// MIN_LATENCY_SAMPLES
+//
+// Number of task latencies required before attempts are hedged
+static size_t const MIN_LATENCY_SAMPLES = 16;
+
+//---------------------------------------------------------------------------
+// iopool::job_t
+//
+// State shared between begin()/end() and the attempts running on the worker threads
+
+struct iopool::job_t
+{
+	task_t						task;						// Task to be executed
+	std::mutex					lock;						// Synchronization object
+	std::condition_variable		completed;					// Signaled as each attempt completes
+	HANDLE						threads[2] = { nullptr };	// Threads running each attempt
+	int							attempts = 0;				// Number of attempts started
+	int							finished = 0;				// Number of finished attempts
+	int							winner = -1;				// First successful attempt
+	bool						abandoned = false;			// Flag if the deadline expired
+	std::exception_ptr			error;						// First exception thrown
+
+	std::chrono::time_point<std::chrono::steady_clock>	start;		// Time the task was started
+	std::chrono::time_point<std::chrono::steady_clock>	expires;	// Time the deadline expires
+	std::chrono::time_point<std::chrono::steady_clock>	hedge;		// Time a hedged attempt is started
+};
+
+//---------------------------------------------------------------------------
+// iopool Constructor
+//
+// Arguments:
+//
+//	maxthreads		- Maximum number of worker threads
+
+iopool::iopool(size_t maxthreads) : m_maxthreads(std::max(maxthreads, static_cast<size_t>(2)))
+{
+	m_latencies.reserve(MAX_LATENCY_SAMPLES);
+}
+
+//---------------------------------------------------------------------------
+// iopool Destructor
+
+iopool::~iopool()
+{
+	stop();
+}
+
+//---------------------------------------------------------------------------
+// iopool::begin
+//
+// Starts executing a task with a deadline; the deadline includes any time spent waiting for a worker
+//
+// Arguments:
+//
+//	task		- Task to be executed, invoked with the attempt number (0 or 1)
+//	deadline	- Maximum amount of time to wait for the task
+
+iopool::ticket_t iopool::begin(task_t const& task, std::chrono::milliseconds deadline)
+{
+	if(task == nullptr) throw std::invalid_argument("task");
+
+	std::shared_ptr<job_t> job = std::make_shared<job_t>();
+	job->task = task;
+	job->start = std::chrono::steady_clock::now();
+	job->expires = job->start + deadline;
+	job->hedge = job->start + hedge_delay(deadline);
+	job->attempts = 1;
+
+	post(job, 0);
+
+	return job;
+}
+
+//---------------------------------------------------------------------------
+// iopool::end
+//
+// Waits for a task started by begin(); returns the attempt that completed or -1 if the deadline expired
+//
+// Arguments:
+//
+//	ticket		- Ticket returned from begin()
+
+int iopool::end(ticket_t const& ticket)
+{
+	if(!ticket) throw std::invalid_argument("ticket");
+
+	std::shared_ptr<job_t> job = ticket;
+	std::unique_lock<std::mutex> joblock(job->lock);
+
+	while(job->winner < 0) {
+
+		// If every attempt failed there is nothing else to wait for; the failure isn't a timeout
+		if(job->finished == job->attempts) std::rethrow_exception(job->error);
+
+		std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
+		if(now >= job->expires) break;
+
+		// The first attempt is taking longer than most; start a second one and take whichever finishes first
+		if((job->attempts == 1) && (now >= job->hedge) && (job->hedge < job->expires)) {
+
+			++job->attempts;
+			joblock.unlock();
+			post(job, 1);
+			joblock.lock();
+
+			++m_hedged;
+			continue;
+		}
+
+		job->completed.wait_until(joblock, ((job->attempts == 1) && (job->hedge < job->expires)) ? job->hedge : job->expires);
+	}
+
+	if(job->winner >= 0) {
+
+		int winner = job->winner;
+		joblock.unlock();
+
+		// Track the latency of the completed task to adjust when attempts are hedged
+		uint32_t latency = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - job->start).count());
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		if(m_latencies.size() < MAX_LATENCY_SAMPLES) m_latencies.push_back(latency);
+		else m_latencies[m_nextlatency] = latency;
+		m_nextlatency = (m_nextlatency + 1) % MAX_LATENCY_SAMPLES;
+
+		return winner;
+	}
+
+	// The deadline expired; cancel any synchronous I/O the attempts are blocked on and abandon them.  The
+	// job lock is held so the threads can't move on to another task while their I/O is being cancelled
+	job->abandoned = true;
+	for(HANDLE thread : job->threads) if(thread != nullptr) CancelSynchronousIo(thread);
+
+	++m_timeouts;
+	return -1;
+}
+
+//---------------------------------------------------------------------------
+// iopool::execute
+//
+// Executes a task with a deadline; returns the attempt that completed or -1 if the deadline expired
+//
+// Arguments:
+//
+//	task		- Task to be executed, invoked with the attempt number (0 or 1)
+//	deadline	- Maximum amount of time to wait for the task
+
+int iopool::execute(task_t const& task, std::chrono::milliseconds deadline)
+{
+	return end(begin(task, deadline));
+}
+
+//---------------------------------------------------------------------------
+// iopool::hedge_delay (private)
+//
+// Gets the time after which a hedged attempt is started
+//
+// Arguments:
+//
+//	deadline	- Deadline of the task being executed
+
+std::chrono::milliseconds iopool::hedge_delay(std::chrono::milliseconds deadline)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	// Until there are enough samples to know what is normal, attempts aren't hedged
+	if(m_latencies.size() < MIN_LATENCY_SAMPLES) return deadline;
+
+	std::vector<uint32_t> latencies(m_latencies);
+	lock.unlock();
+
+	auto percentile = latencies.begin() + ((latencies.size() * HEDGE_PERCENTILE) / 100);
+	std::nth_element(latencies.begin(), percentile, latencies.end());
+
+	return std::min(std::max(std::chrono::milliseconds(*percentile), MIN_HEDGE_DELAY), deadline);
+}
+
+//---------------------------------------------------------------------------
+// iopool::hedged
+//
+// Gets the number of hedged attempts that have been started
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t iopool::hedged(void) const
+{
+	return m_hedged;
+}
+
+//---------------------------------------------------------------------------
+// iopool::post (private)
+//
+// Queues an attempt to be executed by a worker thread
+//
+// Arguments:
+//
+//	job			- Job to be executed
+//	attempt		- Attempt number
+
+void iopool::post(std::shared_ptr<job_t> const& job, int attempt)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	if(m_stop) throw string_exception(__func__, ": the I/O worker pool has been stopped");
+
+	m_queue.emplace(job, attempt);
+
+	// Threads blocked on abandoned I/O don't come back right away; start another one if none are idle
+	if((m_idle == 0) && (m_threads.size() < m_maxthreads)) m_threads.emplace_back(&iopool::worker, this);
+	else m_signal.notify_one();
+}
+
+//---------------------------------------------------------------------------
+// iopool::stop
+//
+// Cancels any pending I/O and stops the worker threads
+//
+// Arguments:
+//
+//	NONE
+
+void iopool::stop(void)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	m_stop = true;
+	for(auto& thread : m_threads) CancelSynchronousIo(thread.native_handle());
+	m_signal.notify_all();
+
+	std::vector<std::thread> threads(std::move(m_threads));
+	m_threads.clear();
+	lock.unlock();
+
+	for(auto& thread : threads) if(thread.joinable()) thread.join();
+}
+
+//---------------------------------------------------------------------------
+// iopool::timeouts
+//
+// Gets the number of tasks that did not complete before the deadline
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t iopool::timeouts(void) const
+{
+	return m_timeouts;
+}
+
+//---------------------------------------------------------------------------
+// iopool::worker (private)
+//
+// Worker thread entry point
+//
+// Arguments:
+//
+//	NONE
+
+void iopool::worker(void)
+{
+	// The shell property system requires COM; the handle is used to cancel this thread's I/O
+	HRESULT hresult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	HANDLE self = OpenThread(THREAD_TERMINATE, FALSE, GetCurrentThreadId());
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	while(!m_stop) {
+
+		++m_idle;
+		m_signal.wait(lock, [&]() -> bool { return m_stop || !m_queue.empty(); });
+		--m_idle;
+
+		if(m_stop) break;
+
+		work_t work = std::move(m_queue.front());
+		m_queue.pop();
+		lock.unlock();
+
+		std::shared_ptr<job_t> job = work.first;
+		int attempt = work.second;
+		bool run = false;
+
+		// Don't start an attempt if the job has already been completed or abandoned
+		std::unique_lock<std::mutex> joblock(job->lock);
+		if((job->winner < 0) && (!job->abandoned)) { job->threads[attempt] = self; run = true; }
+		joblock.unlock();
+
+		if(run) {
+
+			std::exception_ptr error;
+
+			try { job->task(attempt); }
+			catch(...) { error = std::current_exception(); }
+
+			joblock.lock();
+			job->threads[attempt] = nullptr;
+			++job->finished;
+
+			if(!error) { if(job->winner < 0) job->winner = attempt; }
+			else if(!job->error) job->error = error;
+
+			joblock.unlock();
+			job->completed.notify_all();
+		}
+
+		lock.lock();
+	}
+
+	lock.unlock();
+
+	if(self != nullptr) CloseHandle(self);
+	if(SUCCEEDED(hresult)) CoUninitialize();
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
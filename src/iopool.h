@@ -0,0 +1,148 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __IOPOOL_H_
+#define __IOPOOL_H_
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class iopool
+//
+// Runs blocking file I/O on a small pool of worker threads so that a caller can
+// put a deadline on it.  If a task takes longer than most of the recent ones a
+// hedged second attempt is started and whichever finishes first wins; at the
+// deadline any I/O still pending on the workers is cancelled and abandoned
+
+class iopool
+{
+public:
+
+	// Public Data Types
+	//
+	struct job_t;
+	using task_t = std::function<void(int attempt)>;
+	using ticket_t = std::shared_ptr<job_t>;
+
+	// Instance Constructor
+	//
+	iopool(size_t maxthreads);
+
+	// Destructor
+	//
+	~iopool();
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// begin
+	//
+	// Starts executing a task with a deadline; the deadline includes any time spent waiting for a worker
+	ticket_t begin(task_t const& task, std::chrono::milliseconds deadline);
+
+	// end
+	//
+	// Waits for a task started by begin(); returns the attempt that completed or -1 if the deadline expired
+	int end(ticket_t const& ticket);
+
+	// execute
+	//
+	// Executes a task with a deadline; returns the attempt that completed or -1 if the deadline expired
+	int execute(task_t const& task, std::chrono::milliseconds deadline);
+
+	// hedged
+	//
+	// Gets the number of hedged attempts that have been started
+	uint64_t hedged(void) const;
+
+	// stop
+	//
+	// Cancels any pending I/O and stops the worker threads
+	void stop(void);
+
+	// timeouts
+	//
+	// Gets the number of tasks that did not complete before the deadline
+	uint64_t timeouts(void) const;
+
+private:
+
+	iopool(iopool const&)=delete;
+	iopool& operator=(iopool const&)=delete;
+
+	// work_t
+	//
+	// Worker queue element type
+	using work_t = std::pair<std::shared_ptr<job_t>, int>;
+
+	//-----------------------------------------------------------------------
+	// Private Member Functions
+
+	// hedge_delay
+	//
+	// Gets the time after which a hedged attempt is started
+	std::chrono::milliseconds hedge_delay(std::chrono::milliseconds deadline);
+
+	// post
+	//
+	// Queues an attempt to be executed by a worker thread
+	void post(std::shared_ptr<job_t> const& job, int attempt);
+
+	// worker
+	//
+	// Worker thread entry point
+	void worker(void);
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	size_t const					m_maxthreads;			// Maximum number of worker threads
+	std::vector<std::thread>		m_threads;				// Worker threads
+	std::queue<work_t>				m_queue;				// Queued attempts
+	std::vector<uint32_t>			m_latencies;			// Recent task latencies (ms)
+	size_t							m_nextlatency = 0;		// Next latency slot to be replaced
+	size_t							m_idle = 0;				// Number of idle worker threads
+	bool							m_stop = false;			// Flag to stop the worker threads
+	std::mutex						m_lock;					// Synchronization object
+	std::condition_variable			m_signal;				// Signals the worker threads
+	std::atomic<uint64_t>			m_hedged{ 0 };			// Number of hedged attempts
+	std::atomic<uint64_t>			m_timeouts{ 0 };		// Number of expired deadlines
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __IOPOOL_H_
@@ -0,0 +1,306 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "jobgraph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string.h>
+#include <thread>
+
+#include "database.h"
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+// MAX_JOBS
+//
+// Maximum number of jobs in the graph; the state of each recording is kept as job masks
+static size_t const MAX_JOBS = 32;
+
+// PERSIST_INTERVAL
+//
+// Interval at which the finished jobs are written to the database while the workers are running
+static std::chrono::seconds const PERSIST_INTERVAL(5);
+
+//---------------------------------------------------------------------------
+// jobgraph Constructor
+//
+// Arguments:
+//
+//	maxworkers		- Maximum number of worker threads
+
+jobgraph::jobgraph(size_t maxworkers) : m_maxworkers(std::max(maxworkers, static_cast<size_t>(1)))
+{
+}
+
+//---------------------------------------------------------------------------
+// jobgraph::add
+//
+// Adds a job to the graph; the inputs must already have been added, which keeps the graph acyclic
+//
+// Arguments:
+//
+//	name		- Unique job name
+//	inputs		- Names of the jobs that must complete before this job runs
+//	job			- Job implementation
+
+void jobgraph::add(char const* name, std::initializer_list<char const*> inputs, job_t const& job)
+{
+	uint32_t				mask = 0;				// Mask of the input jobs
+
+	if((name == nullptr) || (*name == '\0') || (strchr(name, ',') != nullptr)) throw std::invalid_argument("name");
+	if(job == nullptr) throw std::invalid_argument("job");
+	if(m_nodes.size() >= MAX_JOBS) throw string_exception(__func__, ": too many jobs");
+
+	for(auto const& node : m_nodes) if(node.name == name) throw string_exception(__func__, ": job ", name, " has already been added");
+
+	for(auto const& input : inputs) {
+
+		auto found = std::find_if(m_nodes.begin(), m_nodes.end(), [&](node_t const& node) -> bool { return node.name == input; });
+		if(found == m_nodes.end()) throw string_exception(__func__, ": input ", input, " of job ", name, " has not been added");
+
+		mask |= (1U << static_cast<uint32_t>(found - m_nodes.begin()));
+	}
+
+	m_nodes.push_back({ name, mask, job });
+
+	if(!m_names.empty()) m_names.append(",");
+	m_names.append(name);
+}
+
+//---------------------------------------------------------------------------
+// jobgraph::completed
+//
+// Gets the number of jobs that have completed successfully
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t jobgraph::completed(void) const
+{
+	return m_completed;
+}
+
+//---------------------------------------------------------------------------
+// jobgraph::failed
+//
+// Gets the number of jobs that have failed or were skipped because an input failed
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t jobgraph::failed(void) const
+{
+	return m_failed;
+}
+
+//---------------------------------------------------------------------------
+// jobgraph::run
+//
+// Runs the unfinished jobs of a batch of recordings, returns the number of recordings in the batch
+//
+// Arguments:
+//
+//	instance		- Database instance
+//	maxrecordings	- Maximum number of recordings in the batch
+//	deadline		- Time after which no more jobs are started; jobs not started are left unfinished
+//	cancel			- Condition variable used to cancel the operation
+
+int jobgraph::run(sqlite3* instance, int maxrecordings, std::chrono::milliseconds deadline, scalar_condition<bool> const& cancel)
+{
+	// item_t
+	//
+	// State of the jobs of a single recording
+	struct item_t {
+
+		int64_t					recordingkey;			// Recording key
+		std::string				path;					// Recording path
+		uint32_t				finished;				// Mask of completed and failed jobs
+		uint32_t				succeeded;				// Mask of completed jobs
+		uint32_t				queued;					// Mask of queued or running jobs
+	};
+
+	std::vector<item_t>						items;				// Recordings in the batch
+	std::deque<std::pair<size_t, size_t>>	ready;				// Ready jobs (item, node)
+	std::vector<finished_job>				results;			// Finished jobs not yet written
+	std::vector<std::thread>				workers;			// Worker threads
+	size_t									running = 0;		// Number of running jobs
+	bool									stop = false;		// Flag to stop the workers
+	std::mutex								lock;				// Synchronization object
+	std::condition_variable					signal;				// Signals job state changes
+
+	if(instance == nullptr) throw std::invalid_argument("instance");
+	if(m_nodes.empty()) return 0;
+
+	// Collect the recordings that have unfinished jobs along with the jobs that have finished
+	enumerate_recording_jobs(instance, m_names.c_str(), maxrecordings, [&](struct recording_job const& job) -> void {
+
+		if(items.empty() || (items.back().recordingkey != job.recordingkey)) items.push_back({ job.recordingkey, job.path, 0, 0, 0 });
+		if(job.name == nullptr) return;
+
+		for(size_t index = 0; index < m_nodes.size(); index++) {
+
+			if(m_nodes[index].name != job.name) continue;
+
+			items.back().finished |= (1U << index);
+			if(!job.failed) items.back().succeeded |= (1U << index);
+		}
+	});
+
+	if(items.empty()) return 0;
+
+	// schedule (must be called with the lock held)
+	//
+	// Queues the jobs of a recording whose inputs have all completed; the nodes are in dependency order so
+	// a job skipped because an input failed is seen by any job that depends on it in the same pass
+	auto schedule = [&](size_t item) -> void {
+
+		item_t& state = items[item];
+		for(size_t index = 0; index < m_nodes.size(); index++) {
+
+			uint32_t bit = (1U << index);
+			uint32_t inputs = m_nodes[index].inputs;
+
+			if(((state.finished | state.queued) & bit) != 0) continue;
+
+			if((inputs & state.finished & ~state.succeeded) != 0) {
+
+				state.finished |= bit;
+				results.push_back({ state.recordingkey, m_nodes[index].name.c_str(), true });
+				++m_failed;
+			}
+
+			else if((inputs & ~state.succeeded) == 0) {
+
+				state.queued |= bit;
+				ready.emplace_back(item, index);
+			}
+		}
+	};
+
+	// worker
+	//
+	// Worker thread procedure; runs ready jobs until there are none left and none running that could queue more
+	auto worker = [&]() -> void {
+
+		std::unique_lock<std::mutex> guard(lock);
+
+		while(true) {
+
+			if(stop || cancel.test(true)) ready.clear();
+			if(ready.empty()) {
+
+				if(running == 0) break;
+				signal.wait(guard);
+				continue;
+			}
+
+			std::pair<size_t, size_t> work = ready.front();
+			ready.pop_front();
+			++running;
+
+			item_t const& state = items[work.first];
+			node_t const& node = m_nodes[work.second];
+			guard.unlock();
+
+			bool failed = false;
+			try { node.job(state.recordingkey, state.path.c_str(), cancel); }
+			catch(...) { failed = true; }
+
+			guard.lock();
+			--running;
+
+			// A job interrupted by cancellation did not fail; it's left unfinished and runs again next time
+			if(!(failed && cancel.test(true))) {
+
+				items[work.first].queued &= ~(1U << work.second);
+				items[work.first].finished |= (1U << work.second);
+				if(!failed) items[work.first].succeeded |= (1U << work.second);
+				results.push_back({ state.recordingkey, node.name.c_str(), failed });
+				if(failed) ++m_failed; else ++m_completed;
+
+				schedule(work.first);
+			}
+
+			signal.notify_all();
+		}
+
+		signal.notify_all();
+	};
+
+	std::unique_lock<std::mutex> guard(lock);
+	for(size_t index = 0; index < items.size(); index++) schedule(index);
+	guard.unlock();
+
+	try {
+
+		// The worker budget is shared by every job; no more workers are started than there are jobs to run
+		size_t jobs = ready.size();
+		for(size_t index = 0; index < std::min(m_maxworkers, std::max(jobs, static_cast<size_t>(1))); index++) workers.emplace_back(worker);
+
+		// Write the finished jobs to the database periodically until the workers have run out of work; once the
+		// deadline has passed the workers only finish the jobs that are already running
+		std::chrono::time_point<std::chrono::steady_clock> expires = std::chrono::steady_clock::now() + deadline;
+		bool done = false;
+		while(!done) {
+
+			std::vector<finished_job> batch;
+
+			guard.lock();
+			signal.wait_for(guard, std::min(std::chrono::duration_cast<std::chrono::milliseconds>(PERSIST_INTERVAL), deadline),
+				[&]() -> bool { return ready.empty() && (running == 0); });
+			if((!stop) && (std::chrono::steady_clock::now() >= expires)) { stop = true; signal.notify_all(); }
+			done = ready.empty() && (running == 0);
+			batch.swap(results);
+			guard.unlock();
+
+			set_recording_jobs(instance, batch);
+		}
+
+		for(auto& thread : workers) thread.join();
+	}
+
+	catch(...) {
+
+		if(!guard.owns_lock()) guard.lock();
+		stop = true;
+		signal.notify_all();
+		guard.unlock();
+
+		for(auto& thread : workers) if(thread.joinable()) thread.join();
+		throw;
+	}
+
+	return static_cast<int>(items.size());
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
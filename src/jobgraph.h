@@ -0,0 +1,116 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __JOBGRAPH_H_
+#define __JOBGRAPH_H_
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "scalar_condition.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class jobgraph
+//
+// Runs the background jobs that follow the discovery of each recording.  Jobs
+// name the jobs whose output they need; a job runs for a recording as soon as
+// all of its inputs have completed for that recording, on a pool of workers
+// shared by all of the jobs.  Finished jobs are recorded in the database so
+// a recording only flows through the graph once, unless the file changes
+
+class jobgraph
+{
+public:
+
+	// Public Data Types
+	//
+	using job_t = std::function<void(int64_t recordingkey, char const* path, scalar_condition<bool> const& cancel)>;
+
+	// Instance Constructor
+	//
+	jobgraph(size_t maxworkers);
+
+	// Destructor
+	//
+	~jobgraph()=default;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// add
+	//
+	// Adds a job to the graph; the inputs must already have been added, which keeps the graph acyclic
+	void add(char const* name, std::initializer_list<char const*> inputs, job_t const& job);
+
+	// completed
+	//
+	// Gets the number of jobs that have completed successfully
+	uint64_t completed(void) const;
+
+	// failed
+	//
+	// Gets the number of jobs that have failed or were skipped because an input failed
+	uint64_t failed(void) const;
+
+	// run
+	//
+	// Runs the unfinished jobs of a batch of recordings, returns the number of recordings in the batch
+	int run(sqlite3* instance, int maxrecordings, std::chrono::milliseconds deadline, scalar_condition<bool> const& cancel);
+
+private:
+
+	jobgraph(jobgraph const&)=delete;
+	jobgraph& operator=(jobgraph const&)=delete;
+
+	// node_t
+	//
+	// Job within the graph
+	struct node_t
+	{
+		std::string					name;					// Job name
+		uint32_t					inputs;					// Mask of the input jobs
+		job_t						job;					// Job implementation
+	};
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	size_t const					m_maxworkers;			// Maximum number of worker threads
+	std::vector<node_t>				m_nodes;				// Jobs in dependency order
+	std::string						m_names;				// Comma-separated job names
+	std::atomic<uint64_t>			m_completed{ 0 };		// Number of completed jobs
+	std::atomic<uint64_t>			m_failed{ 0 };			// Number of failed jobs
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __JOBGRAPH_H_
@@ -0,0 +1,337 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "metadatapipeline.h"
+
+#include <algorithm>
+#include <array>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+
+#include "asfprovider.h"
+#include "mpegtsprovider.h"
+#include "propertystoreprovider.h"
+#include "sidecarprovider.h"
+#include "string_exception.h"
+#include "wtvprovider.h"
+
+#pragma warning(push, 4)
+
+// MAGIC_LENGTH
+//
+// Number of bytes read from the start of a file to select the providers
+static size_t const MAGIC_LENGTH = 256;
+
+// MAX_PROVIDERS
+//
+// Maximum number of metadata providers that can be registered
+static size_t const MAX_PROVIDERS = 8;
+
+// MAX_WORKER_THREADS
+//
+// Maximum number of I/O worker threads; enough for the loads discovery keeps in flight plus the threads
+// blocked on abandoned I/O and hedged attempts
+static size_t const MAX_WORKER_THREADS = 12;
+
+//---------------------------------------------------------------------------
+// metadatapipeline::pending_load_t
+//
+// State of a load started by begin_load(); each attempt loads into its own metadata since an
+// abandoned attempt can still be running after end_load() has returned
+
+struct metadatapipeline::pending_load_t
+{
+	iopool::ticket_t								ticket;			// I/O worker pool ticket
+	std::shared_ptr<std::array<recording_metadata, 2>>	results;		// Metadata loaded by each attempt
+};
+
+//---------------------------------------------------------------------------
+// metadatapipeline Constructor
+//
+// Arguments:
+//
+//	NONE
+
+metadatapipeline::metadatapipeline() : m_workers(MAX_WORKER_THREADS)
+{
+	// The native readers have a higher priority than the fallback providers, so the same file is always read
+	// by the same provider when it can be; the registration order breaks a tie between providers of equal cost
+	add(std::unique_ptr<metadataprovider>(new wtvprovider()));
+	add(std::unique_ptr<metadataprovider>(new asfprovider()));
+	add(std::unique_ptr<metadataprovider>(new mpegtsprovider()));
+	add(std::unique_ptr<metadataprovider>(new sidecarprovider()));
+	add(std::unique_ptr<metadataprovider>(new propertystoreprovider()));
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::add (private)
+//
+// Registers a metadata provider
+//
+// Arguments:
+//
+//	provider	- Provider instance to register
+
+void metadatapipeline::add(std::unique_ptr<metadataprovider> provider)
+{
+	if(!provider) throw std::invalid_argument("provider");
+	if(m_providers.size() >= MAX_PROVIDERS) throw string_exception(__func__, ": no more than ", MAX_PROVIDERS, " providers can be registered");
+
+	// Merge the provider extensions into the file mask used to list the recordings
+	char const* extensions = provider->extensions();
+	if(extensions != nullptr) {
+
+		std::istringstream stream(extensions);
+		std::string extension;
+
+		while(std::getline(stream, extension, '|')) {
+
+			std::string mask = "|" + m_extensions + "|";
+			if(mask.find("|" + extension + "|") != std::string::npos) continue;
+
+			if(!m_extensions.empty()) m_extensions.push_back('|');
+			m_extensions.append(extension);
+		}
+	}
+
+	m_providers.push_back(std::move(provider));
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::begin_load
+//
+// Starts loading the metadata for a file on the I/O worker pool; any number of loads can be in flight
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	deadline	- Maximum amount of time to wait for the metadata, including time spent waiting for a worker
+
+metadatapipeline::pending_load metadatapipeline::begin_load(wchar_t const* path, std::chrono::milliseconds deadline)
+{
+	if(path == nullptr) throw std::invalid_argument("path");
+
+	pending_load pending = std::make_shared<pending_load_t>();
+	pending->results = std::make_shared<std::array<recording_metadata, 2>>();
+
+	// The task owns copies of everything it needs, the caller may never wait for it
+	std::shared_ptr<std::array<recording_metadata, 2>> results = pending->results;
+	std::wstring filepath(path);
+
+	pending->ticket = m_workers.begin([this, results, filepath](int attempt) -> void { load(filepath.c_str(), (*results)[attempt]); }, deadline);
+
+	return pending;
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::decode
+//
+// Decodes raw metadata with the provider that loaded it, returns false if there is no such provider
+//
+// Arguments:
+//
+//	format		- Raw metadata format (provider name)
+//	data		- Pointer to the raw metadata
+//	length		- Length of the raw metadata
+//	metadata	- Metadata to be decoded
+
+bool metadatapipeline::decode(char const* format, void const* data, size_t length, recording_metadata& metadata)
+{
+	if(format == nullptr) throw std::invalid_argument("format");
+
+	for(auto const& provider : m_providers) {
+
+		if(strcmp(provider->name(), format) != 0) continue;
+
+		provider->decode(data, length, metadata);
+		return true;
+	}
+
+	return false;
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::end_load
+//
+// Waits for a load started by begin_load(); returns false if the deadline expired
+//
+// Arguments:
+//
+//	pending		- Handle returned from begin_load()
+//	metadata	- Metadata to be loaded
+
+bool metadatapipeline::end_load(pending_load const& pending, recording_metadata& metadata)
+{
+	if(!pending) throw std::invalid_argument("pending");
+
+	int winner = m_workers.end(pending->ticket);
+	if(winner < 0) return false;
+
+	std::swap(metadata, (*pending->results)[winner]);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::enumerate
+//
+// Enumerates the registered providers
+//
+// Arguments:
+//
+//	callback	- Callback function
+
+void metadatapipeline::enumerate(enumerate_providers_callback const& callback) const
+{
+	if(callback == nullptr) return;
+	for(auto const& provider : m_providers) callback(*provider);
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::extensions
+//
+// Gets the file mask of all the extensions read by the registered providers
+//
+// Arguments:
+//
+//	NONE
+
+char const* metadatapipeline::extensions(void) const
+{
+	return m_extensions.c_str();
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::hedged
+//
+// Gets the number of hedged loads that have been started
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t metadatapipeline::hedged(void) const
+{
+	return m_workers.hedged();
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::load
+//
+// Loads the metadata for a file, throws an exception if no provider could read it
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void metadatapipeline::load(wchar_t const* path, recording_metadata& metadata)
+{
+	uint8_t				magic[MAGIC_LENGTH];		// Bytes from the start of the file
+	DWORD				length = 0;					// Number of magic bytes read
+	std::string			errors;						// Accumulated provider errors
+
+	if(path == nullptr) throw std::invalid_argument("path");
+
+	// Read the start of the file to select the providers; if that fails the providers go by the extension
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file != INVALID_HANDLE_VALUE) {
+
+		if(!ReadFile(file, magic, sizeof(magic), &length, nullptr)) length = 0;
+		CloseHandle(file);
+	}
+
+	wchar_t const* extension = PathFindExtensionW(path);
+
+	// A hedged load can run at the same time as the original one, the candidates can't be shared
+	metadataprovider* candidates[MAX_PROVIDERS];
+	size_t count = 0;
+
+	for(auto const& provider : m_providers) 
+		if(provider->accepts(extension, magic, length)) candidates[count++] = provider.get();
+
+	// Try the providers in priority order, the cheapest first among those with the same priority, until the file has
+	// been read.  The cost only decides between equals; otherwise a fallback provider that has never run would be
+	// tried ahead of the native reader and the same file could be read differently depending on timing.  There are
+	// only a handful of candidates, an insertion sort keeps the order stable without the temporary buffer
+	// std::stable_sort would allocate
+	auto precedes = [](metadataprovider const* lhs, metadataprovider const* rhs) -> bool {
+
+		if(lhs->priority() != rhs->priority()) return lhs->priority() < rhs->priority();
+		return lhs->cost() < rhs->cost();
+	};
+
+	for(size_t index = 1; index < count; index++) {
+
+		metadataprovider* provider = candidates[index];
+
+		size_t position = index;
+		for(; (position > 0) && (precedes(provider, candidates[position - 1])); position--) candidates[position] = candidates[position - 1];
+		candidates[position] = provider;
+	}
+
+	for(size_t index = 0; index < count; index++) {
+
+		metadataprovider* provider = candidates[index];
+
+		try { provider->load(path, metadata); return; }
+		catch(std::exception& ex) { errors.append((errors.empty()) ? "" : "; ").append(provider->name()).append(": ").append(ex.what()); }
+	}
+
+	if(count == 0) throw string_exception(__func__, ": no metadata provider accepts the file");
+	throw string_exception(__func__, ": no metadata provider was able to read the file (", errors.c_str(), ")");
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::load
+//
+// Loads the metadata for a file on the I/O worker pool; returns false if the deadline expired
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+//	deadline	- Maximum amount of time to wait for the metadata
+
+bool metadatapipeline::load(wchar_t const* path, recording_metadata& metadata, std::chrono::milliseconds deadline)
+{
+	return end_load(begin_load(path, deadline), metadata);
+}
+
+//---------------------------------------------------------------------------
+// metadatapipeline::timeouts
+//
+// Gets the number of loads that did not complete before the deadline
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t metadatapipeline::timeouts(void) const
+{
+	return m_workers.timeouts();
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
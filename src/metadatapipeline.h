@@ -0,0 +1,141 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __METADATAPIPELINE_H_
+#define __METADATAPIPELINE_H_
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "iopool.h"
+#include "metadataprovider.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class metadatapipeline
+//
+// Chains the registered metadata providers together.  The providers that accept
+// a file, based on its extension and magic bytes, are tried in order of their
+// priority and then their measured cost until one of them is able to read it.  Loads with a deadline
+// run on an I/O worker pool so a file on an unresponsive share can be abandoned
+
+class metadatapipeline
+{
+public:
+
+	// Instance Constructor
+	//
+	metadatapipeline();
+
+	// Destructor
+	//
+	~metadatapipeline()=default;
+
+	//-----------------------------------------------------------------------
+	// Type Declarations
+
+	// enumerate_providers_callback
+	//
+	// Callback function passed to enumerate()
+	using enumerate_providers_callback = std::function<void(metadataprovider const& provider)>;
+
+	// pending_load
+	//
+	// Handle to a load started by begin_load()
+	struct pending_load_t;
+	using pending_load = std::shared_ptr<pending_load_t>;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// begin_load
+	//
+	// Starts loading the metadata for a file on the I/O worker pool; any number of loads can be in flight
+	pending_load begin_load(wchar_t const* path, std::chrono::milliseconds deadline);
+
+	// decode
+	//
+	// Decodes raw metadata with the provider that loaded it, returns false if there is no such provider
+	bool decode(char const* format, void const* data, size_t length, recording_metadata& metadata);
+
+	// end_load
+	//
+	// Waits for a load started by begin_load(); returns false if the deadline expired
+	bool end_load(pending_load const& pending, recording_metadata& metadata);
+
+	// enumerate
+	//
+	// Enumerates the registered providers
+	void enumerate(enumerate_providers_callback const& callback) const;
+
+	// extensions
+	//
+	// Gets the file mask of all the extensions read by the registered providers
+	char const* extensions(void) const;
+
+	// hedged
+	//
+	// Gets the number of hedged loads that have been started
+	uint64_t hedged(void) const;
+
+	// load
+	//
+	// Loads the metadata for a file, throws an exception if no provider could read it
+	void load(wchar_t const* path, recording_metadata& metadata);
+	bool load(wchar_t const* path, recording_metadata& metadata, std::chrono::milliseconds deadline);
+
+	// timeouts
+	//
+	// Gets the number of loads that did not complete before the deadline
+	uint64_t timeouts(void) const;
+
+private:
+
+	metadatapipeline(metadatapipeline const&)=delete;
+	metadatapipeline& operator=(metadatapipeline const&)=delete;
+
+	//-----------------------------------------------------------------------
+	// Private Member Functions
+
+	// add
+	//
+	// Registers a metadata provider
+	void add(std::unique_ptr<metadataprovider> provider);
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	std::vector<std::unique_ptr<metadataprovider>>	m_providers;	// Registered providers
+	std::string										m_extensions;	// File mask of known extensions
+	iopool											m_workers;		// I/O worker pool
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __METADATAPIPELINE_H_
@@ -0,0 +1,609 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "metadataprovider.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_exception.h"
+#include "transcode.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// DATA TYPES
+//---------------------------------------------------------------------------
+
+// attribute_column
+//
+// Recording metadata column an attribute is decoded into
+enum class attribute_column : uint8_t {
+
+	title,						// recording_metadata::title
+	episodename,				// recording_metadata::episodename
+	plot,						// recording_metadata::plot
+	channelname,				// recording_metadata::channelname
+	seriesnumber,				// recording_metadata::seriesnumber
+	episodenumber,				// recording_metadata::episodenumber
+	year,						// recording_metadata::year
+	recordingtime,				// recording_metadata::recordingtime
+	duration,					// recording_metadata::duration
+	ishd,						// recording_metadata::ishd
+};
+
+// attribute_encoding
+//
+// Conversion applied to an attribute value before it is stored in the column
+enum class attribute_encoding : uint8_t {
+
+	plain,						// Stored as-is; strings stored in integer columns are converted
+	fallback,					// Stored as-is, only if the column has not already been set
+	interval,					// Interval in 100ns units, stored as seconds
+	date,						// FILETIME or ISO 8601 date, stored as the year
+	ticks,						// .NET DateTime ticks, stored as a time_t
+};
+
+// attribute_type
+//
+// Value type(s) an attribute is accepted as
+enum class attribute_type : uint8_t {
+
+	numeric		= 0x01,			// Integer and boolean values
+	text		= 0x02,			// String values
+	any			= 0x03,			// Integer, boolean and string values
+};
+
+// attribute_t
+//
+// Defines a Windows Media attribute that is decoded into the recording metadata
+struct attribute_t {
+
+	char const*					name;			// Attribute name
+	attribute_type				type;			// Accepted value type(s)
+	attribute_column			column;			// Target metadata column
+	attribute_encoding			encoding;		// Value conversion
+};
+
+// hash_attribute (constexpr)
+//
+// FNV-1a hash of an attribute name; evaluated at compile time to build ATTRIBUTE_INDEX
+static constexpr uint32_t hash_attribute(char const* name)
+{
+	uint32_t hash = 2166136261U;
+	while(*name) hash = (hash ^ static_cast<uint8_t>(*name++)) * 16777619U;
+
+	return hash;
+}
+
+// ATTRIBUTES
+//
+// Windows Media attributes decoded by the ASF and WTV providers; adding an attribute only requires a new entry
+static constexpr attribute_t ATTRIBUTES[] = {
+
+	{ "Duration",							attribute_type::numeric,	attribute_column::duration,			attribute_encoding::interval },
+	{ "Title",								attribute_type::text,		attribute_column::title,			attribute_encoding::plain },
+	{ "WM/EpisodeNumber",					attribute_type::any,		attribute_column::episodenumber,	attribute_encoding::plain },
+	{ "WM/MediaOriginalBroadcastDateTime",	attribute_type::any,		attribute_column::year,				attribute_encoding::date },
+	{ "WM/MediaStationCallSign",			attribute_type::text,		attribute_column::channelname,		attribute_encoding::fallback },
+	{ "WM/MediaStationName",				attribute_type::text,		attribute_column::channelname,		attribute_encoding::plain },
+	{ "WM/SeasonNumber",					attribute_type::any,		attribute_column::seriesnumber,		attribute_encoding::plain },
+	{ "WM/SubTitle",						attribute_type::text,		attribute_column::episodename,		attribute_encoding::plain },
+	{ "WM/SubTitleDescription",				attribute_type::text,		attribute_column::plot,				attribute_encoding::plain },
+	{ "WM/WMRVEncodeTime",					attribute_type::numeric,	attribute_column::recordingtime,	attribute_encoding::ticks },
+	{ "WM/WMRVHDContent",					attribute_type::numeric,	attribute_column::ishd,				attribute_encoding::plain },
+};
+
+// ATTRIBUTE_COUNT
+//
+// Number of entries in ATTRIBUTES
+static constexpr size_t ATTRIBUTE_COUNT = sizeof(ATTRIBUTES) / sizeof(ATTRIBUTES[0]);
+
+// ATTRIBUTE_SLOTS
+//
+// Number of slots in ATTRIBUTE_INDEX; must be large enough that no two attribute names share a slot
+static constexpr size_t ATTRIBUTE_SLOTS = 64;
+
+// attribute_index_t
+//
+// Perfect hash table of ATTRIBUTES, generated at compile time
+struct attribute_index_t {
+
+	constexpr attribute_index_t() : slots{}, collisions(0)
+	{
+		for(size_t index = 0; index < ATTRIBUTE_COUNT; index++) {
+
+			size_t slot = hash_attribute(ATTRIBUTES[index].name) % ATTRIBUTE_SLOTS;
+			if(slots[slot] != 0) ++collisions;
+			slots[slot] = static_cast<uint8_t>(index + 1);
+		}
+	}
+
+	uint8_t						slots[ATTRIBUTE_SLOTS];		// 1-based index into ATTRIBUTES, zero if unused
+	size_t						collisions;					// Number of attribute names that share a slot
+};
+
+// ATTRIBUTE_INDEX
+//
+// Maps the hash of an attribute name to its ATTRIBUTES entry
+static constexpr attribute_index_t ATTRIBUTE_INDEX{};
+static_assert(ATTRIBUTE_INDEX.collisions == 0, "ATTRIBUTES names collide in ATTRIBUTE_INDEX; increase ATTRIBUTE_SLOTS");
+static_assert(ATTRIBUTE_COUNT < 0xFF, "ATTRIBUTES has too many entries for ATTRIBUTE_INDEX");
+
+// FILETIME_UNIX_EPOCH
+//
+// Number of seconds between the FILETIME epoch (1601) and the time_t epoch (1970)
+static uint64_t const FILETIME_UNIX_EPOCH = 11644473600ULL;
+
+// SCRATCH_BLOCK_SIZE
+//
+// Block size of the per-thread scratch arenas; large enough for the attribute data of a typical recording
+static size_t const SCRATCH_BLOCK_SIZE = 1 MiB;
+
+// TICKS_UNIX_EPOCH
+//
+// Number of seconds between the .NET DateTime epoch (0001) and the time_t epoch (1970)
+static uint64_t const TICKS_UNIX_EPOCH = 62135596800ULL;
+
+// FUNCTION PROTOTYPES
+//
+static attribute_t const* find_attribute(char const* name, attribute_type type);
+
+//
+// HELPER FUNCTIONS
+//
+
+// find_attribute
+//
+// Looks up an attribute by name, returns null if it isn't decoded or isn't accepted as the specified type
+static attribute_t const* find_attribute(char const* name, attribute_type type)
+{
+	uint8_t slot = ATTRIBUTE_INDEX.slots[hash_attribute(name) % ATTRIBUTE_SLOTS];
+	if(slot == 0) return nullptr;
+
+	// The index is a perfect hash of the known names; one comparison rejects any unknown name that hashed into the slot
+	attribute_t const* attribute = &ATTRIBUTES[slot - 1];
+	if(strcmp(attribute->name, name) != 0) return nullptr;
+
+	return ((static_cast<uint8_t>(attribute->type) & static_cast<uint8_t>(type)) != 0) ? attribute : nullptr;
+}
+
+//---------------------------------------------------------------------------
+// recording_metadata::clear
+//
+// Resets the metadata without releasing the string buffers
+//
+// Arguments:
+//
+//	NONE
+
+void recording_metadata::clear(void)
+{
+	title.clear();
+	episodename.clear();
+	plot.clear();
+	channelname.clear();
+	seriesnumber = 0;
+	episodenumber = 0;
+	year = 0;
+	recordingtime = 0;
+	duration = 0;
+	ishd = false;
+	format = nullptr;
+	raw.clear();
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::calls
+//
+// Gets the number of times the provider has been invoked
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t metadataprovider::calls(void) const
+{
+	return m_calls;
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::cost
+//
+// Gets the average time spent per successful load, in microseconds
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t metadataprovider::cost(void) const
+{
+	// Time spent on failed loads is included; a provider that often fails is more expensive
+	uint64_t calls = m_calls, failures = m_failures;
+	uint64_t successes = (calls > failures) ? calls - failures : 0;
+
+	return m_elapsed / ((successes > 0) ? successes : 1);
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::decode
+//
+// Decodes the metadata from raw metadata previously loaded by the provider, throws an exception on failure
+//
+// Arguments:
+//
+//	data		- Pointer to the raw metadata
+//	length		- Length of the raw metadata
+//	metadata	- Metadata to be decoded
+
+void metadataprovider::decode(void const* data, size_t length, recording_metadata& metadata)
+{
+	if((data == nullptr) && (length > 0)) throw std::invalid_argument("data");
+
+	scratch().reset();
+
+	metadata.clear();
+	parse(reinterpret_cast<uint8_t const*>(data), length, metadata);
+
+	if(metadata.title.empty()) throw string_exception(name(), ": no title was found");
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::failures
+//
+// Gets the number of times the provider has failed to read a file
+//
+// Arguments:
+//
+//	NONE
+
+uint64_t metadataprovider::failures(void) const
+{
+	return m_failures;
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::filetime_to_time (protected, static)
+//
+// Converts a FILETIME value (100ns units since 1601) into a time_t
+//
+// Arguments:
+//
+//	filetime	- FILETIME value to convert
+
+int metadataprovider::filetime_to_time(uint64_t filetime)
+{
+	uint64_t seconds = filetime / 10000000ULL;
+	return (seconds > FILETIME_UNIX_EPOCH) ? static_cast<int>(seconds - FILETIME_UNIX_EPOCH) : 0;
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::get_creation_time (protected, static)
+//
+// Gets the creation time of a file as a time_t
+//
+// Arguments:
+//
+//	path		- Path to the file
+
+int metadataprovider::get_creation_time(wchar_t const* path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA		attributes;			// File attribute data
+
+	if(!GetFileAttributesExW(path, GetFileExInfoStandard, &attributes)) return 0;
+
+	ULARGE_INTEGER creationtime = { attributes.ftCreationTime.dwLowDateTime, attributes.ftCreationTime.dwHighDateTime };
+	return filetime_to_time(creationtime.QuadPart);
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::get_le16 (protected, static)
+//
+// Reads an unaligned little-endian 16-bit integer from a buffer
+//
+// Arguments:
+//
+//	data		- Pointer to the integer
+
+uint16_t metadataprovider::get_le16(uint8_t const* data)
+{
+	return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::get_le32 (protected, static)
+//
+// Reads an unaligned little-endian 32-bit integer from a buffer
+//
+// Arguments:
+//
+//	data		- Pointer to the integer
+
+uint32_t metadataprovider::get_le32(uint8_t const* data)
+{
+	return static_cast<uint32_t>(get_le16(data)) | (static_cast<uint32_t>(get_le16(data + 2)) << 16);
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::get_le64 (protected, static)
+//
+// Reads an unaligned little-endian 64-bit integer from a buffer
+//
+// Arguments:
+//
+//	data		- Pointer to the integer
+
+uint64_t metadataprovider::get_le64(uint8_t const* data)
+{
+	return static_cast<uint64_t>(get_le32(data)) | (static_cast<uint64_t>(get_le32(data + 4)) << 32);
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::load
+//
+// Loads the metadata for a file, throws an exception on failure
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void metadataprovider::load(wchar_t const* path, recording_metadata& metadata)
+{
+	std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+	// Returns the number of microseconds spent since the load started
+	auto elapsed = [&]() -> uint64_t {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+	};
+
+	++m_calls;
+
+	try {
+
+		// Anything the previous file left in the scratch arena is no longer referenced
+		scratch().reset();
+
+		metadata.clear();
+		extract(path, metadata);
+
+		// Kodi requires a title for every recording; without one the file was not read successfully
+		if(metadata.title.empty()) throw string_exception(name(), ": no title was found");
+	}
+
+	catch(...) { ++m_failures; m_elapsed += elapsed(); throw; }
+
+	m_elapsed += elapsed();
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::open_file (protected, static)
+//
+// Opens a file for shared read-only access
+//
+// Arguments:
+//
+//	path		- Path to the file
+
+HANDLE metadataprovider::open_file(wchar_t const* path)
+{
+	// Recordings can still be in progress, allow the recorder to keep writing the file
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE) {
+
+		std::string utf8path;
+		utf16_to_utf8(path, wcslen(path), utf8path);
+		throw string_exception(__func__, ": unable to open file ", utf8path.c_str(), " (", GetLastError(), ")");
+	}
+
+	return file;
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::parse (protected)
+//
+// Provider specific implementation of decode(); the default implementation throws
+//
+// Arguments:
+//
+//	data		- Pointer to the raw metadata
+//	length		- Length of the raw metadata
+//	metadata	- Metadata to be decoded
+
+void metadataprovider::parse(uint8_t const* /*data*/, size_t /*length*/, recording_metadata& /*metadata*/)
+{
+	throw string_exception(name(), ": raw metadata is not supported by this provider");
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::read_file (protected, static)
+//
+// Reads a block of data from a specific position in a file
+//
+// Arguments:
+//
+//	file		- File handle
+//	position	- Position in the file to read from
+//	buffer		- Destination buffer
+//	length		- Number of bytes to read
+
+void metadataprovider::read_file(HANDLE file, uint64_t position, void* buffer, size_t length)
+{
+	OVERLAPPED				overlapped = {};		// Specifies the file position
+	DWORD					read = 0;				// Number of bytes read
+
+	if(length > MAXDWORD) throw string_exception(__func__, ": read length ", length, " is too large");
+
+	overlapped.Offset = static_cast<DWORD>(position & 0xFFFFFFFF);
+	overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+
+	if(!ReadFile(file, buffer, static_cast<DWORD>(length), &read, &overlapped) || (read != length)) 
+		throw string_exception(__func__, ": unable to read ", length, " bytes at position ", position);
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::scratch (protected, static)
+//
+// Gets the calling thread's arena for data that only lives until the next file is loaded
+//
+// Arguments:
+//
+//	NONE
+
+arena& metadataprovider::scratch(void)
+{
+	// Each discovery or I/O worker thread loads one file at a time, so each gets its own arena
+	static thread_local arena instance(SCRATCH_BLOCK_SIZE);
+	return instance;
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::set_attribute (protected, static)
+//
+// Applies a numeric Windows Media attribute to the metadata
+//
+// Arguments:
+//
+//	metadata	- Metadata to be updated
+//	name		- Attribute name
+//	value		- Attribute value
+
+void metadataprovider::set_attribute(recording_metadata& metadata, char const* name, uint64_t value)
+{
+	attribute_t const* attribute = find_attribute(name, attribute_type::numeric);
+	if(attribute == nullptr) return;
+
+	int converted = static_cast<int>(value);
+
+	// Interval (100ns units)
+	if(attribute->encoding == attribute_encoding::interval) converted = static_cast<int>(value / 10000000ULL);
+
+	// Date (FILETIME); a zero date is not set
+	else if(attribute->encoding == attribute_encoding::date) {
+
+		FILETIME filetime = { static_cast<DWORD>(value & 0xFFFFFFFF), static_cast<DWORD>(value >> 32) };
+		SYSTEMTIME systemtime;
+		if((value == 0) || (!FileTimeToSystemTime(&filetime, &systemtime))) return;
+		converted = static_cast<int>(systemtime.wYear);
+	}
+
+	// Ticks (.NET DateTime)
+	else if(attribute->encoding == attribute_encoding::ticks) {
+
+		uint64_t seconds = value / 10000000ULL;
+		converted = (seconds > TICKS_UNIX_EPOCH) ? static_cast<int>(seconds - TICKS_UNIX_EPOCH) : 0;
+	}
+
+	switch(attribute->column) {
+
+		case attribute_column::seriesnumber: metadata.seriesnumber = converted; break;
+		case attribute_column::episodenumber: metadata.episodenumber = converted; break;
+		case attribute_column::year: metadata.year = converted; break;
+		case attribute_column::recordingtime: metadata.recordingtime = converted; break;
+		case attribute_column::duration: metadata.duration = converted; break;
+		case attribute_column::ishd: metadata.ishd = (value != 0); break;
+
+		// Numeric values are not stored in the string columns
+		default: break;
+	}
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::set_attribute (protected, static)
+//
+// Applies a string Windows Media attribute to the metadata
+//
+// Arguments:
+//
+//	metadata	- Metadata to be updated
+//	name		- Attribute name
+//	value		- Attribute value (UTF-8)
+
+void metadataprovider::set_attribute(recording_metadata& metadata, char const* name, char const* value)
+{
+	attribute_t const* attribute = find_attribute(name, attribute_type::text);
+	if(attribute == nullptr) return;
+
+	int converted = 0;
+
+	// Date (ISO 8601); only the year is used
+	if(attribute->encoding == attribute_encoding::date) {
+
+		for(size_t index = 0; (index < 4) && (value[index] >= '0') && (value[index] <= '9'); index++) converted = (converted * 10) + (value[index] - '0');
+	}
+
+	else converted = atoi(value);
+
+	std::string* text = nullptr;
+	switch(attribute->column) {
+
+		case attribute_column::title: text = &metadata.title; break;
+		case attribute_column::episodename: text = &metadata.episodename; break;
+		case attribute_column::plot: text = &metadata.plot; break;
+		case attribute_column::channelname: text = &metadata.channelname; break;
+		case attribute_column::seriesnumber: metadata.seriesnumber = converted; break;
+		case attribute_column::episodenumber: metadata.episodenumber = converted; break;
+		case attribute_column::year: metadata.year = converted; break;
+		case attribute_column::recordingtime: metadata.recordingtime = converted; break;
+		case attribute_column::duration: metadata.duration = converted; break;
+		case attribute_column::ishd: metadata.ishd = (converted != 0); break;
+	}
+
+	// Fallback attributes are only used if the column has not already been set
+	if((text != nullptr) && ((attribute->encoding != attribute_encoding::fallback) || (text->empty()))) *text = value;
+}
+
+//---------------------------------------------------------------------------
+// metadataprovider::utf16le_to_utf8 (protected, static)
+//
+// Converts UTF-16LE string data stored in a buffer into a null-terminated UTF-8 string in the scratch arena
+//
+// Arguments:
+//
+//	data		- Pointer to the UTF-16LE string data
+//	length		- Length of the string data in bytes
+
+char const* metadataprovider::utf16le_to_utf8(uint8_t const* data, size_t length)
+{
+	wchar_t*			widestr = scratch().allocate<wchar_t>(length / 2);		// UTF-16 string
+	size_t				cch = 0;												// UTF-16 string length
+
+	// The string data isn't necessarily aligned, assemble the characters one at a time
+	for(size_t index = 0; index + 1 < length; index += 2) {
+
+		wchar_t ch = static_cast<wchar_t>(get_le16(data + index));
+		if(ch == L'\0') break;
+		widestr[cch++] = ch;
+	}
+
+	char* result = scratch().allocate<char>((cch * 3) + 1);
+	result[utf16_to_utf8(widestr, cch, result)] = '\0';
+
+	return result;
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,206 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __METADATAPROVIDER_H_
+#define __METADATAPROVIDER_H_
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include "arena.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Data Types
+//---------------------------------------------------------------------------
+
+// recording_metadata
+//
+// Metadata extracted from a recording file
+struct recording_metadata
+{
+	std::string				title;				// Series or program title
+	std::string				episodename;		// Episode name
+	std::string				plot;				// Program description
+	std::string				channelname;		// Station name
+	int						seriesnumber;		// Season number
+	int						episodenumber;		// Episode number
+	int						year;				// Original broadcast year
+	int						recordingtime;		// Recording time (time_t)
+	int						duration;			// Duration in seconds
+	bool					ishd;				// Flag if the recording is HD
+	char const*				format;				// Raw metadata format (provider name), null if none
+	std::string				raw;				// Raw metadata the fields were decoded from
+
+	// clear
+	//
+	// Resets the metadata without releasing the string buffers
+	void clear(void);
+};
+
+//---------------------------------------------------------------------------
+// Class metadataprovider
+//
+// Base class for the metadata providers used during discovery.  Each provider
+// has a static priority and keeps its own cost counters; the pipeline tries the
+// providers in priority order, and the cheapest of equal priority first
+
+class metadataprovider
+{
+public:
+
+	// Destructor
+	//
+	virtual ~metadataprovider()=default;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// accepts
+	//
+	// Determines if the provider can read a file based on the extension and magic bytes
+	virtual bool accepts(wchar_t const* extension, uint8_t const* magic, size_t length) const = 0;
+
+	// calls
+	//
+	// Gets the number of times the provider has been invoked
+	uint64_t calls(void) const;
+
+	// cost
+	//
+	// Gets the average time spent per successful load, in microseconds
+	uint64_t cost(void) const;
+
+	// decode
+	//
+	// Decodes the metadata from raw metadata previously loaded by the provider, throws an exception on failure
+	void decode(void const* data, size_t length, recording_metadata& metadata);
+
+	// extensions
+	//
+	// Gets the file extension(s) the provider reads natively, or null if it reads any file
+	virtual char const* extensions(void) const = 0;
+
+	// failures
+	//
+	// Gets the number of times the provider has failed to read a file
+	uint64_t failures(void) const;
+
+	// load
+	//
+	// Loads the metadata for a file, throws an exception on failure
+	void load(wchar_t const* path, recording_metadata& metadata);
+
+	// name
+	//
+	// Gets the name of the provider
+	virtual char const* name(void) const = 0;
+
+	// priority
+	//
+	// Gets the static priority of the provider; providers with a lower priority are always tried first and
+	// the measured cost only orders providers with the same priority
+	virtual int priority(void) const = 0;
+
+protected:
+
+	// Instance Constructor
+	//
+	metadataprovider()=default;
+
+	//-----------------------------------------------------------------------
+	// Protected Member Functions
+
+	// extract
+	//
+	// Provider specific implementation of load()
+	virtual void extract(wchar_t const* path, recording_metadata& metadata) = 0;
+
+	// filetime_to_time (static)
+	//
+	// Converts a FILETIME value (100ns units since 1601) into a time_t
+	static int filetime_to_time(uint64_t filetime);
+
+	// get_creation_time (static)
+	//
+	// Gets the creation time of a file as a time_t
+	static int get_creation_time(wchar_t const* path);
+
+	// get_le16/get_le32/get_le64 (static)
+	//
+	// Reads an unaligned little-endian integer from a buffer
+	static uint16_t get_le16(uint8_t const* data);
+	static uint32_t get_le32(uint8_t const* data);
+	static uint64_t get_le64(uint8_t const* data);
+
+	// parse
+	//
+	// Provider specific implementation of decode(); the default implementation throws
+	virtual void parse(uint8_t const* data, size_t length, recording_metadata& metadata);
+
+	// open_file (static)
+	//
+	// Opens a file for shared read-only access
+	static HANDLE open_file(wchar_t const* path);
+
+	// read_file (static)
+	//
+	// Reads a block of data from a specific position in a file
+	static void read_file(HANDLE file, uint64_t position, void* buffer, size_t length);
+
+	// scratch (static)
+	//
+	// Gets the calling thread's arena for data that only lives until the next file is loaded
+	static arena& scratch(void);
+
+	// set_attribute (static)
+	//
+	// Applies a Windows Media attribute to the metadata
+	static void set_attribute(recording_metadata& metadata, char const* name, uint64_t value);
+	static void set_attribute(recording_metadata& metadata, char const* name, char const* value);
+
+	// utf16le_to_utf8 (static)
+	//
+	// Converts UTF-16LE string data stored in a buffer into a null-terminated UTF-8 string in the scratch arena
+	static char const* utf16le_to_utf8(uint8_t const* data, size_t length);
+
+private:
+
+	metadataprovider(metadataprovider const&)=delete;
+	metadataprovider& operator=(metadataprovider const&)=delete;
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	std::atomic<uint64_t>		m_calls{ 0 };		// Number of calls to load()
+	std::atomic<uint64_t>		m_failures{ 0 };	// Number of failed calls to load()
+	std::atomic<uint64_t>		m_elapsed{ 0 };		// Total time spent in load() (us)
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __METADATAPROVIDER_H_
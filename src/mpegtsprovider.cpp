@@ -0,0 +1,614 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "mpegtsprovider.h"
+
+#include <algorithm>
+#include <string.h>
+#include <wchar.h>
+
+#include "string_exception.h"
+#include "transcode.h"
+
+#pragma warning(push, 4)
+
+// CHUNK_PACKETS
+//
+// Number of packets read from the file at a time
+static size_t const CHUNK_PACKETS = 1024;
+
+// MAX_PREFIX_LENGTH
+//
+// Maximum number of bytes read from the start of the file to find the tables; the SDT and the
+// EIT present/following sections are repeated at least every 2 seconds
+static uint64_t const MAX_PREFIX_LENGTH = 8 MiB;
+
+// MAX_SECTION_LENGTH
+//
+// Maximum length of a PSI/SI section, including the 3 byte header
+static size_t const MAX_SECTION_LENGTH = 3 + 0xFFF;
+
+// MAX_SUFFIX_LENGTH
+//
+// Number of bytes read from the end of the file to find the last program clock reference
+static uint64_t const MAX_SUFFIX_LENGTH = 1 MiB;
+
+// PACKET_SIZE / M2TS_PACKET_SIZE
+//
+// Length of a transport stream packet, and of a packet with the 4 byte M2TS timecode prefix
+static size_t const PACKET_SIZE = 188;
+static size_t const M2TS_PACKET_SIZE = 192;
+
+// PCR_CLOCK / PCR_WRAP
+//
+// Frequency of the program clock reference and the value at which it wraps around
+static uint64_t const PCR_CLOCK = 27000000ULL;
+static uint64_t const PCR_WRAP = (1ULL << 33) * 300ULL;
+
+// PID_PAT / PID_SDT / PID_EIT / PID_TDT
+//
+// Fixed PIDs of the program association table and the DVB service information tables
+static int const PID_PAT = 0x0000;
+static int const PID_SDT = 0x0011;
+static int const PID_EIT = 0x0012;
+static int const PID_TDT = 0x0014;
+
+// SYNC_BYTE
+//
+// Transport stream packet sync byte
+static uint8_t const SYNC_BYTE = 0x47;
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::accepts
+//
+// Determines if the provider can read a file based on the extension and magic bytes
+//
+// Arguments:
+//
+//	extension	- File extension, including the leading period
+//	magic		- Bytes read from the start of the file
+//	length		- Number of magic bytes available
+
+bool mpegtsprovider::accepts(wchar_t const* extension, uint8_t const* magic, size_t length) const
+{
+	// A transport stream is recognized by the sync bytes at the start of the first two packets
+	if(length > M2TS_PACKET_SIZE + 4) {
+
+		return ((magic[0] == SYNC_BYTE) && (magic[PACKET_SIZE] == SYNC_BYTE)) || 
+			((magic[4] == SYNC_BYTE) && (magic[M2TS_PACKET_SIZE + 4] == SYNC_BYTE));
+	}
+
+	// If the start of the file couldn't be read go by the extension alone
+	return (_wcsicmp(extension, L".ts") == 0);
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::decode_text (private, static)
+//
+// Converts a DVB SI text field into a null-terminated UTF-8 string in the scratch arena
+//
+// Arguments:
+//
+//	data		- Pointer to the text field
+//	length		- Length of the text field in bytes
+
+char const* mpegtsprovider::decode_text(uint8_t const* data, size_t length)
+{
+	char* result = scratch().allocate<char>((length * 3) + 1);
+	char* dest = result;
+
+	// The first byte selects the character table if it is less than 0x20 (EN 300 468 Annex A)
+	uint8_t table = ((length > 0) && (data[0] < 0x20)) ? data[0] : 0;
+	size_t skip = (table == 0) ? 0 : ((table == 0x10) ? 3 : 1);
+	data += std::min(skip, length);
+	length -= std::min(skip, length);
+
+	// UTF-8 is copied as-is
+	if(table == 0x15) {
+
+		memcpy(dest, data, length);
+		dest += length;
+	}
+
+	// UCS-2 big-endian; the private use control codes are dropped, except for CR/LF
+	else if(table == 0x11) {
+
+		wchar_t* widestr = scratch().allocate<wchar_t>(length / 2);
+		size_t cch = 0;
+
+		for(size_t index = 0; index + 1 < length; index += 2) {
+
+			wchar_t ch = static_cast<wchar_t>(get_be16(data + index));
+			if(ch == 0xE08A) widestr[cch++] = L'\n';
+			else if((ch >= 0x20) && ((ch < 0xE080) || (ch > 0xE09F))) widestr[cch++] = ch;
+		}
+
+		dest += utf16_to_utf8(widestr, cch, dest);
+	}
+
+	// All of the single byte tables are treated as ISO 8859-1, which matches them for the ASCII range and
+	// the common western accented characters; the C1 control codes are dropped, except for CR/LF
+	else {
+
+		for(size_t index = 0; index < length; index++) {
+
+			uint8_t ch = data[index];
+			if(ch == 0x8A) *dest++ = '\n';
+			else if(ch < 0x20) continue;
+			else if(ch < 0x80) *dest++ = static_cast<char>(ch);
+			else if(ch >= 0xA0) {
+
+				*dest++ = static_cast<char>(0xC0 | (ch >> 6));
+				*dest++ = static_cast<char>(0x80 | (ch & 0x3F));
+			}
+		}
+	}
+
+	*dest = '\0';
+	return result;
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::extensions
+//
+// Gets the file extension(s) the provider reads natively, or null if it reads any file
+//
+// Arguments:
+//
+//	NONE
+
+char const* mpegtsprovider::extensions(void) const
+{
+	return ".ts";
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::extract (private)
+//
+// Provider specific implementation of load()
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void mpegtsprovider::extract(wchar_t const* path, recording_metadata& metadata)
+{
+	uint8_t					probe[M2TS_PACKET_SIZE + PACKET_SIZE + 4];	// Start of the file
+	LARGE_INTEGER			filesize;							// Length of the file
+	size_t					packetsize = 0;						// Length of each packet
+	size_t					syncoffset = 0;						// Offset of the sync byte in each packet
+	section_t				sections[5] = {};					// PAT, PMT, SDT, EIT and TDT/TOT sections
+	event_t					events[2] = {};						// EIT present and following events
+	int						programnumber = -1;					// Program (service) number
+	int						pcrpid = -1;						// PID carrying the program clock reference
+	bool					pmtfound = false;					// Flag if the PMT was found
+	bool					sdtfound = false;					// Flag if the service was found in the SDT
+	int						servicetype = 0;					// DVB service type
+	char const*				servicename = nullptr;				// DVB service name
+	int						streamtime = 0;						// Time from the TDT/TOT (time_t)
+	bool					haspcr = false;						// Flag if a PCR was found
+	uint64_t				firstpcr = 0;						// First program clock reference
+	uint64_t				lastpcr = 0;						// Last program clock reference
+
+	// PAT and SI tables have fixed PIDs, the PMT PID comes from the PAT
+	int const pids[] = { PID_PAT, -1, PID_SDT, PID_EIT, PID_TDT };
+	for(size_t index = 0; index < sizeof(pids) / sizeof(pids[0]); index++) {
+
+		sections[index].pid = pids[index];
+		sections[index].continuity = -1;
+		sections[index].data = scratch().allocate<uint8_t>(MAX_SECTION_LENGTH);
+	}
+
+	// Processes a complete PSI/SI section
+	auto process_section = [&](int pid, uint8_t const* section, size_t length) -> void {
+
+		uint8_t tableid = section[0];
+
+		// Sections that use the long syntax have a version, a section number and a trailing CRC
+		bool longsyntax = ((section[1] & 0x80) != 0);
+		if(longsyntax && ((length < 12) || (get_section_crc(section, length) != 0))) return;
+		size_t end = (longsyntax) ? length - 4 : length;
+
+		// PAT: the recording is of the first program, which has a non-zero number
+		if((pid == PID_PAT) && (tableid == 0x00) && (programnumber < 0)) {
+
+			for(size_t offset = 8; offset + 4 <= end; offset += 4) {
+
+				int number = get_be16(section + offset);
+				if(number == 0) continue;
+
+				programnumber = number;
+				sections[1].pid = get_be16(section + offset + 2) & 0x1FFF;
+				break;
+			}
+		}
+
+		// PMT: only the PCR PID is needed
+		else if((pid == sections[1].pid) && (tableid == 0x02) && (get_be16(section + 3) == programnumber)) {
+
+			pcrpid = get_be16(section + 8) & 0x1FFF;
+			pmtfound = true;
+		}
+
+		// SDT (actual transport stream): the service descriptor has the service type and name
+		else if((pid == PID_SDT) && (tableid == 0x42) && (programnumber >= 0) && (!sdtfound)) {
+
+			for(size_t offset = 11; offset + 5 <= end;) {
+
+				int serviceid = get_be16(section + offset);
+				size_t descriptors = get_be16(section + offset + 3) & 0x0FFF;
+				offset += 5;
+				if(offset + descriptors > end) break;
+
+				for(size_t position = offset; (serviceid == programnumber) && (position + 2 <= offset + descriptors);) {
+
+					uint8_t const* descriptor = section + position;
+					size_t descriptorlength = descriptor[1];
+					if(position + 2 + descriptorlength > offset + descriptors) break;
+
+					// service_descriptor: type, provider name and service name
+					if((descriptor[0] == 0x48) && (descriptorlength >= 3)) {
+
+						size_t providerlength = descriptor[3];
+						if(4 + providerlength < 2 + descriptorlength) {
+
+							size_t namelength = std::min(static_cast<size_t>(descriptor[4 + providerlength]), descriptorlength - 3 - providerlength);
+							servicetype = descriptor[2];
+							servicename = decode_text(descriptor + 5 + providerlength, namelength);
+							sdtfound = true;
+						}
+					}
+
+					position += 2 + descriptorlength;
+				}
+
+				offset += descriptors;
+			}
+		}
+
+		// EIT present/following (actual transport stream): section 0 is the present event and section 1 the following one
+		else if((pid == PID_EIT) && (tableid == 0x4E) && (programnumber >= 0) && (get_be16(section + 3) == programnumber) && (section[6] <= 1)) {
+
+			event_t& event = events[section[6]];
+			if(event.found) return;
+
+			event.found = true;
+			if(14 + 12 > end) return;
+
+			uint8_t const* data = section + 14;
+			size_t descriptors = get_be16(data + 10) & 0x0FFF;
+			if(14 + 12 + descriptors > end) return;
+
+			event.starttime = get_utc_time(data + 2);
+			event.duration = get_bcd_duration(data + 7);
+
+			for(size_t position = 12; position + 2 <= 12 + descriptors;) {
+
+				uint8_t const* descriptor = data + position;
+				size_t descriptorlength = descriptor[1];
+				if(position + 2 + descriptorlength > 12 + descriptors) break;
+
+				// short_event_descriptor: language, event name and text
+				if((descriptor[0] == 0x4D) && (descriptorlength >= 5) && (event.name == nullptr)) {
+
+					size_t namelength = std::min(static_cast<size_t>(descriptor[5]), descriptorlength - 4);
+					event.name = decode_text(descriptor + 6, namelength);
+
+					if(4 + namelength < descriptorlength) {
+
+						size_t textlength = std::min(static_cast<size_t>(descriptor[6 + namelength]), descriptorlength - 5 - namelength);
+						event.text = decode_text(descriptor + 7 + namelength, textlength);
+					}
+				}
+
+				position += 2 + descriptorlength;
+			}
+		}
+
+		// TDT/TOT: the current UTC time of the stream
+		else if((pid == PID_TDT) && ((tableid == 0x70) || (tableid == 0x73)) && (length >= 8) && (streamtime == 0)) {
+
+			streamtime = get_utc_time(section + 3);
+		}
+	};
+
+	// Collects payload bytes into a section, processing each section as it completes
+	auto collect = [&](section_t& section, uint8_t const* data, size_t length) -> void {
+
+		while((length > 0) && (section.active)) {
+
+			// Stuffing bytes fill the rest of the packet after the last section
+			if((section.length == 0) && (*data == 0xFF)) { section.active = false; break; }
+
+			size_t total = (section.length < 3) ? 3 : 3 + (get_be16(section.data + 1) & 0x0FFF);
+			size_t count = std::min(total - section.length, length);
+
+			memcpy(section.data + section.length, data, count);
+			section.length += count;
+			data += count;
+			length -= count;
+
+			if(section.length < 3) continue;
+
+			total = 3 + (get_be16(section.data + 1) & 0x0FFF);
+			if(section.length == total) {
+
+				process_section(section.pid, section.data, total);
+				section.length = 0;
+			}
+		}
+	};
+
+	// Processes a transport stream packet; the sections are only needed from the start of the file
+	auto process_packet = [&](uint8_t const* packet, bool tables) -> void {
+
+		// Packets that lost sync or have an uncorrectable error are skipped
+		if((packet[0] != SYNC_BYTE) || ((packet[1] & 0x80) != 0)) return;
+
+		int pid = get_be16(packet + 1) & 0x1FFF;
+		int control = (packet[3] >> 4) & 0x03;
+		size_t payload = 4;
+
+		// The adaptation field carries the program clock reference
+		if((control & 0x02) != 0) {
+
+			size_t adaptationlength = packet[4];
+			if((pid == pcrpid) && (adaptationlength >= 7) && ((packet[5] & 0x10) != 0)) {
+
+				uint64_t base = (static_cast<uint64_t>(packet[6]) << 25) | (static_cast<uint64_t>(packet[7]) << 17) |
+					(static_cast<uint64_t>(packet[8]) << 9) | (static_cast<uint64_t>(packet[9]) << 1) | (packet[10] >> 7);
+				uint64_t pcr = (base * 300) + (((packet[10] & 0x01) << 8) | packet[11]);
+
+				if(!haspcr) firstpcr = pcr;
+				lastpcr = pcr;
+				haspcr = true;
+			}
+
+			payload = 5 + adaptationlength;
+		}
+
+		if((!tables) || ((control & 0x01) == 0) || (payload >= PACKET_SIZE)) return;
+
+		for(section_t& section : sections) {
+
+			if(section.pid != pid) continue;
+
+			// Duplicate packets are ignored and a discontinuity abandons the section being collected
+			int continuity = packet[3] & 0x0F;
+			if(continuity == section.continuity) return;
+			if((section.continuity >= 0) && (continuity != ((section.continuity + 1) & 0x0F))) { section.active = false; section.length = 0; }
+			section.continuity = continuity;
+
+			uint8_t const* data = packet + payload;
+			size_t length = PACKET_SIZE - payload;
+
+			// The pointer field at the start of a payload unit gives the start of the next section
+			if((packet[1] & 0x40) != 0) {
+
+				size_t pointer = data[0];
+				if(pointer + 1 > length) { section.active = false; section.length = 0; return; }
+
+				collect(section, data + 1, pointer);
+				section.active = true;
+				section.length = 0;
+				collect(section, data + 1 + pointer, length - 1 - pointer);
+			}
+
+			else collect(section, data, length);
+
+			return;
+		}
+	};
+
+	// Determines if everything that is read from the start of the file has been found
+	auto complete = [&]() -> bool {
+		return (pmtfound && sdtfound && events[0].found && events[1].found && haspcr);
+	};
+
+	HANDLE file = open_file(path);
+
+	try {
+
+		if(!GetFileSizeEx(file, &filesize)) throw string_exception(__func__, ": unable to determine the file size (", GetLastError(), ")");
+		uint64_t length = static_cast<uint64_t>(filesize.QuadPart);
+
+		// A transport stream is recognized by the sync bytes at the start of the first two packets
+		if(length < sizeof(probe)) throw string_exception(__func__, ": file is too small to be an MPEG transport stream");
+		read_file(file, 0, probe, sizeof(probe));
+
+		if((probe[0] == SYNC_BYTE) && (probe[PACKET_SIZE] == SYNC_BYTE)) packetsize = PACKET_SIZE;
+		else if((probe[4] == SYNC_BYTE) && (probe[M2TS_PACKET_SIZE + 4] == SYNC_BYTE)) { packetsize = M2TS_PACKET_SIZE; syncoffset = 4; }
+		else throw string_exception(__func__, ": file is not an MPEG transport stream");
+
+		size_t chunklength = CHUNK_PACKETS * packetsize;
+		uint8_t* chunk = scratch().allocate<uint8_t>(chunklength);
+
+		// Reads and processes the packets in a range of the file, optionally stopping once everything has been found
+		auto scan = [&](uint64_t position, uint64_t end, bool tables) -> uint64_t {
+
+			while((position < end) && ((!tables) || (!complete()))) {
+
+				size_t count = static_cast<size_t>(std::min(static_cast<uint64_t>(chunklength), end - position));
+				read_file(file, position, chunk, count);
+
+				for(size_t offset = syncoffset; offset + PACKET_SIZE <= count; offset += packetsize) process_packet(chunk + offset, tables);
+				position += count;
+			}
+
+			return position;
+		};
+
+		// Read the tables from the start of the file, then the last program clock reference from the end
+		uint64_t position = scan(0, std::min(length, MAX_PREFIX_LENGTH), true);
+		if(length > position) {
+
+			uint64_t suffix = (length > MAX_SUFFIX_LENGTH) ? ((length - MAX_SUFFIX_LENGTH) / packetsize) * packetsize : 0;
+			scan(std::max(position, suffix), length, false);
+		}
+
+		CloseHandle(file);
+	}
+
+	catch(...) { CloseHandle(file); throw; }
+
+	// Estimate the duration from the program clock references, allowing for one wrap around
+	int duration = (haspcr) ? static_cast<int>(((lastpcr + PCR_WRAP - firstpcr) % PCR_WRAP) / PCR_CLOCK) : 0;
+
+	// The recording is of whichever of the present or following events it overlaps the most; a recording
+	// usually starts a little before the event so the present event can be the one that is ending
+	int recordingstart = (streamtime != 0) ? streamtime : get_creation_time(path);
+	event_t const* event = nullptr;
+	int overlap = 0;
+
+	for(event_t const& candidate : events) {
+
+		if(candidate.name == nullptr) continue;
+		if(event == nullptr) event = &candidate;
+
+		if((recordingstart == 0) || (candidate.starttime == 0)) continue;
+
+		int current = std::min(candidate.starttime + candidate.duration, recordingstart + std::max(duration, 1)) - std::max(candidate.starttime, recordingstart);
+		if(current > overlap) { event = &candidate; overlap = current; }
+	}
+
+	// Without an event the title is taken from the file name, as there is nothing else to go by
+	if((event != nullptr) && (*event->name != '\0')) metadata.title = event->name;
+	else {
+
+		wchar_t const* filename = PathFindFileNameW(path);
+		wchar_t const* extension = wcsrchr(filename, L'.');
+		utf16_to_utf8(filename, (extension != nullptr) ? static_cast<size_t>(extension - filename) : wcslen(filename), metadata.title);
+	}
+
+	if((event != nullptr) && (event->text != nullptr)) metadata.plot = event->text;
+	if(servicename != nullptr) metadata.channelname = servicename;
+
+	metadata.recordingtime = ((event != nullptr) && (event->starttime != 0)) ? event->starttime : recordingstart;
+	metadata.duration = ((duration == 0) && (event != nullptr)) ? event->duration : duration;
+
+	// MPEG-2 HD, H.264 HD and HEVC service types
+	metadata.ishd = ((servicetype == 0x11) || (servicetype == 0x19) || (servicetype == 0x1F) || (servicetype == 0x20));
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::get_bcd_duration (private, static)
+//
+// Converts a 24-bit BCD hhmmss field into a number of seconds
+//
+// Arguments:
+//
+//	data		- Pointer to the BCD field
+
+int mpegtsprovider::get_bcd_duration(uint8_t const* data)
+{
+	auto bcd = [](uint8_t value) -> int { return ((value >> 4) * 10) + (value & 0x0F); };
+	return (bcd(data[0]) * 3600) + (bcd(data[1]) * 60) + bcd(data[2]);
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::get_be16 (private, static)
+//
+// Reads a big-endian 16-bit integer from a buffer
+//
+// Arguments:
+//
+//	data		- Pointer to the integer
+
+uint16_t mpegtsprovider::get_be16(uint8_t const* data)
+{
+	return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::get_section_crc (private, static)
+//
+// Calculates the MPEG-2 CRC32 of a section, which is zero if the section is intact
+//
+// Arguments:
+//
+//	data		- Pointer to the section, including the trailing CRC
+//	length		- Length of the section
+
+uint32_t mpegtsprovider::get_section_crc(uint8_t const* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for(size_t index = 0; index < length; index++) {
+
+		crc ^= static_cast<uint32_t>(data[index]) << 24;
+		for(int bit = 0; bit < 8; bit++) crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+	}
+
+	return crc;
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::get_utc_time (private, static)
+//
+// Converts a 40-bit MJD/BCD UTC time field into a time_t, 0 if the time is undefined
+//
+// Arguments:
+//
+//	data		- Pointer to the time field
+
+int mpegtsprovider::get_utc_time(uint8_t const* data)
+{
+	// Modified Julian Date 40587 is 1970-01-01; an undefined time has all of the bits set
+	int mjd = get_be16(data);
+	if((mjd == 0xFFFF) || (mjd < 40587)) return 0;
+
+	return ((mjd - 40587) * 86400) + get_bcd_duration(data + 2);
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::name
+//
+// Gets the name of the provider
+//
+// Arguments:
+//
+//	NONE
+
+char const* mpegtsprovider::name(void) const
+{
+	return "mpeg-ts";
+}
+
+//---------------------------------------------------------------------------
+// mpegtsprovider::priority
+//
+// Gets the static priority of the provider; lower values are tried first
+//
+// Arguments:
+//
+//	NONE
+
+int mpegtsprovider::priority(void) const
+{
+	return 0;		// Native reader of the MPEG-TS format; always tried before the fallback providers
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,138 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __MPEGTSPROVIDER_H_
+#define __MPEGTSPROVIDER_H_
+#pragma once
+
+#include "metadataprovider.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class mpegtsprovider
+//
+// Reads the metadata of MPEG transport stream recordings
+
+class mpegtsprovider : public metadataprovider
+{
+public:
+
+	// Instance Constructor
+	//
+	mpegtsprovider()=default;
+
+	// Destructor
+	//
+	virtual ~mpegtsprovider()=default;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// accepts (metadataprovider)
+	//
+	// Determines if the provider can read a file based on the extension and magic bytes
+	virtual bool accepts(wchar_t const* extension, uint8_t const* magic, size_t length) const override;
+
+	// extensions (metadataprovider)
+	//
+	// Gets the file extension(s) the provider reads natively, or null if it reads any file
+	virtual char const* extensions(void) const override;
+
+	// name (metadataprovider)
+	//
+	// Gets the name of the provider
+	virtual char const* name(void) const override;
+
+	// priority (metadataprovider)
+	//
+	// Gets the static priority of the provider; lower values are tried first
+	virtual int priority(void) const override;
+
+private:
+
+	mpegtsprovider(mpegtsprovider const&)=delete;
+	mpegtsprovider& operator=(mpegtsprovider const&)=delete;
+
+	// event_t
+	//
+	// Event described by an EIT present/following section
+	struct event_t
+	{
+		bool			found;			// Flag if the section has been seen
+		int				starttime;		// Event start time (time_t), 0 if undefined
+		int				duration;		// Event duration in seconds
+		char const*		name;			// Event name (UTF-8)
+		char const*		text;			// Event description (UTF-8)
+	};
+
+	// section_t
+	//
+	// Reassembles the PSI/SI sections carried by a PID
+	struct section_t
+	{
+		int				pid;			// PID carrying the sections, -1 if not known yet
+		int				continuity;		// Last continuity counter, -1 if none
+		bool			active;			// Flag if a section is being collected
+		uint8_t*		data;			// Section data
+		size_t			length;			// Number of bytes collected
+	};
+
+	//-----------------------------------------------------------------------
+	// Private Member Functions
+
+	// decode_text (static)
+	//
+	// Converts a DVB SI text field into a null-terminated UTF-8 string in the scratch arena
+	static char const* decode_text(uint8_t const* data, size_t length);
+
+	// extract (metadataprovider)
+	//
+	// Provider specific implementation of load()
+	virtual void extract(wchar_t const* path, recording_metadata& metadata) override;
+
+	// get_bcd_duration (static)
+	//
+	// Converts a 24-bit BCD hhmmss field into a number of seconds
+	static int get_bcd_duration(uint8_t const* data);
+
+	// get_be16 (static)
+	//
+	// Reads a big-endian 16-bit integer from a buffer
+	static uint16_t get_be16(uint8_t const* data);
+
+	// get_section_crc (static)
+	//
+	// Calculates the MPEG-2 CRC32 of a section, which is zero if the section is intact
+	static uint32_t get_section_crc(uint8_t const* data, size_t length);
+
+	// get_utc_time (static)
+	//
+	// Converts a 40-bit MJD/BCD UTC time field into a time_t, 0 if the time is undefined
+	static int get_utc_time(uint8_t const* data);
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __MPEGTSPROVIDER_H_
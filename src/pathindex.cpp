@@ -0,0 +1,255 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "pathindex.h"
+
+#include <stdexcept>
+#include <string.h>
+
+#include "collation.h"
+
+#pragma warning(push, 4)
+
+// EMPTY_HASH / DELETED_HASH
+//
+// Reserved hash values used to mark unused slots in the hash table
+static uint64_t const EMPTY_HASH = 0;
+static uint64_t const DELETED_HASH = 1;
+
+// INITIAL_CAPACITY
+//
+// Initial capacity of the hash table; must be a power of two
+static size_t const INITIAL_CAPACITY = 1024;
+
+//---------------------------------------------------------------------------
+// pathindex Constructor
+//
+// Arguments:
+//
+//	NONE
+
+pathindex::pathindex() : m_table(INITIAL_CAPACITY)
+{
+}
+
+//---------------------------------------------------------------------------
+// pathindex::check
+//
+// Checks the status of a path against the known size and modification time
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	size		- Current size of the file
+//	mtime		- Current modification time of the file
+
+pathindex::status pathindex::check(char const* path, uint64_t size, int64_t mtime) const
+{
+	int64_t rowid;
+	return check(path, size, mtime, rowid);
+}
+
+//---------------------------------------------------------------------------
+// pathindex::check
+//
+// Checks the status of a path against the known size and modification time
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	size		- Current size of the file
+//	mtime		- Current modification time of the file
+//	rowid		- On success, receives the database row identifier
+
+pathindex::status pathindex::check(char const* path, uint64_t size, int64_t mtime, int64_t& rowid) const
+{
+	rowid = 0;
+	if(path == nullptr) throw std::invalid_argument("path");
+
+	uint64_t key = hash(path);
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	entry_t const& entry = m_table[find(key)];
+	if(entry.hash != key) return status::unknown;
+
+	rowid = entry.rowid;
+	return ((entry.size == size) && (entry.mtime == mtime)) ? status::unchanged : status::changed;
+}
+
+//---------------------------------------------------------------------------
+// pathindex::clear
+//
+// Removes all entries from the index
+//
+// Arguments:
+//
+//	NONE
+
+void pathindex::clear(void)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	m_table.assign(INITIAL_CAPACITY, entry_t{ EMPTY_HASH, 0, 0, 0 });
+	m_count = m_deleted = 0;
+}
+
+//---------------------------------------------------------------------------
+// pathindex::find (private)
+//
+// Locates the slot for a path hash, or the slot it should be inserted into
+//
+// Arguments:
+//
+//	hash		- Path hash to locate
+
+size_t pathindex::find(uint64_t hash) const
+{
+	size_t const mask = m_table.size() - 1;
+	size_t insertat = m_table.size();
+
+	// Linear probing; remember the first deleted slot in case the hash isn't present
+	for(size_t index = static_cast<size_t>(hash) & mask; ; index = (index + 1) & mask) {
+
+		uint64_t slothash = m_table[index].hash;
+
+		if(slothash == hash) return index;
+		if(slothash == EMPTY_HASH) return (insertat != m_table.size()) ? insertat : index;
+		if((slothash == DELETED_HASH) && (insertat == m_table.size())) insertat = index;
+	}
+}
+
+//---------------------------------------------------------------------------
+// pathindex::hash (private, static)
+//
+// Generates the case-insensitive 64-bit FNV-1a hash of a path
+//
+// Arguments:
+//
+//	path		- Path to be hashed
+
+uint64_t pathindex::hash(char const* path)
+{
+	uint64_t hash = path_hash(path, static_cast<int>(strlen(path)));
+
+	// Don't allow the hash to collide with the reserved slot values
+	return (hash <= DELETED_HASH) ? hash + 2 : hash;
+}
+
+//---------------------------------------------------------------------------
+// pathindex::insert
+//
+// Inserts or replaces the entry for a path
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	size		- Size of the file
+//	mtime		- Modification time of the file
+//	rowid		- Database row identifier
+
+void pathindex::insert(char const* path, uint64_t size, int64_t mtime, int64_t rowid)
+{
+	if(path == nullptr) throw std::invalid_argument("path");
+
+	uint64_t key = hash(path);
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	// Keep the load factor (including deleted slots) at or below 75%
+	if(((m_count + m_deleted + 1) * 4) > (m_table.size() * 3))
+		rehash(((m_count + 1) * 2 > m_table.size()) ? m_table.size() * 2 : m_table.size());
+
+	entry_t& entry = m_table[find(key)];
+	if(entry.hash != key) {
+
+		if(entry.hash == DELETED_HASH) --m_deleted;
+		++m_count;
+	}
+
+	entry = entry_t{ key, size, mtime, rowid };
+}
+
+//---------------------------------------------------------------------------
+// pathindex::rehash (private)
+//
+// Resizes the hash table to the specified capacity
+//
+// Arguments:
+//
+//	capacity	- New hash table capacity; must be a power of two
+
+void pathindex::rehash(size_t capacity)
+{
+	std::vector<entry_t> table(capacity);
+	table.swap(m_table);
+	m_deleted = 0;
+
+	// Reinsert all of the live entries from the previous hash table
+	for(auto const& entry : table)
+		if(entry.hash > DELETED_HASH) m_table[find(entry.hash)] = entry;
+}
+
+//---------------------------------------------------------------------------
+// pathindex::remove
+//
+// Removes the entry for a path
+//
+// Arguments:
+//
+//	path		- Path to the file
+
+void pathindex::remove(char const* path)
+{
+	if(path == nullptr) throw std::invalid_argument("path");
+
+	uint64_t key = hash(path);
+
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	entry_t& entry = m_table[find(key)];
+	if(entry.hash != key) return;
+
+	entry.hash = DELETED_HASH;
+	--m_count;
+	++m_deleted;
+}
+
+//---------------------------------------------------------------------------
+// pathindex::size
+//
+// Gets the number of entries in the index
+//
+// Arguments:
+//
+//	NONE
+
+size_t pathindex::size(void) const
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	return m_count;
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
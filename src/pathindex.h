@@ -0,0 +1,131 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __PATHINDEX_H_
+#define __PATHINDEX_H_
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class pathindex
+//
+// Implements a compact open-addressing hash set of known recording paths used
+// to decide if a file is new, changed or unchanged without querying the database
+
+class pathindex
+{
+public:
+
+	// Public Data Types
+	//
+	enum class status { unknown, changed, unchanged };
+
+	// Instance Constructor
+	//
+	pathindex();
+
+	// Destructor
+	//
+	~pathindex()=default;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// check
+	//
+	// Checks the status of a path against the known size and modification time
+	status check(char const* path, uint64_t size, int64_t mtime) const;
+	status check(char const* path, uint64_t size, int64_t mtime, int64_t& rowid) const;
+
+	// clear
+	//
+	// Removes all entries from the index
+	void clear(void);
+
+	// insert
+	//
+	// Inserts or replaces the entry for a path
+	void insert(char const* path, uint64_t size, int64_t mtime, int64_t rowid);
+
+	// remove
+	//
+	// Removes the entry for a path
+	void remove(char const* path);
+
+	// size
+	//
+	// Gets the number of entries in the index
+	size_t size(void) const;
+
+private:
+
+	pathindex(pathindex const&)=delete;
+	pathindex& operator=(pathindex const&)=delete;
+
+	// entry_t
+	//
+	// Hash table element type; the path itself is not stored, only its hash
+	struct entry_t
+	{
+		uint64_t	hash;			// Path hash (0 = empty, 1 = deleted)
+		uint64_t	size;			// File size
+		int64_t		mtime;			// File modification time
+		int64_t		rowid;			// Database row identifier
+	};
+
+	//-----------------------------------------------------------------------
+	// Private Member Functions
+
+	// find
+	//
+	// Locates the slot for a path hash, or the slot it should be inserted into
+	size_t find(uint64_t hash) const;
+
+	// hash
+	//
+	// Generates the case-insensitive 64-bit hash of a path
+	static uint64_t hash(char const* path);
+
+	// rehash
+	//
+	// Resizes the hash table to the specified capacity
+	void rehash(size_t capacity);
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	std::vector<entry_t>		m_table;				// Hash table
+	size_t						m_count = 0;			// Number of live entries
+	size_t						m_deleted = 0;			// Number of deleted entries
+	mutable std::mutex			m_lock;					// Synchronization object
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __PATHINDEX_H_
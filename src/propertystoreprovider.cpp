@@ -0,0 +1,252 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "propertystoreprovider.h"
+
+#include <string>
+
+#include "string_exception.h"
+#include "transcode.h"
+
+#pragma warning(push, 4)
+
+// FUNCTION PROTOTYPES
+//
+static bool get_bool(IPropertyStore* store, PROPERTYKEY const& key);
+static uint64_t get_filetime(IPropertyStore* store, PROPERTYKEY const& key);
+static uint32_t get_ui4(IPropertyStore* store, PROPERTYKEY const& key);
+static uint64_t get_ui8(IPropertyStore* store, PROPERTYKEY const& key);
+static void get_utf8(IPropertyStore* store, PROPERTYKEY const& key, std::string& result);
+
+//
+// HELPER FUNCTIONS
+//
+
+// get_bool
+//
+// Retrieves a VT_BOOL property from an IPropertyStore instance
+static bool get_bool(IPropertyStore* store, PROPERTYKEY const& key)
+{
+	PROPVARIANT				value;				// PROPVARIANT value
+	bool					result = false;		// Result from this function
+
+	assert(store);
+	PropVariantInit(&value);
+
+	// Attempt to retrieve the value from the property store and set the result if successful
+	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_BOOL)) result = (value.boolVal != 0);
+
+	PropVariantClear(&value);
+	return result;
+}
+
+// get_filetime
+//
+// Retrieves a VT_FILETIME property from an IPropertyStore instance
+static uint64_t get_filetime(IPropertyStore* store, PROPERTYKEY const& key)
+{
+	PROPVARIANT				value;				// PROPVARIANT value
+	uint64_t				result = 0;			// Result from this function
+
+	assert(store);
+	PropVariantInit(&value);
+
+	// Attempt to retrieve the value from the property store and set the result if successful
+	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_FILETIME)) {
+
+		ULARGE_INTEGER filetime = { value.filetime.dwLowDateTime, value.filetime.dwHighDateTime };
+		result = filetime.QuadPart;
+	}
+
+	PropVariantClear(&value);
+	return result;
+}
+
+// get_ui4
+//
+// Retrieves a VT_UI4 property from an IPropertyStore instance
+static uint32_t get_ui4(IPropertyStore* store, PROPERTYKEY const& key)
+{
+	PROPVARIANT				value;				// PROPVARIANT value
+	uint32_t				result = 0;			// Result from this function
+
+	assert(store);
+	PropVariantInit(&value);
+
+	// Attempt to retrieve the value from the property store and set the result if successful
+	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_UI4)) result = value.ulVal;
+
+	PropVariantClear(&value);
+	return result;
+}
+
+// get_ui8
+//
+// Retrieves a VT_UI8 property from an IPropertyStore instance
+static uint64_t get_ui8(IPropertyStore* store, PROPERTYKEY const& key)
+{
+	PROPVARIANT				value;				// PROPVARIANT value
+	uint64_t				result = 0;			// Result from this function
+
+	assert(store);
+	PropVariantInit(&value);
+
+	// Attempt to retrieve the value from the property store and set the result if successful
+	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_UI8)) result = value.uhVal.QuadPart;
+
+	PropVariantClear(&value);
+	return result;
+}
+
+// get_utf8
+//
+// Retrieves a VT_LPWSTR property from an IPropertyStore instance as UTF-8
+static void get_utf8(IPropertyStore* store, PROPERTYKEY const& key, std::string& result)
+{
+	PROPVARIANT				value;			// PROPVARIANT value
+
+	assert(store);
+	PropVariantInit(&value);
+	result.clear();
+
+	// Attempt to retrieve the value from the property store and convert it directly into the result
+	if(SUCCEEDED(store->GetValue(key, &value)) && (value.vt == VT_LPWSTR) && (value.pwszVal != nullptr)) 
+		utf16_to_utf8(value.pwszVal, wcslen(value.pwszVal), result);
+
+	PropVariantClear(&value);
+}
+
+//---------------------------------------------------------------------------
+// propertystoreprovider::accepts
+//
+// Determines if the provider can read a file based on the extension and magic bytes
+//
+// Arguments:
+//
+//	extension	- File extension, including the leading period
+//	magic		- Bytes read from the start of the file
+//	length		- Number of magic bytes available
+
+bool propertystoreprovider::accepts(wchar_t const* extension, uint8_t const* /*magic*/, size_t /*length*/) const
+{
+	// The shell chooses the property handler based on the extension alone
+	return (_wcsicmp(extension, L".wtv") == 0) || (_wcsicmp(extension, L".dvr-ms") == 0);
+}
+
+//---------------------------------------------------------------------------
+// propertystoreprovider::extensions
+//
+// Gets the file extension(s) the provider reads natively, or null if it reads any file
+//
+// Arguments:
+//
+//	NONE
+
+char const* propertystoreprovider::extensions(void) const
+{
+	return ".wtv|.dvr-ms";
+}
+
+//---------------------------------------------------------------------------
+// propertystoreprovider::extract (private)
+//
+// Provider specific implementation of load()
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void propertystoreprovider::extract(wchar_t const* path, recording_metadata& metadata)
+{
+	IShellItem2*			shellitem = nullptr;		// IShellItem2 instance pointer
+	IPropertyStore*			store = nullptr;			// IPropertyStore instance pointer
+	HRESULT					hresult;					// Result from COM/OLE function call
+
+	// Create an IShellItem2 instance from the path
+	hresult = SHCreateItemFromParsingName(path, nullptr, IID_IShellItem2, reinterpret_cast<void**>(&shellitem));
+	if(FAILED(hresult)) throw string_exception("SHCreateItemFromParsingName() failed");
+
+	// Query for the GPS_DEFAULT IPropertyStore instance; always done with IShellItem2 afterwards
+	hresult = shellitem->GetPropertyStore(GETPROPERTYSTOREFLAGS::GPS_DEFAULT, IID_IPropertyStore, reinterpret_cast<void**>(&store));
+	shellitem->Release();
+	if(FAILED(hresult)) throw string_exception("shellitem->GetPropertyStore() failed");
+
+	try {
+
+		get_utf8(store, PKEY_Title, metadata.title);
+		get_utf8(store, PKEY_RecordedTV_EpisodeName, metadata.episodename);
+		metadata.seriesnumber = static_cast<int>(get_ui4(store, PKEY_Media_SeasonNumber));
+		metadata.episodenumber = static_cast<int>(get_ui4(store, PKEY_Media_EpisodeNumber));
+
+		uint64_t originalbroadcastdate = get_filetime(store, PKEY_RecordedTV_OriginalBroadcastDate);
+		if(originalbroadcastdate != 0) {
+
+			FILETIME filetime = { static_cast<DWORD>(originalbroadcastdate & 0xFFFFFFFF), static_cast<DWORD>(originalbroadcastdate >> 32) };
+			SYSTEMTIME systemtime;
+			if(FileTimeToSystemTime(&filetime, &systemtime)) metadata.year = static_cast<int>(systemtime.wYear);
+		}
+
+		get_utf8(store, PKEY_RecordedTV_ProgramDescription, metadata.plot);
+		get_utf8(store, PKEY_RecordedTV_StationName, metadata.channelname);
+		metadata.recordingtime = filetime_to_time(get_filetime(store, PKEY_RecordedTV_RecordingTime));
+		metadata.duration = static_cast<int>(get_ui8(store, PKEY_Media_Duration) / 10000000ULL);
+		metadata.ishd = get_bool(store, PKEY_RecordedTV_IsHDContent);
+
+		store->Release();							// Release IPropertyStore
+	}
+
+	catch(...) { store->Release(); throw; }
+}
+
+//---------------------------------------------------------------------------
+// propertystoreprovider::name
+//
+// Gets the name of the provider
+//
+// Arguments:
+//
+//	NONE
+
+char const* propertystoreprovider::name(void) const
+{
+	return "propertystore";
+}
+
+//---------------------------------------------------------------------------
+// propertystoreprovider::priority
+//
+// Gets the static priority of the provider; lower values are tried first
+//
+// Arguments:
+//
+//	NONE
+
+int propertystoreprovider::priority(void) const
+{
+	return 1;		// Fallback to the Windows property store; tried after the native readers
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -22,8 +22,11 @@
 
 #include "stdafx.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -35,9 +38,14 @@
 #include <libXBMC_addon.h>
 #include <libXBMC_pvr.h>
 
+#include "arena.h"
 #include "database.h"
+#include "jobgraph.h"
+#include "metadatapipeline.h"
+#include "pathindex.h"
 #include "scheduler.h"
 #include "scalar_condition.h"
+#include "snapshot.h"
 #include "string_exception.h"
 
 #pragma warning(push, 4)				// Enable maximum compiler warnings
@@ -53,6 +61,11 @@ template<typename _result> static _result handle_generalexception(char const* fu
 static void handle_stdexception(char const* function, std::exception const& ex);
 template<typename _result> static _result handle_stdexception(char const* function, std::exception const& ex, _result result);
 
+// Background jobs
+//
+static void fingerprint_job(int64_t recordingkey, char const* path, scalar_condition<bool> const& cancel);
+static void metadata_job(int64_t recordingkey, char const* path, scalar_condition<bool> const& cancel);
+
 // Log helpers
 //
 template<typename... _args> static void log_debug(_args&&... args);
@@ -63,7 +76,138 @@ template<typename... _args> static void log_notice(_args&&... args);
 
 // Scheduled Tasks
 //
+static void compact_database_task(const scalar_condition<bool>& cancel);
+static void delete_duplicates_task(const scalar_condition<bool>& cancel);
 static void discover_recordings_task(const scalar_condition<bool>& cancel);
+static void find_duplicates_task(const scalar_condition<bool>& cancel);
+static void open_database_task(const scalar_condition<bool>& cancel);
+static void persist_database_task(const scalar_condition<bool>& cancel);
+static void purge_recordings_task(const scalar_condition<bool>& cancel);
+static void run_jobs_task(const scalar_condition<bool>& cancel);
+static void trigger_recording_update_task(const scalar_condition<bool>& cancel);
+static void validate_recordings_task(const scalar_condition<bool>& cancel);
+static void write_snapshot_task(const scalar_condition<bool>& cancel);
+
+// Database helpers
+//
+static void persist_database(void);
+static void retry_open_database(void);
+static void schedule_jobs(void);
+static void schedule_snapshot(void);
+static void trigger_recording_update(void);
+static uint64_t write_duplicates_report(sqlite3* instance);
+static void write_snapshot(void);
+
+//---------------------------------------------------------------------------
+// CONSTANTS
+//---------------------------------------------------------------------------
+
+// COMPACT_DATABASE_INTERVAL
+//
+// Interval at which the database is compacted once all free pages have been released
+static std::chrono::minutes const COMPACT_DATABASE_INTERVAL(60);
+
+// COMPACT_DATABASE_SLICE_PAGES
+//
+// Maximum number of free database pages to release in a single pass
+static int const COMPACT_DATABASE_SLICE_PAGES = 256;
+
+// COMPACT_DATABASE_THROTTLE
+//
+// Delay between compaction passes while there are still free pages to be released
+static std::chrono::seconds const COMPACT_DATABASE_THROTTLE(30);
+
+// JOB_BATCH_SIZE
+//
+// Maximum number of recordings processed by the background jobs in a single pass
+static int const JOB_BATCH_SIZE = 64;
+
+// JOB_BATCH_DEADLINE
+//
+// Time after which a batch of background jobs stops starting new jobs; the scheduler thread is held until it ends
+static std::chrono::seconds const JOB_BATCH_DEADLINE(30);
+
+// JOB_START_DELAY
+//
+// Delay before the background jobs run after the recordings have changed; longer than RECORDING_UPDATE_MAX_DELAY
+// so that the coalesced refresh of the recordings in Kodi isn't held up behind a batch of jobs
+static std::chrono::seconds const JOB_START_DELAY(15);
+
+// JOB_WORKERS
+//
+// Number of worker threads shared by the background jobs
+static size_t const JOB_WORKERS = 2;
+
+// MENUHOOK_RECORDING_DELETEDUPLICATES
+//
+// Menu hook identifier to move the redundant copies of duplicate recordings into the trash
+static unsigned int const MENUHOOK_RECORDING_DELETEDUPLICATES = 2;
+
+// MENUHOOK_RECORDING_FINDDUPLICATES
+//
+// Menu hook identifier to generate the duplicate recordings report
+static unsigned int const MENUHOOK_RECORDING_FINDDUPLICATES = 1;
+
+// OPEN_DATABASE_RETRY_DELAY / OPEN_DATABASE_MAX_RETRY_DELAY
+//
+// Initial delay before retrying a failed database open, and the limit the delay is doubled up to
+static std::chrono::seconds const OPEN_DATABASE_RETRY_DELAY(5);
+static std::chrono::seconds const OPEN_DATABASE_MAX_RETRY_DELAY(300);
+
+// PERSIST_DATABASE_INTERVAL
+//
+// Interval at which an in-memory database is persisted to storage
+static std::chrono::minutes const PERSIST_DATABASE_INTERVAL(15);
+
+// PURGE_RECORDINGS_BATCH_SIZE
+//
+// Maximum number of deleted recording files to purge in a single pass
+static int const PURGE_RECORDINGS_BATCH_SIZE = 10;
+
+// PURGE_RECORDINGS_INTERVAL
+//
+// Interval at which deleted recording files are purged when the queue has been drained
+static std::chrono::minutes const PURGE_RECORDINGS_INTERVAL(10);
+
+// PURGE_RECORDINGS_THROTTLE
+//
+// Delay between purge passes while there are still files waiting to be purged
+static std::chrono::seconds const PURGE_RECORDINGS_THROTTLE(30);
+
+// RECONCILE_INTERVAL
+//
+// Interval between full reconciles of the recordings folder when recordings are validated on access
+static std::chrono::hours const RECONCILE_INTERVAL(24 * 7);
+
+// RECORDING_UPDATE_COALESCE
+//
+// Quiet period after a change before Kodi is told to refresh the recordings; further changes restart it
+static std::chrono::seconds const RECORDING_UPDATE_COALESCE(2);
+
+// RECORDING_UPDATE_MAX_DELAY
+//
+// Maximum time a change can wait for Kodi to refresh the recordings while changes keep arriving
+static std::chrono::seconds const RECORDING_UPDATE_MAX_DELAY(10);
+
+// RECORDING_UPDATE_MIN_INTERVAL
+//
+// Minimum time between two refreshes of the recordings; Kodi reloads every recording each time
+static std::chrono::seconds const RECORDING_UPDATE_MIN_INTERVAL(5);
+
+// RECORDING_TRASH_RETENTION
+//
+// Length of time a deleted recording is kept in the trash before being purged
+static std::chrono::hours const RECORDING_TRASH_RETENTION(24 * 7);
+
+// VALIDATE_RECORDING_DEADLINE
+//
+// Time allowed to reload the metadata of a changed recording that was queued for validation
+static std::chrono::milliseconds const VALIDATE_RECORDING_DEADLINE(10000);
+
+// WRITE_SNAPSHOT_DELAY
+//
+// Delay before writing the recordings snapshot after a change
+static std::chrono::seconds const WRITE_SNAPSHOT_DELAY(5);
 
 //---------------------------------------------------------------------------
 // TYPE DECLARATIONS
@@ -77,6 +221,22 @@ struct addon_settings {
 	// Path to the Media Center RecordedTV folder
 	//
 	std::string recordedtv_folder;
+
+	// Flag to keep the database in memory and persist it periodically
+	//
+	bool inmemory_database;
+
+	// Folder hierarchy presented to Kodi for the recordings
+	//
+	enum directory_layout directory_layout;
+
+	// Flag to stage discovered recordings on disk and keep memory bounded
+	//
+	bool bounded_discovery;
+
+	// Flag to validate recordings when they are played instead of on every discovery
+	//
+	bool validate_on_access;
 };
 
 //---------------------------------------------------------------------------
@@ -98,7 +258,7 @@ static const PVR_ADDON_CAPABILITIES g_capabilities = {
 	false,			// bSupportsTV
 	false,			// bSupportsRadio
 	true,			// bSupportsRecordings
-	false,			// bSupportsRecordingsUndelete
+	true,			// bSupportsRecordingsUndelete
 	false,			// bSupportsTimers
 	false,			// bSupportsChannelGroups
 	false,			// bSupportsChannelScan
@@ -108,7 +268,7 @@ static const PVR_ADDON_CAPABILITIES g_capabilities = {
 	false,			// bSupportsRecordingPlayCount
 	false,			// bSupportsLastPlayedPosition
 	false,			// bSupportsRecordingEdl
-	false,			// bSupportsRecordingsRename
+	true,			// bSupportsRecordingsRename
 	false,			// bSupportsRecordingsLifetimeChange
 	false,			// bSupportsDescrambleInfo
 	0,				// iRecordingsLifetimesSize
@@ -121,11 +281,71 @@ static const PVR_ADDON_CAPABILITIES g_capabilities = {
 // Global SQLite database connection pool instance
 static std::shared_ptr<connectionpool> g_connpool;
 
+// g_database_ready
+//
+// Flag indicating the database has been opened by the background task
+static std::atomic<bool> g_database_ready{ false };
+
+// g_database_retry_delay
+//
+// Delay before the next attempt to open the database if the current one fails; only accessed by the scheduler
+static std::chrono::seconds g_database_retry_delay(OPEN_DATABASE_RETRY_DELAY);
+
+// g_databasefile
+//
+// Connection string for the on-disk database file
+static std::string g_databasefile;
+
+// g_duplicatesreport
+//
+// Path to the duplicate recordings report file
+static std::string g_duplicatesreport;
+
+// g_inmemory_database
+//
+// Flag indicating the database connection pool is in-memory
+static bool g_inmemory_database = false;
+
+// g_jobs
+//
+// Background jobs run against each discovered recording
+static std::unique_ptr<jobgraph> g_jobs;
+
+// g_metadata
+//
+// Metadata provider pipeline used during discovery
+static std::unique_ptr<metadatapipeline> g_metadata;
+
+// g_pathindex
+//
+// Index of known recording paths, kept in sync with the database
+static pathindex g_pathindex;
+
+// g_persisted_commits
+//
+// Database commit count at the time of the last persistence operation
+static std::atomic<unsigned long long> g_persisted_commits{ 0 };
+
 // g_pvr
 //
 // Kodi PVR add-on callbacks
 static std::unique_ptr<CHelper_libXBMC_pvr> g_pvr;
 
+// g_recording_update_first
+//
+// Time of the first change not yet refreshed by Kodi, or the epoch if there are none
+static std::chrono::time_point<std::chrono::system_clock> g_recording_update_first;
+
+// g_recording_update_last
+//
+// Time Kodi was last told to refresh the recordings
+static std::chrono::time_point<std::chrono::system_clock> g_recording_update_last;
+
+// g_recording_update_lock
+//
+// Synchronization object to serialize access to the recording update state
+static std::mutex g_recording_update_lock;
+
 // g_scheduler
 //
 // Task scheduler
@@ -134,17 +354,107 @@ static scheduler g_scheduler([](std::exception const& ex) -> void { handle_stdex
 // g_settings
 //
 // Global addon settings instance
-static addon_settings g_settings;
+static addon_settings g_settings = {
+
+	"",				// recordedtv_folder
+	false,			// inmemory_database
+	directory_layout::season,	// directory_layout
+	false,			// bounded_discovery
+	false,			// validate_on_access
+};
 
 // g_settings_lock
 //
 // Synchronization object to serialize access to addon settings
 std::mutex g_settings_lock;
 
+// g_snapshot
+//
+// Recordings snapshot served to Kodi until the database has been opened
+static std::shared_ptr<snapshot const> g_snapshot;
+
+// g_snapshot_pending
+//
+// Flag indicating the catalog has changed since the recordings snapshot was last written
+static std::atomic<bool> g_snapshot_pending{ false };
+
+// g_snapshotfile
+//
+// Path to the recordings snapshot file
+static std::string g_snapshotfile;
+
+// g_validate_queue
+//
+// Recordings waiting to be validated after they were accessed
+static std::vector<std::string> g_validate_queue;
+
+// g_validate_queue_lock
+//
+// Synchronization object to serialize access to the validation queue
+static std::mutex g_validate_queue_lock;
+
 //---------------------------------------------------------------------------
 // HELPER FUNCTIONS
 //---------------------------------------------------------------------------
 
+// compact_database_task
+//
+// Scheduled task implementation to release free database pages a slice at a time
+static void compact_database_task(const scalar_condition<bool>& /*cancel*/)
+{
+	uint64_t		freepages = 0;			// Free pages remaining in the database
+	uint64_t		size = 0;				// Size of the database
+
+	try {
+
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		int released = compact_database(dbhandle, COMPACT_DATABASE_SLICE_PAGES);
+		get_database_size(dbhandle, size, freepages);
+
+		log_notice(__func__, ": released ", released, " free page(s) -- database size is ", size, " bytes with ", freepages, " free page(s)");
+	}
+
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+
+	// Reschedule the task; if there are still free pages continue releasing them shortly
+	g_scheduler.add(std::chrono::system_clock::now() + ((freepages > 0) ? std::chrono::duration_cast<std::chrono::seconds>(COMPACT_DATABASE_THROTTLE) : 
+		std::chrono::duration_cast<std::chrono::seconds>(COMPACT_DATABASE_INTERVAL)), compact_database_task);
+}
+
+// delete_duplicates_task
+//
+// Scheduled task implementation to move the redundant copies of duplicate recordings into the trash
+static void delete_duplicates_task(const scalar_condition<bool>& cancel)
+{
+	assert(g_addon && g_pvr);
+	log_notice(__func__, ": initiated duplicate recording cleanup");
+
+	try {
+
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		// Always refresh the duplicates first, the catalog may have changed since the last report
+		find_duplicate_recordings(dbhandle, cancel);
+		int deleted = delete_duplicate_recordings(dbhandle, g_pathindex, cancel);
+
+		if(deleted > 0) {
+
+			log_notice(__func__, ": moved ", deleted, " duplicate recording(s) to the trash -- trigger recording update");
+			trigger_recording_update();
+			schedule_snapshot();
+		}
+
+		g_addon->QueueNotification(ADDON::queue_msg_t::QUEUE_INFO, "Moved %d duplicate recording(s) to the trash", deleted);
+	}
+
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+}
+
 // discover_recordings_task
 //
 // Scheduled task implementation to discover the recordings
@@ -153,28 +463,60 @@ static void discover_recordings_task(const scalar_condition<bool>& cancel)
 	bool		changed = false;			// Flag if the discovery data changed
 
 	assert(g_addon && g_pvr);
+
+	// Discovery is always scheduled once the database has been opened, nothing to do until then
+	if(!g_database_ready) return;
+
 	log_notice(__func__, ": initiated windows media center recording discovery");
 
 	// Grab copies of the required setting(s) up front
 	std::unique_lock<std::mutex> settings_lock(g_settings_lock);
 	std::string recordedtv_folder = g_settings.recordedtv_folder;
+	enum directory_layout layout = g_settings.directory_layout;
+	bool bounded = g_settings.bounded_discovery;
+	bool validate = g_settings.validate_on_access;
 	settings_lock.unlock();
 
+	// Recordings validated on access only need the folder reconciled once in a while
+	int reconcile = (validate) ? static_cast<int>(std::chrono::duration_cast<std::chrono::seconds>(RECONCILE_INTERVAL).count()) : 0;
+
 	try {
 
 		// Pull a database connection out from the connection pool
 		connectionpool::handle dbhandle(g_connpool);
 
+		// Arena blocks only come from the heap until the arenas have grown to fit the recordings; once they
+		// have, a discovery that reallocates blocks indicates that the per-file memory is not being reused
+		uint64_t arenagrowth = arena::growth();
+
 		// Discover the recordings available in the recordedtv_folder
-		discover_recordings(dbhandle, g_addon, recordedtv_folder.c_str(), cancel, changed);
+		discover_recordings(dbhandle, g_addon, recordedtv_folder.c_str(), layout, bounded, reconcile, g_pathindex, *g_metadata, cancel, changed);
 		
 		if(changed) {
 
 			// Changes in the recording data affects just the PVR recordings
 			log_notice(__func__, ": recording discovery data changed -- trigger recording update");
-			g_pvr->TriggerRecordingUpdate();
+			trigger_recording_update();
+			schedule_snapshot();
+
+			// New and changed recordings flow through the background jobs once Kodi has been refreshed
+			schedule_jobs();
+
+			// Once there are enough recordings, train the dictionary used to compress the text fields
+			uint64_t before = 0, after = 0;
+			if(train_text_dictionary(dbhandle, before, after)) 
+				log_notice(__func__, ": text dictionary trained -- text fields reduced from ", before, " to ", after, " bytes per recording");
 		}
 
+		// Log the metadata provider counters so the cost of each provider can be followed
+		g_metadata->enumerate([&](metadataprovider const& provider) -> void {
+
+			if(provider.calls() > 0) log_info(__func__, ": metadata provider ", provider.name(), ": ", provider.calls(), " call(s), ", 
+				provider.failures(), " failure(s), ", provider.cost(), "us per recording");
+		});
+		log_info(__func__, ": metadata loads hedged: ", g_metadata->hedged(), ", timed out: ", g_metadata->timeouts());
+		log_info(__func__, ": arena blocks allocated from the heap during discovery: ", arena::growth() - arenagrowth);
+
 		log_notice(__func__, ": windows media center recording discovery task completed");
 	}
 
@@ -182,6 +524,39 @@ static void discover_recordings_task(const scalar_condition<bool>& cancel)
 	catch(...) { handle_generalexception(__func__); }
 }
 
+// find_duplicates_task
+//
+// Scheduled task implementation to find duplicate recordings and generate the report
+static void find_duplicates_task(const scalar_condition<bool>& cancel)
+{
+	assert(g_addon);
+	log_notice(__func__, ": initiated duplicate recording detection");
+
+	try {
+
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		int duplicates = find_duplicate_recordings(dbhandle, cancel);
+		uint64_t reclaimable = write_duplicates_report(dbhandle);
+
+		log_notice(__func__, ": found ", duplicates, " duplicate recording(s) using ", reclaimable, " bytes -- report written to ", g_duplicatesreport.c_str());
+		g_addon->QueueNotification(ADDON::queue_msg_t::QUEUE_INFO, "Found %d duplicate recording(s) using %llu MB", duplicates, 
+			static_cast<unsigned long long>(reclaimable >> 20));
+	}
+
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+}
+
+// fingerprint_job
+//
+// Background job implementation to generate the fingerprint used to find duplicate recordings
+static void fingerprint_job(int64_t recordingkey, char const* /*path*/, scalar_condition<bool> const& /*cancel*/)
+{
+	fingerprint_recording(connectionpool::handle(g_connpool), recordingkey);
+}
+
 // handle_generalexception
 //
 // Handler for thrown generic exceptions
@@ -274,6 +649,433 @@ static void log_notice(_args&&... args)
 	log_message(ADDON::addon_log_t::LOG_NOTICE, std::forward<_args>(args)...);
 }
 
+// metadata_job
+//
+// Background job implementation to verify that a recording can be identified by the jobs that depend on it
+static void metadata_job(int64_t recordingkey, char const* /*path*/, scalar_condition<bool> const& /*cancel*/)
+{
+	check_recording_metadata(connectionpool::handle(g_connpool), recordingkey);
+}
+
+// open_database_task
+//
+// Scheduled task implementation to open the database in the background
+static void open_database_task(const scalar_condition<bool>& /*cancel*/)
+{
+	std::shared_ptr<connectionpool>		connpool;		// New connection pool instance
+
+	assert(g_pvr);
+	log_notice(__func__, ": opening database ", g_databasefile.c_str());
+
+	// Grab copies of the required setting(s) up front
+	std::unique_lock<std::mutex> settings_lock(g_settings_lock);
+	enum directory_layout layout = g_settings.directory_layout;
+	settings_lock.unlock();
+
+	std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+	try {
+
+		if(g_inmemory_database) {
+
+			try {
+
+				// The in-memory database is shared by every connection in the pool via the memdb VFS and
+				// is restored from the database file, which is only written to when it's persisted
+				std::string memoryfile = "file:/mcerecordings-v" + std::string(VERSION_VERSION2_ANSI) + ".db?vfs=memdb";
+				connpool = std::make_shared<connectionpool>(memoryfile.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI);
+				restore_database(connectionpool::handle(connpool), g_databasefile.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI);
+				g_persisted_commits = get_commit_count();
+
+				log_notice(__func__, ": in-memory database restored from ", g_databasefile.c_str());
+			}
+
+			// If the in-memory database can't be created or restored, fall back to using the database file
+			catch(std::exception& ex) { 
+						
+				handle_stdexception(__func__, ex);
+				log_notice(__func__, ": unable to use an in-memory database -- using database file instead");
+
+				connpool.reset();
+				g_inmemory_database = false;
+			}
+		}
+
+		if(!connpool) connpool = std::make_shared<connectionpool>(g_databasefile.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI);
+
+		connectionpool::handle dbhandle(connpool);
+
+		// Load the index of known recording paths from the existing database
+		load_pathindex(dbhandle, g_pathindex);
+
+		// The directory layout may have been changed while the addon wasn't running; the catalog can still be
+		// served if this fails, the directories are regenerated the next time the layout is changed
+		try { update_recording_directories(dbhandle, layout); }
+		catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+		catch(...) { handle_generalexception(__func__); }
+
+		// Columns added since the raw metadata was cached are decoded from it rather than rediscovered; this is
+		// attempted again the next time the database is opened if it fails
+		try {
+
+			int backfilled = backfill_recording_metadata(dbhandle, *g_metadata);
+			if(backfilled > 0) log_notice(__func__, ": ", backfilled, " recording(s) updated from the cached raw metadata");
+		}
+
+		catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+		catch(...) { handle_generalexception(__func__); }
+	}
+
+	// If the database couldn't be opened, the snapshot is served until it can be; try again with an increasing delay
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); retry_open_database(); return; }
+	catch(...) { handle_generalexception(__func__); retry_open_database(); return; }
+
+	g_database_retry_delay = OPEN_DATABASE_RETRY_DELAY;
+
+	// The connection pool has to be in place before the ready flag is set; the entry points check 
+	// the flag before they touch the pool.  The snapshot is released so that it can be rewritten
+	g_connpool = connpool;
+	g_database_ready = true;
+	std::shared_ptr<snapshot const> previous = std::atomic_exchange(&g_snapshot, std::shared_ptr<snapshot const>());
+
+	log_notice(__func__, ": database opened in ", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(), 
+		"ms -- trigger recording update");
+
+	// Anything Kodi loaded from the snapshot has to be reloaded from the database
+	trigger_recording_update();
+
+	// Schedule the initial discovery run to execute as soon as possible
+	std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+	g_scheduler.add(now + std::chrono::seconds(1), discover_recordings_task);
+
+	// Schedule the in-memory database to be persisted periodically
+	if(g_inmemory_database) g_scheduler.add(now + PERSIST_DATABASE_INTERVAL, persist_database_task);
+
+	// Schedule the deleted recordings to be purged from the trash periodically
+	g_scheduler.add(now + PURGE_RECORDINGS_INTERVAL, purge_recordings_task);
+
+	// Schedule any background jobs left unfinished by a previous session
+	g_scheduler.add(now + JOB_START_DELAY, run_jobs_task);
+
+	// Schedule the database to be compacted periodically
+	g_scheduler.add(now + COMPACT_DATABASE_INTERVAL, compact_database_task);
+
+	// If there was no usable snapshot, write one now rather than waiting for the catalog to change
+	if(!previous) schedule_snapshot();
+}
+
+// persist_database
+//
+// Persists an in-memory database to storage if it has changed
+static void persist_database(void)
+{
+	if((!g_inmemory_database) || (!g_connpool)) return;
+
+	// Only persist the database if there have been changes since the last time
+	unsigned long long commits = get_commit_count();
+	if(commits == g_persisted_commits) return;
+
+	backup_database(connectionpool::handle(g_connpool), g_databasefile.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI);
+	g_persisted_commits = commits;
+
+	log_notice(__func__, ": in-memory database persisted to ", g_databasefile.c_str());
+}
+
+// persist_database_task
+//
+// Scheduled task implementation to persist an in-memory database
+static void persist_database_task(const scalar_condition<bool>& /*cancel*/)
+{
+	try { persist_database(); }
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+
+	// Reschedule the task to run again after the persistence interval
+	g_scheduler.add(std::chrono::system_clock::now() + PERSIST_DATABASE_INTERVAL, persist_database_task);
+}
+
+// purge_recordings_task
+//
+// Scheduled task implementation to purge deleted recordings from the trash
+static void purge_recordings_task(const scalar_condition<bool>& cancel)
+{
+	int			purged = 0;				// Number of files purged
+
+	assert(g_addon && g_pvr);
+
+	try {
+
+		// Purge a limited batch of files so that the scheduler isn't monopolized by a large trash
+		purged = purge_recordings(connectionpool::handle(g_connpool), g_addon, static_cast<int>(std::chrono::duration_cast<std::chrono::seconds>(
+			RECORDING_TRASH_RETENTION).count()), PURGE_RECORDINGS_BATCH_SIZE, cancel);
+
+		if(purged > 0) {
+
+			// Purging expired recordings affects the list of deleted PVR recordings
+			log_notice(__func__, ": purged ", purged, " deleted recording(s) -- trigger recording update");
+			trigger_recording_update();
+		}
+	}
+
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+
+	// Reschedule the task; if a full batch was purged there are likely more files waiting
+	g_scheduler.add(std::chrono::system_clock::now() + ((purged >= PURGE_RECORDINGS_BATCH_SIZE) ? 
+		std::chrono::duration_cast<std::chrono::seconds>(PURGE_RECORDINGS_THROTTLE) : std::chrono::duration_cast<std::chrono::seconds>(PURGE_RECORDINGS_INTERVAL)), 
+		purge_recordings_task);
+}
+
+// retry_open_database
+//
+// Schedules another attempt to open the database after a failure; the delay doubles with each attempt
+static void retry_open_database(void)
+{
+	std::chrono::seconds delay = g_database_retry_delay;
+	g_database_retry_delay = std::min(delay * 2, std::chrono::seconds(OPEN_DATABASE_MAX_RETRY_DELAY));
+
+	log_notice(__func__, ": unable to open the database -- retrying in ", delay.count(), " seconds");
+	g_scheduler.add(std::chrono::system_clock::now() + delay, open_database_task);
+}
+
+// run_jobs_task
+//
+// Scheduled task implementation to run the background jobs of the discovered recordings
+static void run_jobs_task(const scalar_condition<bool>& cancel)
+{
+	int			recordings = 0;			// Number of recordings in the batch
+	bool		expired = false;		// Flag indicating the batch deadline expired
+
+	assert(g_jobs);
+
+	// The jobs are always scheduled once the database has been opened, nothing to do until then
+	if(!g_database_ready) return;
+
+	try {
+
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		uint64_t completed = g_jobs->completed(), failed = g_jobs->failed();
+		std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+		recordings = g_jobs->run(dbhandle, JOB_BATCH_SIZE, JOB_BATCH_DEADLINE, cancel);
+		expired = ((std::chrono::steady_clock::now() - start) >= JOB_BATCH_DEADLINE);
+
+		if(recordings > 0) log_notice(__func__, ": background jobs processed ", recordings, " recording(s): ", g_jobs->completed() - completed,
+			" job(s) completed, ", g_jobs->failed() - failed, " job(s) failed");
+	}
+
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+
+	// A full or expired batch means there may be more recordings waiting; give the other tasks a turn and continue
+	if(((recordings >= JOB_BATCH_SIZE) || (expired)) && (!cancel.test(true))) g_scheduler.add(std::chrono::system_clock::now() + std::chrono::seconds(1), run_jobs_task);
+}
+
+// schedule_jobs
+//
+// Schedules the background jobs to run against new and changed recordings
+static void schedule_jobs(void)
+{
+	// Give Kodi a chance to refresh the recordings before the jobs start competing for the database
+	g_scheduler.remove(run_jobs_task);
+	g_scheduler.add(std::chrono::system_clock::now() + JOB_START_DELAY, run_jobs_task);
+}
+
+// schedule_snapshot
+//
+// Schedules the recordings snapshot to be rewritten after a change
+static void schedule_snapshot(void)
+{
+	// Changes tend to arrive in bursts, only write the snapshot once they settle down
+	g_snapshot_pending = true;
+	g_scheduler.remove(write_snapshot_task);
+	g_scheduler.add(std::chrono::system_clock::now() + WRITE_SNAPSHOT_DELAY, write_snapshot_task);
+}
+
+// trigger_recording_update
+//
+// Schedules Kodi to refresh the recordings; changes arriving close together are coalesced into a single refresh
+static void trigger_recording_update(void)
+{
+	std::unique_lock<std::mutex> lock(g_recording_update_lock);
+
+	std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+	if(g_recording_update_first == std::chrono::time_point<std::chrono::system_clock>()) g_recording_update_first = now;
+
+	// Wait for the burst of changes to settle, but not longer than the maximum delay since the first one and
+	// never sooner than the minimum interval since the last refresh
+	std::chrono::time_point<std::chrono::system_clock> due = std::min(now + RECORDING_UPDATE_COALESCE, g_recording_update_first + RECORDING_UPDATE_MAX_DELAY);
+	due = std::max(due, g_recording_update_last + RECORDING_UPDATE_MIN_INTERVAL);
+
+	g_scheduler.remove(trigger_recording_update_task);
+	g_scheduler.add(due, trigger_recording_update_task);
+}
+
+// trigger_recording_update_task
+//
+// Scheduled task implementation to have Kodi refresh the recordings
+static void trigger_recording_update_task(const scalar_condition<bool>& /*cancel*/)
+{
+	assert(g_pvr);
+
+	std::unique_lock<std::mutex> lock(g_recording_update_lock);
+
+	// The changes are picked up as soon as Kodi starts to reload the recordings; anything after this needs another refresh
+	if(g_recording_update_first == std::chrono::time_point<std::chrono::system_clock>()) return;
+	g_recording_update_first = std::chrono::time_point<std::chrono::system_clock>();
+	g_recording_update_last = std::chrono::system_clock::now();
+	lock.unlock();
+
+	g_pvr->TriggerRecordingUpdate();
+}
+
+// validate_recordings_task
+//
+// Scheduled task implementation to validate the recordings that have been accessed
+static void validate_recordings_task(const scalar_condition<bool>& cancel)
+{
+	std::vector<std::string>	recordings;			// Recordings to be validated
+	bool						changed = false;	// Flag if the catalog changed
+
+	// Recordings are only queued once the database has been opened
+	if(!g_database_ready) return;
+
+	// Grab the queued recordings and a copy of the required setting(s) up front
+	std::unique_lock<std::mutex> queue_lock(g_validate_queue_lock);
+	recordings.swap(g_validate_queue);
+	queue_lock.unlock();
+
+	std::unique_lock<std::mutex> settings_lock(g_settings_lock);
+	enum directory_layout layout = g_settings.directory_layout;
+	settings_lock.unlock();
+
+	if(recordings.empty()) return;
+
+	try {
+
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		for(auto const& recordingid : recordings) {
+
+			if(cancel.test(true)) break;
+
+			// The check is best effort, a recording that can't be validated is picked up by the next full reconcile
+			try {
+
+				enum recording_validation validation = validate_recording(dbhandle, g_addon, recordingid.c_str(), layout, g_pathindex, *g_metadata, VALIDATE_RECORDING_DEADLINE);
+				if(validation != recording_validation::unchanged) {
+
+					log_notice(__func__, ": recording ", recordingid.c_str(), (validation == recording_validation::removed) ? " was removed" : " was updated");
+					changed = true;
+				}
+			}
+
+			catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+			catch(...) { handle_generalexception(__func__); }
+		}
+	}
+
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+
+	if(changed) {
+
+		log_notice(__func__, ": validated recording data changed -- trigger recording update");
+		trigger_recording_update();
+		schedule_snapshot();
+		schedule_jobs();
+	}
+}
+
+// write_duplicates_report
+//
+// Writes the duplicate recordings report file and returns the number of bytes that could be reclaimed
+static uint64_t write_duplicates_report(sqlite3* instance)
+{
+	std::ostringstream			report;					// Report text
+	uint64_t					fingerprint = 0;		// Fingerprint of the current group
+	uint64_t					reclaimable = 0;		// Bytes used by the redundant copies
+
+	assert(g_addon);
+
+	report << "Duplicate recordings; the copy marked with * is the one that would be kept" << std::endl;
+
+	enumerate_duplicate_recordings(instance, [&](struct duplicate_recording const& item) -> void {
+
+		// Separate each group of duplicates with the title and episode
+		if(item.fingerprint != fingerprint) {
+
+			report << std::endl << item.title;
+			if((item.episodename) && (*item.episodename)) report << " - " << item.episodename;
+			report << std::endl;
+			fingerprint = item.fingerprint;
+		}
+
+		time_t recordingtime = static_cast<time_t>(item.recordingtime);
+		struct tm tm = {};
+		localtime_s(&tm, &recordingtime);
+
+		char timestr[32] = { '\0' };
+		strftime(timestr, std::extent<decltype(timestr)>::value, "%Y-%m-%d %H:%M", &tm);
+
+		report << ((item.keep) ? " * " : "   ") << timestr << "  " << ((item.channelname) ? item.channelname : "") << "  " << (item.duration / 60) 
+			<< " min  " << (item.filesize >> 20) << " MB" << ((item.ishd) ? "  HD" : "") << "  " << item.recordingid << std::endl;
+
+		if(!item.keep) reclaimable += item.filesize;
+	});
+
+	std::string text = report.str();
+
+	void* handle = g_addon->OpenFileForWrite(g_duplicatesreport.c_str(), true);
+	if(handle == nullptr) throw string_exception(__func__, ": unable to open report file ", g_duplicatesreport.c_str());
+
+	ssize_t written = g_addon->WriteFile(handle, text.data(), text.size());
+	g_addon->CloseFile(handle);
+
+	if(written != static_cast<ssize_t>(text.size())) throw string_exception(__func__, ": unable to write report file ", g_duplicatesreport.c_str());
+
+	return reclaimable;
+}
+
+// write_snapshot
+//
+// Writes the recordings snapshot from the database
+static void write_snapshot(void)
+{
+	if(!g_database_ready) return;
+
+	// Clear the flag first; a change made while the snapshot is being written schedules another one
+	g_snapshot_pending = false;
+
+	try {
+
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		// The snapshot only contains the active recordings, the trash is never shown at startup
+		snapshot::write(g_snapshotfile.c_str(), [&](enumerate_recordings_callback const& callback) -> void { 
+			
+			enumerate_recordings(dbhandle, false, callback); 
+		});
+
+		log_notice(__func__, ": recordings snapshot written to ", g_snapshotfile.c_str());
+	}
+
+	catch(...) { g_snapshot_pending = true; throw; }
+}
+
+// write_snapshot_task
+//
+// Scheduled task implementation to write the recordings snapshot
+static void write_snapshot_task(const scalar_condition<bool>& /*cancel*/)
+{
+	try { write_snapshot(); }
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+}
+
 //---------------------------------------------------------------------------
 // KODI ADDON ENTRY POINTS
 //---------------------------------------------------------------------------
@@ -291,6 +1093,8 @@ static void log_notice(_args&&... args)
 ADDON_STATUS ADDON_Create(void* handle, void* props)
 {
 	char			strvalue[1024] = { '\0' };				// Setting value 
+	bool			bvalue = false;							// Setting value
+	int				nvalue = 0;								// Setting value
 
 	if((handle == nullptr) || (props == nullptr)) return ADDON_STATUS::ADDON_STATUS_PERMANENT_FAILURE;
 
@@ -318,32 +1122,50 @@ ADDON_STATUS ADDON_Create(void* handle, void* props)
 
 			// Load the general settings
 			if(g_addon->GetSetting("recordedtv_folder", strvalue)) g_settings.recordedtv_folder = strvalue;
+			if(g_addon->GetSetting("inmemory_database", &bvalue)) g_settings.inmemory_database = bvalue;
+			if(g_addon->GetSetting("directory_layout", &nvalue)) g_settings.directory_layout = static_cast<enum directory_layout>(nvalue);
+			if(g_addon->GetSetting("bounded_discovery", &bvalue)) g_settings.bounded_discovery = bvalue;
+			if(g_addon->GetSetting("validate_on_access", &bvalue)) g_settings.validate_on_access = bvalue;
 
 			// Create the global pvrcallbacks instance
 			g_pvr.reset(new CHelper_libXBMC_pvr());
 			if(!g_pvr->RegisterMe(handle)) throw string_exception("Failed to register pvr addon handle (CHelper_libXBMC_pvr::RegisterMe)");
+
+			// Register the recording menu hooks
+			PVR_MENUHOOK menuhook = { MENUHOOK_RECORDING_FINDDUPLICATES, 30200, PVR_MENUHOOK_RECORDING };
+			g_pvr->AddMenuHook(&menuhook);
+
+			menuhook = { MENUHOOK_RECORDING_DELETEDUPLICATES, 30201, PVR_MENUHOOK_RECORDING };
+			g_pvr->AddMenuHook(&menuhook);
 		
 			try {
 
-				// Create the global database connection pool instance, the file name is based on the versionb
-				std::string databasefile = "file:///" + std::string(pvrprops->strUserPath) + "/mcerecordings-v" + VERSION_VERSION2_ANSI + ".db";
-				g_connpool = std::make_shared<connectionpool>(databasefile.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI);
+				// Generate the paths to the files kept in the user data directory, the database file name is based on the version
+				g_databasefile = "file:///" + std::string(pvrprops->strUserPath) + "/mcerecordings-v" + VERSION_VERSION2_ANSI + ".db";
+				g_duplicatesreport = std::string(pvrprops->strUserPath) + "/duplicates.txt";
+				g_snapshotfile = std::string(pvrprops->strUserPath) + "/recordings.snapshot";
+				g_inmemory_database = g_settings.inmemory_database;
 
-				try {
+				// Create the metadata provider pipeline used by discovery
+				g_metadata.reset(new metadatapipeline());
 
-					// Schedule the initial discovery run to execute as soon as possible
-					std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-					g_scheduler.add(now + std::chrono::seconds(1), discover_recordings_task);
+				// Create the background jobs run against each discovered recording; each job names the jobs it depends on
+				g_jobs.reset(new jobgraph(JOB_WORKERS));
+				g_jobs->add("metadata", {}, metadata_job);
+				g_jobs->add("fingerprint", { "metadata" }, fingerprint_job);
 
-					g_scheduler.start();				// <--- Start the task scheduler
-				}
+				// Map the recordings snapshot so Kodi can be given the recordings without waiting for the database
+				try { std::atomic_store(&g_snapshot, std::shared_ptr<snapshot const>(new snapshot(g_snapshotfile.c_str()))); }
+				catch(std::exception& ex) { log_notice(__func__, ": recordings snapshot is not available: ", ex.what()); }
 
-				// Clean up the database connection pool on exception
-				catch(...) { g_connpool.reset(); throw; }
+				// Opening the database, and restoring an in-memory database in particular, can take some
+				// time with a large catalog; do that on the scheduler rather than blocking Kodi startup
+				g_scheduler.add(std::chrono::system_clock::now(), open_database_task);
+				g_scheduler.start();				// <--- Start the task scheduler
 			}
 			
-			// Clean up the pvrcallbacks instance on exception
-			catch(...) { g_pvr.reset(nullptr); throw; }
+			// Clean up the snapshot, metadata pipeline and pvrcallbacks instance on exception
+			catch(...) { std::atomic_store(&g_snapshot, std::shared_ptr<snapshot const>()); g_jobs.reset(); g_metadata.reset(); g_pvr.reset(nullptr); throw; }
 		}
 
 		// Clean up the addoncallbacks on exception; but log the error first -- once the callbacks
@@ -378,7 +1200,15 @@ void ADDON_Destroy(void)
 	// Stop the task scheduler
 	g_scheduler.stop();
 
+	// Persist an in-memory database before it gets destroyed
+	try { persist_database(); }
+	catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+	catch(...) { handle_generalexception(__func__); }
+
 	// Destroy all the dynamically created objects
+	std::atomic_store(&g_snapshot, std::shared_ptr<snapshot const>());
+	g_jobs.reset();
+	g_metadata.reset();
 	g_connpool.reset();
 	g_pvr.reset(nullptr);
 	
@@ -422,8 +1252,32 @@ ADDON_STATUS ADDON_SetSetting(char const* name, void const* value)
 
 		if(strcmp(g_settings.recordedtv_folder.c_str(), reinterpret_cast<char const*>(value)) != 0) {
 
+			std::string previous = g_settings.recordedtv_folder;
 			g_settings.recordedtv_folder = reinterpret_cast<char const*>(value);
-			log_notice(__func__, ": setting recordedtv_folder changed to ", g_settings.recordedtv_folder.c_str());
+			std::string current = g_settings.recordedtv_folder;
+			log_notice(__func__, ": setting recordedtv_folder changed to ", current.c_str());
+
+			// Moving the root and reloading the path index can take a while, don't hold up the entry points that read the settings meanwhile
+			settings_lock.unlock();
+
+			// The recordings are stored relative to their root folder; point that root at the new location so that
+			// the discovery only has to load files that differ rather than every file in the folder again
+			try {
+
+				if(g_database_ready) {
+
+					connectionpool::handle dbhandle(g_connpool);
+					if(move_recording_root(dbhandle, previous.c_str(), current.c_str())) {
+
+						// The index of known recording paths holds the full paths, reload it to match the new root
+						load_pathindex(dbhandle, g_pathindex);
+						log_notice(__func__, ": recordings moved from root folder ", previous.c_str(), " to ", current.c_str());
+					}
+				}
+			}
+
+			catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+			catch(...) { handle_generalexception(__func__); }
 
 			// Reschedule the discovery task to run as soon as possible
 			g_scheduler.remove(discover_recordings_task);
@@ -432,6 +1286,75 @@ ADDON_STATUS ADDON_SetSetting(char const* name, void const* value)
 		}
 	}
 
+	// inmemory_database
+	//
+	else if(strcmp(name, "inmemory_database") == 0) {
+
+		bool bvalue = *reinterpret_cast<bool const*>(value);
+		if(bvalue != g_settings.inmemory_database) {
+
+			g_settings.inmemory_database = bvalue;
+			log_notice(__func__, ": setting inmemory_database changed to ", (bvalue) ? "true" : "false", " -- addon restart required");
+			return ADDON_STATUS_NEED_RESTART;
+		}
+	}
+
+	// directory_layout
+	//
+	else if(strcmp(name, "directory_layout") == 0) {
+
+		enum directory_layout layout = static_cast<enum directory_layout>(*reinterpret_cast<int const*>(value));
+		if(layout != g_settings.directory_layout) {
+
+			g_settings.directory_layout = layout;
+			log_notice(__func__, ": setting directory_layout changed to ", static_cast<int>(layout));
+
+			// Updating the catalog can take a while, don't hold up the entry points that read the settings meanwhile
+			settings_lock.unlock();
+
+			// The directories are regenerated from the existing catalog; the recordings don't need to be discovered again
+			try { 
+				
+				// If the database hasn't been opened yet the directories will be updated when it is
+				if((g_database_ready) && (update_recording_directories(connectionpool::handle(g_connpool), layout) > 0)) {
+
+					log_notice(__func__, ": recording directories changed -- trigger recording update");
+					trigger_recording_update();
+					schedule_snapshot();
+				}
+			}
+
+			catch(std::exception& ex) { handle_stdexception(__func__, ex); }
+			catch(...) { handle_generalexception(__func__); }
+		}
+	}
+
+	// bounded_discovery
+	//
+	else if(strcmp(name, "bounded_discovery") == 0) {
+
+		bool bvalue = *reinterpret_cast<bool const*>(value);
+		if(bvalue != g_settings.bounded_discovery) {
+
+			// The setting is picked up by the next discovery, nothing needs to be restarted
+			g_settings.bounded_discovery = bvalue;
+			log_notice(__func__, ": setting bounded_discovery changed to ", (bvalue) ? "true" : "false");
+		}
+	}
+
+	// validate_on_access
+	//
+	else if(strcmp(name, "validate_on_access") == 0) {
+
+		bool bvalue = *reinterpret_cast<bool const*>(value);
+		if(bvalue != g_settings.validate_on_access) {
+
+			// The setting is picked up by the next discovery, nothing needs to be restarted
+			g_settings.validate_on_access = bvalue;
+			log_notice(__func__, ": setting validate_on_access changed to ", (bvalue) ? "true" : "false");
+		}
+	}
+
 	return ADDON_STATUS_OK;
 }
 
@@ -523,9 +1446,34 @@ PVR_ERROR GetDriveSpace(long long* /*total*/, long long* /*used*/)
 //	menuhook	- The hook to call
 //	item		- The selected item for which the hook is called
 
-PVR_ERROR CallMenuHook(PVR_MENUHOOK const& /*menuhook*/, PVR_MENUHOOK_DATA const& /*item*/)
+PVR_ERROR CallMenuHook(PVR_MENUHOOK const& menuhook, PVR_MENUHOOK_DATA const& /*item*/)
 {
-	return PVR_ERROR::PVR_ERROR_NOT_IMPLEMENTED;
+	std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+
+	if(!g_database_ready) return PVR_ERROR::PVR_ERROR_SERVER_TIMEOUT;
+
+	try {
+
+		// The duplicate recording tasks are scheduled rather than run here so they don't block Kodi
+		if(menuhook.iHookId == MENUHOOK_RECORDING_FINDDUPLICATES) {
+
+			g_scheduler.remove(find_duplicates_task);
+			g_scheduler.add(now, find_duplicates_task);
+		}
+
+		else if(menuhook.iHookId == MENUHOOK_RECORDING_DELETEDUPLICATES) {
+
+			g_scheduler.remove(delete_duplicates_task);
+			g_scheduler.add(now, delete_duplicates_task);
+		}
+
+		else return PVR_ERROR::PVR_ERROR_INVALID_PARAMETERS;
+	}
+
+	catch(std::exception& ex) { return handle_stdexception(__func__, ex, PVR_ERROR::PVR_ERROR_FAILED); }
+	catch(...) { return handle_generalexception(__func__, PVR_ERROR::PVR_ERROR_FAILED); }
+
+	return PVR_ERROR::PVR_ERROR_NO_ERROR;
 }
 
 //---------------------------------------------------------------------------
@@ -761,9 +1709,18 @@ PVR_ERROR OpenDialogChannelAdd(PVR_CHANNEL const& /*channel*/)
 
 int GetRecordingsAmount(bool deleted)
 {
-	if(deleted) return 0;			// Deleted recordings aren't supported
+	try { 
+		
+		// Until the database has been opened the recordings come from the snapshot, which has no deleted recordings
+		if(!g_database_ready) {
+
+			std::shared_ptr<snapshot const> current = std::atomic_load(&g_snapshot);
+			return ((current) && (!deleted)) ? static_cast<int>(current->count()) : 0;
+		}
+
+		return get_recording_count(connectionpool::handle(g_connpool), deleted); 
+	}
 
-	try { return get_recording_count(connectionpool::handle(g_connpool)); }
 	catch(std::exception& ex) { return handle_stdexception(__func__, ex, -1); }
 	catch(...) { return handle_generalexception(__func__, -1); }
 }
@@ -784,16 +1741,13 @@ PVR_ERROR GetRecordings(ADDON_HANDLE handle, bool deleted)
 
 	if(handle == nullptr) return PVR_ERROR::PVR_ERROR_INVALID_PARAMETERS;
 
-	// The PVR doesn't support tracking deleted recordings
-	if(deleted) return PVR_ERROR::PVR_ERROR_NO_ERROR;
-
 	try {
 
-		// Pull a database connection out from the connection pool
-		connectionpool::handle dbhandle(g_connpool);
+		int count = 0;
+		std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
 
-		// Enumerate all of the recordings in the database
-		enumerate_recordings(dbhandle, [&](struct recording const& item) -> void {
+		// Converts a recording from the database or the snapshot into a PVR_RECORDING
+		auto transfer = [&](struct recording const& item) -> void {
 
 			PVR_RECORDING recording;							// PVR_RECORDING to be transferred to Kodi
 			memset(&recording, 0, sizeof(PVR_RECORDING));		// Initialize the structure
@@ -839,8 +1793,26 @@ PVR_ERROR GetRecordings(ADDON_HANDLE handle, bool deleted)
 			// channelType
 			recording.channelType = PVR_RECORDING_CHANNEL_TYPE_TV;
 
+			// bIsDeleted
+			recording.bIsDeleted = deleted;
+
 			g_pvr->TransferRecordingEntry(handle, &recording);
-		});
+			++count;
+		};
+
+		// Enumerate all of the active or deleted recordings in the database
+		if(g_database_ready) enumerate_recordings(connectionpool::handle(g_connpool), deleted, transfer);
+
+		// Until the database has been opened, serve the active recordings from the snapshot; a full
+		// recording update is triggered as soon as the database is ready
+		else {
+
+			std::shared_ptr<snapshot const> current = std::atomic_load(&g_snapshot);
+			if((current) && (!deleted)) current->enumerate(transfer);
+		}
+
+		log_info(__func__, ": enumerated ", count, " recording(s) in ", 
+			std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(), "ms", (g_database_ready) ? "" : " from snapshot");
 	}
 	
 	catch(std::exception& ex) { return handle_stdexception(__func__, ex, PVR_ERROR::PVR_ERROR_FAILED); }
@@ -862,7 +1834,18 @@ PVR_ERROR DeleteRecording(PVR_RECORDING const& recording)
 {
 	assert(g_addon);
 
-	try { delete_recording(connectionpool::handle(g_connpool), g_addon, recording.strRecordingId); }
+	if(!g_database_ready) return PVR_ERROR::PVR_ERROR_SERVER_TIMEOUT;
+
+	try { 
+		
+		delete_recording(connectionpool::handle(g_connpool), recording.strRecordingId); 
+		g_pathindex.remove(recording.strRecordingId);
+
+		// The recording moves to (or out of) the deleted recordings list in Kodi
+		trigger_recording_update();
+		schedule_snapshot();
+	}
+
 	catch(std::exception& ex) { return handle_stdexception(__func__, ex, PVR_ERROR::PVR_ERROR_FAILED); }
 	catch(...) { return handle_generalexception(__func__, PVR_ERROR::PVR_ERROR_FAILED); }
 
@@ -878,9 +1861,28 @@ PVR_ERROR DeleteRecording(PVR_RECORDING const& recording)
 //
 //	recording	- The recording to undelete
 
-PVR_ERROR UndeleteRecording(PVR_RECORDING const& /*recording*/)
+PVR_ERROR UndeleteRecording(PVR_RECORDING const& recording)
 {
-	return PVR_ERROR::PVR_ERROR_NOT_IMPLEMENTED;
+	if(!g_database_ready) return PVR_ERROR::PVR_ERROR_SERVER_TIMEOUT;
+
+	try { 
+		
+		// Pull a database connection out from the connection pool
+		connectionpool::handle dbhandle(g_connpool);
+
+		// Move the recording out of the trash and reload the path index to pick it back up
+		undelete_recording(dbhandle, recording.strRecordingId);
+		load_pathindex(dbhandle, g_pathindex);
+
+		// The recording moves from the deleted recordings list back into the recordings in Kodi
+		trigger_recording_update();
+		schedule_snapshot();
+	}
+
+	catch(std::exception& ex) { return handle_stdexception(__func__, ex, PVR_ERROR::PVR_ERROR_FAILED); }
+	catch(...) { return handle_generalexception(__func__, PVR_ERROR::PVR_ERROR_FAILED); }
+
+	return PVR_ERROR::PVR_ERROR_NO_ERROR;
 }
 
 //---------------------------------------------------------------------------
@@ -894,7 +1896,25 @@ PVR_ERROR UndeleteRecording(PVR_RECORDING const& /*recording*/)
 
 PVR_ERROR DeleteAllRecordingsFromTrash()
 {
-	return PVR_ERROR::PVR_ERROR_NOT_IMPLEMENTED;
+	if(!g_database_ready) return PVR_ERROR::PVR_ERROR_SERVER_TIMEOUT;
+
+	try { 
+		
+		// Remove the deleted recordings from the database; the files are purged in the background
+		if(empty_recording_trash(connectionpool::handle(g_connpool)) > 0) {
+
+			trigger_recording_update();
+			schedule_snapshot();
+		}
+
+		g_scheduler.remove(purge_recordings_task);
+		g_scheduler.add(std::chrono::system_clock::now() + std::chrono::seconds(1), purge_recordings_task);
+	}
+
+	catch(std::exception& ex) { return handle_stdexception(__func__, ex, PVR_ERROR::PVR_ERROR_FAILED); }
+	catch(...) { return handle_generalexception(__func__, PVR_ERROR::PVR_ERROR_FAILED); }
+
+	return PVR_ERROR::PVR_ERROR_NO_ERROR;
 }
 
 //---------------------------------------------------------------------------
@@ -906,9 +1926,26 @@ PVR_ERROR DeleteAllRecordingsFromTrash()
 //
 //	recording	- The recording to rename, containing the new name
 
-PVR_ERROR RenameRecording(PVR_RECORDING const& /*recording*/)
+PVR_ERROR RenameRecording(PVR_RECORDING const& recording)
 {
-	return PVR_ERROR::PVR_ERROR_NOT_IMPLEMENTED;
+	if(!g_database_ready) return PVR_ERROR::PVR_ERROR_SERVER_TIMEOUT;
+
+	// Grab a copy of the required setting(s) up front
+	std::unique_lock<std::mutex> settings_lock(g_settings_lock);
+	enum directory_layout layout = g_settings.directory_layout;
+	settings_lock.unlock();
+
+	try { 
+		
+		rename_recording(connectionpool::handle(g_connpool), recording.strRecordingId, recording.strTitle, layout, g_pathindex); 
+		schedule_snapshot();
+		schedule_jobs();
+	}
+
+	catch(std::exception& ex) { return handle_stdexception(__func__, ex, PVR_ERROR::PVR_ERROR_FAILED); }
+	catch(...) { return handle_generalexception(__func__, PVR_ERROR::PVR_ERROR_FAILED); }
+
+	return PVR_ERROR::PVR_ERROR_NO_ERROR;
 }
 
 //---------------------------------------------------------------------------
@@ -1220,13 +2257,48 @@ PVR_ERROR GetRecordingStreamProperties(PVR_RECORDING const* recording, PVR_NAMED
 {
 	try {
 
+		std::string streamurl;
+
+		// Until the database has been opened the stream URL comes from the snapshot
+		if(g_database_ready) {
+
+			std::unique_lock<std::mutex> settings_lock(g_settings_lock);
+			bool validate = g_settings.validate_on_access;
+			settings_lock.unlock();
+
+			// Discovery skips the files it already knows about in this mode; the recording is played from the catalog
+			// right away and checked on the scheduler, touching the share here could hold up playback indefinitely
+			if(validate) {
+
+				std::unique_lock<std::mutex> queue_lock(g_validate_queue_lock);
+				if(std::find(g_validate_queue.begin(), g_validate_queue.end(), recording->strRecordingId) == g_validate_queue.end()) {
+
+					g_validate_queue.emplace_back(recording->strRecordingId);
+					if(g_validate_queue.size() == 1) g_scheduler.add(std::chrono::system_clock::now(), validate_recordings_task);
+				}
+			}
+
+			streamurl = get_recording_stream_url(connectionpool::handle(g_connpool), recording->strRecordingId);
+		}
+
+		else {
+
+			std::shared_ptr<snapshot const> current = std::atomic_load(&g_snapshot);
+			if(current) streamurl = current->get_stream_url(recording->strRecordingId);
+		}
+
 		// PVR_STREAM_PROPERTY_STREAMURL
 		snprintf(props[0].strName, std::extent<decltype(props[0].strName)>::value, PVR_STREAM_PROPERTY_STREAMURL);
-		snprintf(props[0].strValue, std::extent<decltype(props[0].strName)>::value, get_recording_stream_url(connectionpool::handle(g_connpool), recording->strRecordingId).c_str());
+		snprintf(props[0].strValue, std::extent<decltype(props[0].strName)>::value, streamurl.c_str());
+
+		// PVR_STREAM_PROPERTY_MIMETYPE; recordings other than WTV can be loaded by the metadata providers
+		char const* extension = strrchr(recording->strRecordingId, '.');
+		char const* mimetype = "video/x-ms-wtv";
+		if((extension != nullptr) && (_stricmp(extension, ".dvr-ms") == 0)) mimetype = "video/x-ms-dvr";
+		else if((extension != nullptr) && (_stricmp(extension, ".ts") == 0)) mimetype = "video/mp2t";
 
-		// PVR_STREAM_PROPERTY_MIMETYPE
 		snprintf(props[1].strName, std::extent<decltype(props[1].strName)>::value, PVR_STREAM_PROPERTY_MIMETYPE);
-		snprintf(props[1].strValue, std::extent<decltype(props[1].strName)>::value, "video/x-ms-wtv");
+		snprintf(props[1].strValue, std::extent<decltype(props[1].strName)>::value, "%s", mimetype);
 
 		// PVR_STREAM_PROPERTY_ISREALTIMESTREAM
 		snprintf(props[2].strName, std::extent<decltype(props[2].strName)>::value, PVR_STREAM_PROPERTY_ISREALTIMESTREAM);
@@ -1538,6 +2610,9 @@ void OnSystemSleep()
 
 		g_scheduler.stop();					// Stop the scheduler
 		g_scheduler.clear();				// Clear out any pending tasks
+
+		persist_database();					// Persist an in-memory database
+		if(g_snapshot_pending) write_snapshot();	// Write a snapshot that was still waiting
 	}
 
 	catch(std::exception& ex) { return handle_stdexception(__func__, ex); }
@@ -1557,9 +2632,37 @@ void OnSystemWake()
 {
 	try {
 
-		// Reschedule the discovery to update everything
 		std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+
+		// If the database still hasn't been opened, try again; that schedules all of the other tasks
+		if(!g_database_ready) {
+
+			g_scheduler.remove(open_database_task);
+			g_scheduler.add(now, open_database_task);
+			g_scheduler.start();
+			return;
+		}
+
+		// Reschedule the discovery to update everything
 		g_scheduler.add(now + std::chrono::seconds(1), discover_recordings_task);
+
+		// Reschedule the periodic persistence of an in-memory database
+		if(g_inmemory_database) g_scheduler.add(now + PERSIST_DATABASE_INTERVAL, persist_database_task);
+
+		// Reschedule the periodic purge of deleted recordings
+		g_scheduler.add(now + PURGE_RECORDINGS_INTERVAL, purge_recordings_task);
+
+		// Reschedule any unfinished background jobs
+		g_scheduler.add(now + JOB_START_DELAY, run_jobs_task);
+
+		// Reschedule a recording update that was still waiting when the system went to sleep
+		g_scheduler.add(now, trigger_recording_update_task);
+
+		// Reschedule the validation of any recordings that were still waiting when the system went to sleep
+		g_scheduler.add(now, validate_recordings_task);
+
+		// Reschedule the periodic compaction of the database
+		g_scheduler.add(now + COMPACT_DATABASE_INTERVAL, compact_database_task);
 	
 		// Restart the scheduler
 		g_scheduler.start();
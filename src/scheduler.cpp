@@ -120,11 +120,17 @@ void scheduler::remove(std::function<void(scalar_condition<bool> const&)> task)
 
 	std::unique_lock<std::mutex> lock(m_queue_lock);
 
+	// Tasks are compared by their target function pointer; std::function<>::target only
+	// returns a non-null pointer when the exact type of the stored target is specified
+	using target_t = void(*)(scalar_condition<bool> const&);
+	target_t const* target = task.target<target_t>();
+
 	// priority_queue<> doesn't actually allow elements to be removed, create
 	// a new queue with all the elements that don't have the same target
 	while(!m_queue.empty()) {
 
-		if(m_queue.top().second.target<void(*)(void)>() != task.target<void(*)(void)>()) newqueue.push(m_queue.top());
+		target_t const* queued = m_queue.top().second.target<target_t>();
+		if((target == nullptr) || (queued == nullptr) || (*queued != *target)) newqueue.push(m_queue.top());
 		m_queue.pop();
 	}
 
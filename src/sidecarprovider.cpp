@@ -0,0 +1,276 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "sidecarprovider.h"
+
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <wchar.h>
+
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+// MAX_SIDECAR_LENGTH
+//
+// Maximum length of a sidecar file that will be read
+static uint64_t const MAX_SIDECAR_LENGTH = 1 MiB;
+
+// FUNCTION PROTOTYPES
+//
+static bool get_element(char const* xml, char const* tag, std::string& value);
+static bool is_xml_space(char ch);
+
+//
+// HELPER FUNCTIONS
+//
+
+// get_element
+//
+// Retrieves the decoded text of the first XML element with the specified tag
+static bool get_element(char const* xml, char const* tag, std::string& value)
+{
+	size_t					taglength = strlen(tag);		// Length of the tag name
+	char const*				start = nullptr;				// Start of the element text
+	char const*				end = nullptr;					// End of the element text
+
+	value.clear();
+
+	// Find the opening tag, which may have attributes
+	for(char const* offset = strchr(xml, '<'); offset != nullptr; offset = strchr(offset + 1, '<')) {
+
+		if(strncmp(offset + 1, tag, taglength) == 0) {
+
+			char next = offset[1 + taglength];
+			if((next == '>') || (next == ' ') || (next == '\t') || (next == '\r') || (next == '\n')) {
+
+				start = strchr(offset, '>');
+				break;
+			}
+		}
+	}
+
+	if((start == nullptr) || (start[-1] == '/')) return false;
+	++start;
+
+	for(end = strstr(start, "</"); end != nullptr; end = strstr(end + 2, "</"))
+		if(strncmp(end + 2, tag, taglength) == 0) break;
+
+	if(end == nullptr) return false;
+
+	// CDATA sections are taken as-is
+	if((end - start >= 9) && (strncmp(start, "<![CDATA[", 9) == 0)) {
+
+		char const* cdataend = start + 9;
+		while((end - cdataend >= 3) && (strncmp(cdataend, "]]>", 3) != 0)) ++cdataend;
+		value.assign(start + 9, (end - cdataend >= 3) ? cdataend : end);
+		return true;
+	}
+
+	// Trim any surrounding whitespace; none of the entities decode to whitespace
+	while((start < end) && is_xml_space(*start)) ++start;
+	while((end > start) && is_xml_space(end[-1])) --end;
+
+	// Decode the predefined XML entities; numeric references are left alone
+	value.reserve(end - start);
+	for(char const* current = start; current < end; current++) {
+
+		if(*current == '&') {
+
+			if(strncmp(current, "&amp;", 5) == 0) { value.push_back('&'); current += 4; continue; }
+			if(strncmp(current, "&lt;", 4) == 0) { value.push_back('<'); current += 3; continue; }
+			if(strncmp(current, "&gt;", 4) == 0) { value.push_back('>'); current += 3; continue; }
+			if(strncmp(current, "&quot;", 6) == 0) { value.push_back('"'); current += 5; continue; }
+			if(strncmp(current, "&apos;", 6) == 0) { value.push_back('\''); current += 5; continue; }
+		}
+
+		value.push_back(*current);
+	}
+
+	return true;
+}
+
+// is_xml_space
+//
+// Determines if a character is XML whitespace
+static bool is_xml_space(char ch)
+{
+	return ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n'));
+}
+
+//---------------------------------------------------------------------------
+// sidecarprovider::accepts
+//
+// Determines if the provider can read a file based on the extension and magic bytes
+//
+// Arguments:
+//
+//	extension	- File extension, including the leading period
+//	magic		- Bytes read from the start of the file
+//	length		- Number of magic bytes available
+
+bool sidecarprovider::accepts(wchar_t const* /*extension*/, uint8_t const* /*magic*/, size_t /*length*/) const
+{
+	// Any recording can have a sidecar file; if it doesn't the load fails quickly
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// sidecarprovider::extensions
+//
+// Gets the file extension(s) the provider reads natively, or null if it reads any file
+//
+// Arguments:
+//
+//	NONE
+
+char const* sidecarprovider::extensions(void) const
+{
+	return nullptr;
+}
+
+//---------------------------------------------------------------------------
+// sidecarprovider::extract (private)
+//
+// Provider specific implementation of load()
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void sidecarprovider::extract(wchar_t const* path, recording_metadata& metadata)
+{
+	LARGE_INTEGER			filesize;			// Length of the sidecar file
+	uint8_t*				raw = nullptr;		// Raw metadata
+	size_t					rawlength = 0;		// Length of the raw metadata
+
+	// The sidecar file has the same name as the recording with an .nfo extension
+	size_t stem = wcslen(path);
+	for(size_t index = stem; index > 0; index--) {
+
+		if(path[index - 1] == L'.') { stem = index - 1; break; }
+		if((path[index - 1] == L'/') || (path[index - 1] == L'\\')) break;
+	}
+
+	wchar_t* sidecar = scratch().allocate<wchar_t>(stem + 5);
+	wmemcpy(sidecar, path, stem);
+	wmemcpy(sidecar + stem, L".nfo", 5);
+
+	HANDLE file = open_file(sidecar);
+
+	try {
+
+		if(!GetFileSizeEx(file, &filesize) || (static_cast<uint64_t>(filesize.QuadPart) > MAX_SIDECAR_LENGTH)) 
+			throw string_exception(__func__, ": sidecar file is too large or its size cannot be determined");
+
+		// The raw metadata is the recording creation time followed by the null-terminated sidecar file contents;
+		// the recording time isn't part of the .nfo format so the time the recording was created is used
+		rawlength = sizeof(uint32_t) + static_cast<size_t>(filesize.QuadPart) + 1;
+		raw = scratch().allocate<uint8_t>(rawlength);
+
+		uint32_t creationtime = static_cast<uint32_t>(get_creation_time(path));
+		for(size_t index = 0; index < sizeof(uint32_t); index++) raw[index] = static_cast<uint8_t>(creationtime >> (index * 8));
+
+		if(filesize.QuadPart > 0) read_file(file, 0, raw + sizeof(uint32_t), static_cast<size_t>(filesize.QuadPart));
+		raw[rawlength - 1] = 0;
+
+		CloseHandle(file);
+	}
+
+	catch(...) { CloseHandle(file); throw; }
+
+	parse(raw, rawlength, metadata);
+
+	metadata.format = name();
+	metadata.raw.assign(reinterpret_cast<char const*>(raw), rawlength);
+}
+
+//---------------------------------------------------------------------------
+// sidecarprovider::name
+//
+// Gets the name of the provider
+//
+// Arguments:
+//
+//	NONE
+
+char const* sidecarprovider::name(void) const
+{
+	return "sidecar";
+}
+
+//---------------------------------------------------------------------------
+// sidecarprovider::parse (private)
+//
+// Provider specific implementation of decode()
+//
+// Arguments:
+//
+//	data		- Pointer to the raw metadata
+//	length		- Length of the raw metadata
+//	metadata	- Metadata to be decoded
+
+void sidecarprovider::parse(uint8_t const* data, size_t length, recording_metadata& metadata)
+{
+	std::string				value;				// Element value
+
+	if((length <= sizeof(uint32_t)) || (data[length - 1] != 0)) throw string_exception(__func__, ": invalid raw metadata");
+
+	// The contents are null terminated so the elements can be located with the C string functions
+	char const* xml = reinterpret_cast<char const*>(data + sizeof(uint32_t));
+
+	// Kodi episode .nfo files have the series title in <showtitle> and the episode name in <title>
+	if(get_element(xml, "showtitle", metadata.title)) get_element(xml, "title", metadata.episodename);
+	else get_element(xml, "title", metadata.title);
+
+	get_element(xml, "plot", metadata.plot);
+	get_element(xml, "studio", metadata.channelname);
+
+	if(get_element(xml, "season", value)) metadata.seriesnumber = atoi(value.c_str());
+	if(get_element(xml, "episode", value)) metadata.episodenumber = atoi(value.c_str());
+	if(get_element(xml, "aired", value) || get_element(xml, "premiered", value)) metadata.year = atoi(value.substr(0, 4).c_str());
+	if(get_element(xml, "runtime", value)) metadata.duration = atoi(value.c_str()) * 60;
+
+	// The recording time isn't part of the .nfo format, use the time the recording was created
+	metadata.recordingtime = static_cast<int>(get_le32(data));
+}
+
+//---------------------------------------------------------------------------
+// sidecarprovider::priority
+//
+// Gets the static priority of the provider; lower values are tried first
+//
+// Arguments:
+//
+//	NONE
+
+int sidecarprovider::priority(void) const
+{
+	return 2;		// Fallback to the sidecar files next to the recording; tried last
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,95 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __SIDECARPROVIDER_H_
+#define __SIDECARPROVIDER_H_
+#pragma once
+
+#include "metadataprovider.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class sidecarprovider
+//
+// Reads the metadata of a recording from a Kodi-style .nfo sidecar file with
+// the same name as the recording
+
+class sidecarprovider : public metadataprovider
+{
+public:
+
+	// Instance Constructor
+	//
+	sidecarprovider()=default;
+
+	// Destructor
+	//
+	virtual ~sidecarprovider()=default;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// accepts (metadataprovider)
+	//
+	// Determines if the provider can read a file based on the extension and magic bytes
+	virtual bool accepts(wchar_t const* extension, uint8_t const* magic, size_t length) const override;
+
+	// extensions (metadataprovider)
+	//
+	// Gets the file extension(s) the provider reads natively, or null if it reads any file
+	virtual char const* extensions(void) const override;
+
+	// name (metadataprovider)
+	//
+	// Gets the name of the provider
+	virtual char const* name(void) const override;
+
+	// priority (metadataprovider)
+	//
+	// Gets the static priority of the provider; lower values are tried first
+	virtual int priority(void) const override;
+
+private:
+
+	sidecarprovider(sidecarprovider const&)=delete;
+	sidecarprovider& operator=(sidecarprovider const&)=delete;
+
+	//-----------------------------------------------------------------------
+	// Private Member Functions
+
+	// extract (metadataprovider)
+	//
+	// Provider specific implementation of load()
+	virtual void extract(wchar_t const* path, recording_metadata& metadata) override;
+
+	// parse (metadataprovider)
+	//
+	// Provider specific implementation of decode()
+	virtual void parse(uint8_t const* data, size_t length, recording_metadata& metadata) override;
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __SIDECARPROVIDER_H_
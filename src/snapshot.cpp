@@ -0,0 +1,325 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "snapshot.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include "collation.h"
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+// NULL_OFFSET
+//
+// String pool offset used to indicate a null string
+static uint32_t const NULL_OFFSET = 0xFFFFFFFF;
+
+// SNAPSHOT_MAGIC
+//
+// Snapshot file signature ('MCRS')
+static uint32_t const SNAPSHOT_MAGIC = 0x5352434D;
+
+// SNAPSHOT_VERSION
+//
+// Snapshot file format version; increment if entry_t or header_t change
+static uint32_t const SNAPSHOT_VERSION = 1;
+
+// to_wstring (local)
+//
+// Converts a UTF-8 path into a UTF-16 path
+static std::wstring to_wstring(char const* path)
+{
+	int length = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+	if(length <= 0) throw string_exception(__func__, ": invalid path ", path);
+
+	std::vector<wchar_t> buffer(length);
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, buffer.data(), length);
+
+	return std::wstring(buffer.data());
+}
+
+//---------------------------------------------------------------------------
+// snapshot Constructor
+//
+// Arguments:
+//
+//	path		- Path to the snapshot file
+
+snapshot::snapshot(char const* path)
+{
+	LARGE_INTEGER			filesize;			// Size of the snapshot file
+
+	if(path == nullptr) throw std::invalid_argument("path");
+
+	// The file is opened with FILE_SHARE_DELETE so that it can still be replaced while mapped
+	m_file = CreateFileW(to_wstring(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(m_file == INVALID_HANDLE_VALUE) throw string_exception(__func__, ": unable to open snapshot file ", path, " (", GetLastError(), ")");
+
+	try {
+
+		if(!GetFileSizeEx(m_file, &filesize)) throw string_exception(__func__, ": unable to get size of snapshot file ", path);
+		if(filesize.QuadPart < static_cast<LONGLONG>(sizeof(header_t))) throw string_exception(__func__, ": snapshot file ", path, " is truncated");
+
+		m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(m_mapping == nullptr) throw string_exception(__func__, ": unable to map snapshot file ", path, " (", GetLastError(), ")");
+
+		m_view = reinterpret_cast<uint8_t const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		if(m_view == nullptr) throw string_exception(__func__, ": unable to map snapshot file ", path, " (", GetLastError(), ")");
+
+		// Validate the header before trusting any of the offsets
+		m_header = reinterpret_cast<header_t const*>(m_view);
+		if((m_header->magic != SNAPSHOT_MAGIC) || (m_header->version != SNAPSHOT_VERSION) || (m_header->entrysize != sizeof(entry_t)))
+			throw string_exception(__func__, ": snapshot file ", path, " has an incompatible format");
+
+		if((m_header->length != static_cast<uint64_t>(filesize.QuadPart)) || 
+			(m_header->stringpool != sizeof(header_t) + (static_cast<uint64_t>(m_header->count) * sizeof(entry_t))) || (m_header->stringpool > m_header->length))
+			throw string_exception(__func__, ": snapshot file ", path, " is corrupt");
+
+		if(checksum(m_view + sizeof(header_t), static_cast<size_t>(m_header->length - sizeof(header_t))) != m_header->checksum)
+			throw string_exception(__func__, ": snapshot file ", path, " failed checksum validation");
+
+		m_entries = reinterpret_cast<entry_t const*>(m_view + sizeof(header_t));
+		m_strings = reinterpret_cast<char const*>(m_view + m_header->stringpool);
+		m_poolsize = static_cast<size_t>(m_header->length - m_header->stringpool);
+	}
+
+	catch(...) {
+
+		if(m_view) UnmapViewOfFile(m_view);
+		if(m_mapping) CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		throw;
+	}
+}
+
+//---------------------------------------------------------------------------
+// snapshot Destructor
+
+snapshot::~snapshot()
+{
+	UnmapViewOfFile(m_view);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+}
+
+//---------------------------------------------------------------------------
+// snapshot::checksum (private, static)
+//
+// Generates the checksum of a block of data
+//
+// Arguments:
+//
+//	data		- Data to generate the checksum for
+//	length		- Length of the data
+
+uint64_t snapshot::checksum(void const* data, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	uint8_t const* current = reinterpret_cast<uint8_t const*>(data);
+	for(size_t index = 0; index < length; index++) hash = (hash ^ current[index]) * 1099511628211ULL;
+
+	return hash;
+}
+
+//---------------------------------------------------------------------------
+// snapshot::count
+//
+// Gets the number of recordings in the snapshot
+//
+// Arguments:
+//
+//	NONE
+
+size_t snapshot::count(void) const
+{
+	return m_header->count;
+}
+
+//---------------------------------------------------------------------------
+// snapshot::enumerate
+//
+// Enumerates the recordings in the snapshot
+//
+// Arguments:
+//
+//	callback	- Callback function
+
+void snapshot::enumerate(enumerate_recordings_callback const& callback) const
+{
+	if(callback == nullptr) return;
+
+	for(uint32_t index = 0; index < m_header->count; index++) {
+
+		entry_t const& entry = m_entries[index];
+
+		struct recording item;
+		item.recordingid = get_string(entry.recordingid);
+		item.title = get_string(entry.title);
+		item.episodename = get_string(entry.episodename);
+		item.seriesnumber = entry.seriesnumber;
+		item.episodenumber = entry.episodenumber;
+		item.year = entry.year;
+		item.streamurl = get_string(entry.streamurl);
+		item.directory = get_string(entry.directory);
+		item.plot = get_string(entry.plot);
+		item.channelname = get_string(entry.channelname);
+		item.recordingtime = entry.recordingtime;
+		item.duration = entry.duration;
+
+		callback(item);
+	}
+}
+
+//---------------------------------------------------------------------------
+// snapshot::get_stream_url
+//
+// Gets the playback URL for a recording in the snapshot
+//
+// Arguments:
+//
+//	recordingid		- Recording ID (CmdURL) of the item
+
+std::string snapshot::get_stream_url(char const* recordingid) const
+{
+	if(recordingid == nullptr) throw std::invalid_argument("recordingid");
+
+	int length = static_cast<int>(strlen(recordingid));
+
+	for(uint32_t index = 0; index < m_header->count; index++) {
+
+		char const* entryid = get_string(m_entries[index].recordingid);
+		if((entryid) && (path_collation(nullptr, static_cast<int>(strlen(entryid)), entryid, length, recordingid) == 0)) {
+
+			char const* streamurl = get_string(m_entries[index].streamurl);
+			return std::string((streamurl) ? streamurl : "");
+		}
+	}
+
+	return std::string();
+}
+
+//---------------------------------------------------------------------------
+// snapshot::get_string (private)
+//
+// Converts a string pool offset into a pointer
+//
+// Arguments:
+//
+//	offset		- Offset into the string pool
+
+char const* snapshot::get_string(uint32_t offset) const
+{
+	return ((offset == NULL_OFFSET) || (offset >= m_poolsize)) ? nullptr : m_strings + offset;
+}
+
+//---------------------------------------------------------------------------
+// snapshot::write (static)
+//
+// Writes a new snapshot file, replacing any existing file
+//
+// Arguments:
+//
+//	path		- Path to the snapshot file
+//	enumerator	- Function that enumerates the recordings to write
+
+void snapshot::write(char const* path, enumerator_t const& enumerator)
+{
+	std::vector<entry_t>		entries;			// Snapshot entries
+	std::string					strings;			// Snapshot string pool
+	DWORD						written = 0;		// Bytes written to the file
+
+	if(path == nullptr) throw std::invalid_argument("path");
+	if(enumerator == nullptr) throw std::invalid_argument("enumerator");
+
+	// Appends a string to the string pool and returns the offset
+	auto append = [&](char const* str) -> uint32_t {
+
+		if(str == nullptr) return NULL_OFFSET;
+
+		uint32_t offset = static_cast<uint32_t>(strings.size());
+		strings.append(str);
+		strings.push_back('\0');
+
+		return offset;
+	};
+
+	enumerator([&](struct recording const& item) -> void {
+
+		entry_t entry;
+		entry.recordingid = append(item.recordingid);
+		entry.title = append(item.title);
+		entry.episodename = append(item.episodename);
+		entry.streamurl = append(item.streamurl);
+		entry.directory = append(item.directory);
+		entry.plot = append(item.plot);
+		entry.channelname = append(item.channelname);
+		entry.seriesnumber = item.seriesnumber;
+		entry.episodenumber = item.episodenumber;
+		entry.year = item.year;
+		entry.recordingtime = item.recordingtime;
+		entry.duration = item.duration;
+
+		entries.push_back(entry);
+	});
+
+	if(strings.size() >= NULL_OFFSET) throw string_exception(__func__, ": snapshot string pool is too large");
+
+	// Generate the header, the checksum covers the entries and the string pool as they are laid out in the file
+	header_t header = {};
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.count = static_cast<uint32_t>(entries.size());
+	header.entrysize = sizeof(entry_t);
+	header.stringpool = sizeof(header_t) + (entries.size() * sizeof(entry_t));
+	header.length = header.stringpool + strings.size();
+
+	std::vector<uint8_t> body(static_cast<size_t>(header.length - sizeof(header_t)));
+	if(!entries.empty()) memcpy(body.data(), entries.data(), entries.size() * sizeof(entry_t));
+	if(!strings.empty()) memcpy(body.data() + (entries.size() * sizeof(entry_t)), strings.data(), strings.size());
+	header.checksum = checksum(body.data(), body.size());
+
+	// Write the snapshot to a temporary file first so that an incomplete file never replaces a good one
+	std::wstring widepath = to_wstring(path);
+	std::wstring widetemp = widepath + L".tmp";
+
+	HANDLE file = CreateFileW(widetemp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE) throw string_exception(__func__, ": unable to create snapshot file ", path, " (", GetLastError(), ")");
+
+	bool succeeded = (WriteFile(file, &header, sizeof(header_t), &written, nullptr) && (written == sizeof(header_t)));
+	if((succeeded) && (!body.empty())) succeeded = (WriteFile(file, body.data(), static_cast<DWORD>(body.size()), &written, nullptr) && (written == body.size()));
+
+	CloseHandle(file);
+
+	if((!succeeded) || (!MoveFileExW(widetemp.c_str(), widepath.c_str(), MOVEFILE_REPLACE_EXISTING))) {
+
+		DeleteFileW(widetemp.c_str());
+		throw string_exception(__func__, ": unable to write snapshot file ", path);
+	}
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
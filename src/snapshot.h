@@ -0,0 +1,157 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __SNAPSHOT_H_
+#define __SNAPSHOT_H_
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+
+#include "database.h"
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class snapshot
+//
+// Implements a read-only, memory-mapped binary snapshot of the recordings that
+// can be served to Kodi without any parsing while the database is being opened.
+// The file is a header followed by an array of fixed-size entries and a pool of
+// null-terminated strings; entries refer to the strings by offset so the file
+// can be mapped at any address
+
+class snapshot
+{
+public:
+
+	// Instance Constructor
+	//
+	snapshot(char const* path);
+
+	// Destructor
+	//
+	~snapshot();
+
+	//-----------------------------------------------------------------------
+	// Type Declarations
+
+	// enumerator_t
+	//
+	// Function that enumerates the recordings to be written into a snapshot
+	using enumerator_t = std::function<void(enumerate_recordings_callback const& callback)>;
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// count
+	//
+	// Gets the number of recordings in the snapshot
+	size_t count(void) const;
+
+	// enumerate
+	//
+	// Enumerates the recordings in the snapshot
+	void enumerate(enumerate_recordings_callback const& callback) const;
+
+	// get_stream_url
+	//
+	// Gets the playback URL for a recording in the snapshot
+	std::string get_stream_url(char const* recordingid) const;
+
+	// write (static)
+	//
+	// Writes a new snapshot file, replacing any existing file
+	static void write(char const* path, enumerator_t const& enumerator);
+
+private:
+
+	snapshot(snapshot const&)=delete;
+	snapshot& operator=(snapshot const&)=delete;
+
+	//-----------------------------------------------------------------------
+	// Private Type Declarations
+
+	// entry_t
+	//
+	// Fixed-size snapshot entry; the string members are offsets into the string pool
+	struct entry_t
+	{
+		uint32_t	recordingid;
+		uint32_t	title;
+		uint32_t	episodename;
+		uint32_t	streamurl;
+		uint32_t	directory;
+		uint32_t	plot;
+		uint32_t	channelname;
+		int32_t		seriesnumber;
+		int32_t		episodenumber;
+		int32_t		year;
+		int32_t		recordingtime;
+		int32_t		duration;
+	};
+
+	// header_t
+	//
+	// Snapshot file header
+	struct header_t
+	{
+		uint32_t	magic;			// File signature
+		uint32_t	version;		// File format version
+		uint32_t	count;			// Number of entries
+		uint32_t	entrysize;		// Size of each entry
+		uint64_t	stringpool;		// Offset of the string pool
+		uint64_t	length;			// Length of the file
+		uint64_t	checksum;		// 64-bit FNV-1a hash of everything after the header
+	};
+
+	//-----------------------------------------------------------------------
+	// Private Member Functions
+
+	// checksum (static)
+	//
+	// Generates the checksum of a block of data
+	static uint64_t checksum(void const* data, size_t length);
+
+	// get_string
+	//
+	// Converts a string pool offset into a pointer
+	char const* get_string(uint32_t offset) const;
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	HANDLE					m_file = INVALID_HANDLE_VALUE;	// File handle
+	HANDLE					m_mapping = nullptr;			// File mapping handle
+	uint8_t const*			m_view = nullptr;				// Mapped view of the file
+	header_t const*			m_header = nullptr;				// Snapshot header
+	entry_t const*			m_entries = nullptr;			// Snapshot entries
+	char const*				m_strings = nullptr;			// Snapshot string pool
+	size_t					m_poolsize = 0;					// Length of the string pool
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __SNAPSHOT_H_
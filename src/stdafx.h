@@ -42,6 +42,7 @@
 #include <ShObjIdl.h>				// Include shell object COM declarations
 #include <propkey.h>				// Include property key declarations
 #include <PathCch.h>				// Include PathCch helper declarations
+#include <compressapi.h>			// Include compression API declarations
 
 #include <assert.h>					// Include standard assertion declarations
 #include <stdint.h>					// Include standard integer declarations
@@ -65,7 +66,7 @@
 // SQLite Declarations
 
 #define SQLITE_THREADSAFE 2			// SQLITE_CONFIG_MULTITHREAD
-#define SQLITE_TEMP_STORE 3			// Enable in-memory temp storage
+#define SQLITE_TEMP_STORE 2			// In-memory temp storage unless overridden
 
 #include <sqlite3.h>				// Include SQLite declarations
 
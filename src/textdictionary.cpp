@@ -0,0 +1,258 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "textdictionary.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#pragma warning(push, 4)
+
+// CODE_PREFIX
+//
+// First lead byte of a dictionary code; 0xF5 through 0xFF never occur in UTF-8
+static uint8_t const CODE_PREFIX = 0xF5;
+
+// MAX_WORDS
+//
+// Maximum number of words in a dictionary (11 lead bytes x 256 trail bytes)
+static size_t const MAX_WORDS = (0x100 - CODE_PREFIX) * 0x100;
+
+// MIN_WORD_LENGTH
+//
+// Minimum length of a dictionary word; anything shorter doesn't save space
+static size_t const MIN_WORD_LENGTH = 3;
+
+// next_word (local)
+//
+// Gets the length of the word at the start of the text; a word is a run of letters, digits and
+// non-ASCII characters plus the single character that follows it, typically a space
+static size_t next_word(uint8_t const* text, size_t length)
+{
+	size_t index = 0;
+	while((index < length) && ((text[index] >= 0x80) || (isalnum(text[index])))) ++index;
+
+	// Include the trailing separator, or take a lone separator as a word by itself
+	return (index < length) ? index + 1 : index;
+}
+
+//---------------------------------------------------------------------------
+// textdictionary Constructor
+//
+// Arguments:
+//
+//	serialized	- Serialized dictionary generated by textdictionary::trainer
+//	length		- Length of the serialized dictionary
+
+textdictionary::textdictionary(void const* serialized, size_t length)
+{
+	if((serialized == nullptr) && (length > 0)) throw std::invalid_argument("serialized");
+
+	char const* begin = reinterpret_cast<char const*>(serialized);
+	char const* end = begin + length;
+
+	// The words are stored in code order separated by null characters
+	while((begin < end) && (m_words.size() < MAX_WORDS)) {
+
+		char const* terminator = std::find(begin, end, '\0');
+		m_words.emplace_back(begin, terminator);
+		m_codes.emplace(m_words.back(), static_cast<uint16_t>(m_words.size() - 1));
+
+		begin = (terminator < end) ? terminator + 1 : end;
+	}
+}
+
+//---------------------------------------------------------------------------
+// textdictionary::compress
+//
+// Compresses text; returns false if the result would not be any smaller
+//
+// Arguments:
+//
+//	text		- Text to be compressed
+//	length		- Length of the text to be compressed
+//	result		- Receives the compressed data
+
+bool textdictionary::compress(char const* text, size_t length, std::string& result) const
+{
+	std::string					word;			// Current word
+
+	result.clear();
+	if((text == nullptr) || (length == 0) || (m_words.empty())) return false;
+
+	uint8_t const* current = reinterpret_cast<uint8_t const*>(text);
+	uint8_t const* end = current + length;
+
+	result.reserve(length);
+
+	while(current < end) {
+
+		size_t wordlength = next_word(current, end - current);
+
+		// Text that already contains a byte in the code range can't be compressed
+		if(*current >= CODE_PREFIX) return false;
+
+		if(wordlength >= MIN_WORD_LENGTH) {
+
+			word.assign(reinterpret_cast<char const*>(current), wordlength);
+
+			auto found = m_codes.find(word);
+			if(found != m_codes.end()) {
+
+				result.push_back(static_cast<char>(CODE_PREFIX + (found->second >> 8)));
+				result.push_back(static_cast<char>(found->second & 0xFF));
+				current += wordlength;
+				continue;
+			}
+		}
+
+		// Copy the word as-is, checking every byte for one in the code range
+		for(size_t index = 0; index < wordlength; index++) {
+
+			if(current[index] >= CODE_PREFIX) return false;
+			result.push_back(static_cast<char>(current[index]));
+		}
+
+		current += wordlength;
+	}
+
+	return (result.size() < length);
+}
+
+//---------------------------------------------------------------------------
+// textdictionary::decompress
+//
+// Decompresses text previously compressed with this dictionary
+//
+// Arguments:
+//
+//	data		- Compressed data
+//	length		- Length of the compressed data
+//	result		- Receives the decompressed text
+
+void textdictionary::decompress(void const* data, size_t length, std::string& result) const
+{
+	result.clear();
+	if((data == nullptr) || (length == 0)) return;
+
+	uint8_t const* current = reinterpret_cast<uint8_t const*>(data);
+	uint8_t const* end = current + length;
+
+	// Most text decompresses to around twice the length of the compressed data
+	result.reserve(length * 2);
+
+	while(current < end) {
+
+		if(*current < CODE_PREFIX) { result.push_back(static_cast<char>(*current++)); continue; }
+
+		if(current + 1 == end) throw std::runtime_error("textdictionary: truncated dictionary code");
+
+		size_t code = (static_cast<size_t>(current[0] - CODE_PREFIX) << 8) | current[1];
+		if(code >= m_words.size()) throw std::runtime_error("textdictionary: invalid dictionary code");
+
+		result.append(m_words[code]);
+		current += 2;
+	}
+}
+
+//---------------------------------------------------------------------------
+// textdictionary::size
+//
+// Gets the number of words in the dictionary
+//
+// Arguments:
+//
+//	NONE
+
+size_t textdictionary::size(void) const
+{
+	return m_words.size();
+}
+
+//---------------------------------------------------------------------------
+// textdictionary::trainer::add
+//
+// Adds a sample of text to the trainer
+//
+// Arguments:
+//
+//	text		- Sample text
+//	length		- Length of the sample text
+
+void textdictionary::trainer::add(char const* text, size_t length)
+{
+	if(text == nullptr) return;
+
+	uint8_t const* current = reinterpret_cast<uint8_t const*>(text);
+	uint8_t const* end = current + length;
+
+	while(current < end) {
+
+		size_t wordlength = next_word(current, end - current);
+		if(wordlength >= MIN_WORD_LENGTH) ++m_counts[std::string(reinterpret_cast<char const*>(current), wordlength)];
+
+		current += wordlength;
+	}
+}
+
+//---------------------------------------------------------------------------
+// textdictionary::trainer::serialize
+//
+// Generates the serialized dictionary from the collected samples
+//
+// Arguments:
+//
+//	NONE
+
+std::string textdictionary::trainer::serialize(void) const
+{
+	std::vector<std::pair<size_t, std::string const*>>	candidates;		// Candidate words
+	std::string											serialized;		// Serialized dictionary
+
+	// The value of a word is the number of bytes it would save across all of the samples
+	candidates.reserve(m_counts.size());
+	for(auto const& count : m_counts) {
+
+		if((count.second < 2) || (count.first.find('\0') != std::string::npos)) continue;
+		candidates.emplace_back((count.first.size() - 2) * count.second, &count.first);
+	}
+
+	size_t words = std::min(candidates.size(), MAX_WORDS);
+	std::partial_sort(candidates.begin(), candidates.begin() + words, candidates.end(), 
+		[](std::pair<size_t, std::string const*> const& lhs, std::pair<size_t, std::string const*> const& rhs) -> bool {
+
+		return (lhs.first != rhs.first) ? lhs.first > rhs.first : *lhs.second < *rhs.second;
+	});
+
+	for(size_t index = 0; index < words; index++) {
+
+		serialized.append(*candidates[index].second);
+		serialized.push_back('\0');
+	}
+
+	return serialized;
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,120 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#ifndef __TEXTDICTIONARY_H_
+#define __TEXTDICTIONARY_H_
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#pragma warning(push, 4)
+
+//---------------------------------------------------------------------------
+// Class textdictionary
+//
+// Implements a static word dictionary used to compress the long text fields
+// stored in the database; the dictionary is trained from the catalog itself.
+// Dictionary words are replaced by two byte codes that start with a byte that
+// can never appear in UTF-8 text, all other bytes are stored as-is
+
+class textdictionary
+{
+public:
+
+	// Instance Constructor
+	//
+	textdictionary(void const* serialized, size_t length);
+
+	// Destructor
+	//
+	~textdictionary()=default;
+
+	//-----------------------------------------------------------------------
+	// Type Declarations
+
+	// trainer
+	//
+	// Collects word frequencies from sample text to generate a dictionary
+	class trainer
+	{
+	public:
+
+		// Instance Constructor
+		//
+		trainer()=default;
+
+		// add
+		//
+		// Adds a sample of text to the trainer
+		void add(char const* text, size_t length);
+
+		// serialize
+		//
+		// Generates the serialized dictionary from the collected samples
+		std::string serialize(void) const;
+
+	private:
+
+		trainer(trainer const&)=delete;
+		trainer& operator=(trainer const&)=delete;
+
+		std::unordered_map<std::string, size_t>	m_counts;		// Word frequencies
+	};
+
+	//-----------------------------------------------------------------------
+	// Member Functions
+
+	// compress
+	//
+	// Compresses text; returns false if the result would not be any smaller
+	bool compress(char const* text, size_t length, std::string& result) const;
+
+	// decompress
+	//
+	// Decompresses text previously compressed with this dictionary
+	void decompress(void const* data, size_t length, std::string& result) const;
+
+	// size
+	//
+	// Gets the number of words in the dictionary
+	size_t size(void) const;
+
+private:
+
+	textdictionary(textdictionary const&)=delete;
+	textdictionary& operator=(textdictionary const&)=delete;
+
+	//-----------------------------------------------------------------------
+	// Member Variables
+
+	std::vector<std::string>					m_words;		// Words by code
+	std::unordered_map<std::string, uint16_t>	m_codes;		// Codes by word
+};
+
+//-----------------------------------------------------------------------------
+
+#pragma warning(pop)
+
+#endif	// __TEXTDICTIONARY_H_
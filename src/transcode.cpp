@@ -0,0 +1,224 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "transcode.h"
+
+#include <stdexcept>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#pragma warning(push, 4)
+
+//
+// HELPER FUNCTIONS
+//
+
+// transcode_scalar
+//
+// Converts UTF-16 character data into UTF-8 one code unit at a time
+static char* transcode_scalar(wchar_t const* src, wchar_t const* end, char* dest)
+{
+	while(src < end) {
+
+		uint32_t codepoint = static_cast<uint16_t>(*src++);
+
+		// U+0000 - U+007F: 1 byte
+		if(codepoint < 0x80) { *dest++ = static_cast<char>(codepoint); continue; }
+
+		// U+0080 - U+07FF: 2 bytes
+		if(codepoint < 0x800) {
+
+			*dest++ = static_cast<char>(0xC0 | (codepoint >> 6));
+			*dest++ = static_cast<char>(0x80 | (codepoint & 0x3F));
+			continue;
+		}
+
+		// Surrogate code units; a valid pair is combined into a single 4 byte sequence and
+		// any unpaired surrogate is replaced with U+FFFD REPLACEMENT CHARACTER
+		if((codepoint >= 0xD800) && (codepoint <= 0xDFFF)) {
+
+			if((codepoint <= 0xDBFF) && (src < end) && (*src >= 0xDC00) && (*src <= 0xDFFF)) {
+
+				codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (static_cast<uint16_t>(*src++) - 0xDC00);
+				*dest++ = static_cast<char>(0xF0 | (codepoint >> 18));
+				*dest++ = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+				*dest++ = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+				*dest++ = static_cast<char>(0x80 | (codepoint & 0x3F));
+				continue;
+			}
+
+			codepoint = 0xFFFD;
+		}
+
+		// U+0800 - U+FFFF: 3 bytes
+		*dest++ = static_cast<char>(0xE0 | (codepoint >> 12));
+		*dest++ = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		*dest++ = static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+
+	return dest;
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+// has_avx2
+//
+// Determines if the processor and operating system support AVX2 instructions
+static bool has_avx2(void)
+{
+	int info[4] = { 0, 0, 0, 0 };
+
+	__cpuid(info, 0);
+	if(info[0] < 7) return false;
+
+	// AVX support requires OSXSAVE and the OS must be preserving the YMM registers
+	__cpuid(info, 1);
+	if((info[2] & ((1 << 27) | (1 << 28))) != ((1 << 27) | (1 << 28))) return false;
+	if((_xgetbv(0) & 0x06) != 0x06) return false;
+
+	__cpuidex(info, 7, 0);
+	return ((info[1] & (1 << 5)) != 0);
+}
+
+// transcode_avx2
+//
+// Converts UTF-16 character data into UTF-8, 16 ASCII code units at a time
+static char* transcode_avx2(wchar_t const* src, wchar_t const* end, char* dest)
+{
+	__m256i const nonascii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+
+	while(src < end) {
+
+		// Convert blocks of 16 code units with a single pack when they are all ASCII
+		while((end - src) >= 16) {
+
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src));
+			if(!_mm256_testz_si256(block, nonascii)) break;
+
+			// packus operates on each 128-bit lane; gather the low quadwords of both lanes
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(block, block), 0xD8);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm256_castsi256_si128(packed));
+
+			src += 16;
+			dest += 16;
+		}
+
+		if(src == end) break;
+
+		// Process the non-ASCII block (or the tail) with the scalar implementation
+		wchar_t const* next = ((end - src) >= 16) ? src + 16 : end;
+		if((next < end) && (next[-1] >= 0xD800) && (next[-1] <= 0xDBFF)) ++next;
+		dest = transcode_scalar(src, next, dest);
+		src = next;
+	}
+
+	_mm256_zeroupper();
+	return dest;
+}
+
+// transcode_sse2
+//
+// Converts UTF-16 character data into UTF-8, 8 ASCII code units at a time
+static char* transcode_sse2(wchar_t const* src, wchar_t const* end, char* dest)
+{
+	__m128i const nonascii = _mm_set1_epi16(static_cast<short>(0xFF80));
+	__m128i const zero = _mm_setzero_si128();
+
+	while(src < end) {
+
+		// Convert blocks of 8 code units with a single pack when they are all ASCII
+		while((end - src) >= 8) {
+
+			__m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+			if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(block, nonascii), zero)) != 0xFFFF) break;
+
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dest), _mm_packus_epi16(block, block));
+
+			src += 8;
+			dest += 8;
+		}
+
+		if(src == end) break;
+
+		// Process the non-ASCII block (or the tail) with the scalar implementation
+		wchar_t const* next = ((end - src) >= 8) ? src + 8 : end;
+		if((next < end) && (next[-1] >= 0xD800) && (next[-1] <= 0xDBFF)) ++next;
+		dest = transcode_scalar(src, next, dest);
+		src = next;
+	}
+
+	return dest;
+}
+
+#endif	// defined(_M_IX86) || defined(_M_X64)
+
+//---------------------------------------------------------------------------
+// utf16_to_utf8
+//
+// Converts UTF-16 character data into UTF-8
+//
+// Arguments:
+//
+//	src		- Source UTF-16 character data
+//	cch		- Number of UTF-16 code units in the source data
+//	dest	- Destination buffer; must be at least (cch * 3) bytes in length
+
+size_t utf16_to_utf8(wchar_t const* src, size_t cch, char* dest)
+{
+	if((src == nullptr) || (cch == 0)) return 0;
+	if(dest == nullptr) throw std::invalid_argument("dest");
+
+#if defined(_M_IX86) || defined(_M_X64)
+	static bool const avx2 = has_avx2();
+	char* end = (avx2) ? transcode_avx2(src, src + cch, dest) : transcode_sse2(src, src + cch, dest);
+#else
+	char* end = transcode_scalar(src, src + cch, dest);
+#endif
+
+	return static_cast<size_t>(end - dest);
+}
+
+//---------------------------------------------------------------------------
+// utf16_to_utf8
+//
+// Converts UTF-16 character data into a UTF-8 std::string, the existing
+// capacity of the string is reused if it is large enough
+//
+// Arguments:
+//
+//	src		- Source UTF-16 character data
+//	cch		- Number of UTF-16 code units in the source data
+//	dest	- Destination std::string instance
+
+void utf16_to_utf8(wchar_t const* src, size_t cch, std::string& dest)
+{
+	dest.resize(cch * 3);
+	dest.resize(utf16_to_utf8(src, cch, &dest[0]));
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)
@@ -0,0 +1,321 @@
+//---------------------------------------------------------------------------
+// Copyright (c) 2017 Michael G. Brehm
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//---------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "wtvprovider.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "string_exception.h"
+
+#pragma warning(push, 4)
+
+// DIRECTORY_ENTRY_GUID
+//
+// GUID that starts each entry in the WTV root directory
+static uint8_t const DIRECTORY_ENTRY_GUID[] = { 0x92, 0xB7, 0x74, 0x91, 0x59, 0x70, 0x70, 0x44, 0x88, 0xDF, 0x06, 0x3B, 0x82, 0xCC, 0x21, 0x3D };
+
+// LEGACY_ATTRIB_STREAM
+//
+// Name of the WTV stream that contains the recording attributes
+static char const LEGACY_ATTRIB_STREAM[] = "table.0.entries.legacy_attrib";
+
+// MAX_STREAM_LENGTH
+//
+// Maximum length of the attribute stream that will be read
+static uint64_t const MAX_STREAM_LENGTH = 16 MiB;
+
+// METADATA_GUID
+//
+// GUID that starts each entry in the attribute stream
+static uint8_t const METADATA_GUID[] = { 0x5A, 0xFE, 0xD7, 0x6D, 0xC8, 0x1D, 0x8F, 0x4A, 0x99, 0x22, 0xFA, 0xB1, 0x1C, 0x38, 0x14, 0x53 };
+
+// SECTOR_BITS / BIGSECTOR_BITS
+//
+// Sector sizes used by WTV streams; sector numbers are always in units of SECTOR_BITS
+static int const SECTOR_BITS = 12;
+static int const BIGSECTOR_BITS = 18;
+
+// SECTOR_ENTRIES
+//
+// Number of sector numbers stored in a sector table
+static size_t const SECTOR_ENTRIES = (1 << SECTOR_BITS) / sizeof(uint32_t);
+
+// WTV_GUID
+//
+// GUID at the start of every WTV file
+static uint8_t const WTV_GUID[] = { 0xB7, 0xD8, 0x00, 0x20, 0x37, 0x49, 0xDA, 0x11, 0xA6, 0x4E, 0x00, 0x07, 0xE9, 0x5E, 0xAD, 0x8D };
+
+//---------------------------------------------------------------------------
+// wtvprovider::accepts
+//
+// Determines if the provider can read a file based on the extension and magic bytes
+//
+// Arguments:
+//
+//	extension	- File extension, including the leading period
+//	magic		- Bytes read from the start of the file
+//	length		- Number of magic bytes available
+
+bool wtvprovider::accepts(wchar_t const* extension, uint8_t const* magic, size_t length) const
+{
+	// If the start of the file couldn't be read go by the extension alone
+	if(length < sizeof(WTV_GUID)) return (_wcsicmp(extension, L".wtv") == 0);
+	return (memcmp(magic, WTV_GUID, sizeof(WTV_GUID)) == 0);
+}
+
+//---------------------------------------------------------------------------
+// wtvprovider::extensions
+//
+// Gets the file extension(s) the provider reads natively, or null if it reads any file
+//
+// Arguments:
+//
+//	NONE
+
+char const* wtvprovider::extensions(void) const
+{
+	return ".wtv";
+}
+
+//---------------------------------------------------------------------------
+// wtvprovider::extract (private)
+//
+// Provider specific implementation of load()
+//
+// Arguments:
+//
+//	path		- Path to the file
+//	metadata	- Metadata to be loaded
+
+void wtvprovider::extract(wchar_t const* path, recording_metadata& metadata)
+{
+	uint8_t						header[0x40];			// WTV file header
+	uint8_t*					root = nullptr;			// WTV root directory
+	uint32_t*					sectors = nullptr;		// Attribute stream sectors
+	size_t						sectorcount = 0;		// Number of attribute stream sectors
+	uint8_t*					stream = nullptr;		// Attribute stream data
+	size_t						streamlength = 0;		// Attribute stream data length
+	uint64_t					length = 0;				// Attribute stream length
+	uint32_t					firstsector = 0;		// Attribute stream first sector
+	uint32_t					depth = 0;				// Attribute stream sector table depth
+	bool						found = false;			// Flag if the stream was found
+
+	HANDLE file = open_file(path);
+
+	try {
+
+		// Reads a sector of sector numbers from the file into an array of SECTOR_ENTRIES slots, zeros are unused
+		auto read_sectors = [&](uint32_t sector, uint32_t* result) -> size_t {
+
+			uint8_t block[1 << SECTOR_BITS];
+			size_t count = 0;
+
+			read_file(file, static_cast<uint64_t>(sector) << SECTOR_BITS, block, sizeof(block));
+
+			for(size_t index = 0; index < sizeof(block); index += sizeof(uint32_t)) {
+
+				uint32_t value = get_le32(&block[index]);
+				if(value != 0) result[count++] = value;
+			}
+
+			return count;
+		};
+
+		// The header contains the size and location of the root directory
+		read_file(file, 0, header, sizeof(header));
+		if(memcmp(header, WTV_GUID, sizeof(WTV_GUID)) != 0) throw string_exception(__func__, ": file is not a WTV file");
+
+		uint32_t rootsize = get_le32(&header[0x30]);
+		uint32_t rootsector = get_le32(&header[0x38]);
+		if(rootsize > (1 << SECTOR_BITS)) throw string_exception(__func__, ": invalid root directory size ", rootsize);
+
+		root = scratch().allocate<uint8_t>(rootsize);
+		read_file(file, static_cast<uint64_t>(rootsector) << SECTOR_BITS, root, rootsize);
+
+		// Locate the attribute stream in the root directory; the names are UTF-16LE and may or may not be null terminated
+		size_t namelength = strlen(LEGACY_ATTRIB_STREAM);
+		for(size_t offset = 0; (!found) && (offset + 48 <= rootsize);) {
+
+			uint8_t const* entry = &root[offset];
+			if(memcmp(entry, DIRECTORY_ENTRY_GUID, sizeof(DIRECTORY_ENTRY_GUID)) != 0) break;
+
+			uint16_t entrylength = get_le16(entry + 16);
+			size_t namesize = static_cast<size_t>(get_le32(entry + 32)) * 2;
+			if(48 + namesize > rootsize - offset) break;
+
+			if(namesize >= namelength * 2) {
+
+				found = true;
+				for(size_t index = 0; (found) && (index < namelength); index++)
+					found = ((entry[40 + (index * 2)] == static_cast<uint8_t>(LEGACY_ATTRIB_STREAM[index])) && (entry[41 + (index * 2)] == 0));
+
+				if((found) && (namesize > namelength * 2)) found = (get_le16(entry + 40 + (namelength * 2)) == 0);
+
+				if(found) {
+
+					length = get_le64(entry + 24);
+					firstsector = get_le32(entry + 40 + namesize);
+					depth = get_le32(entry + 44 + namesize);
+				}
+			}
+
+			if(entrylength == 0) break;
+			offset += entrylength;
+		}
+
+		if(!found) throw string_exception(__func__, ": attribute stream not found");
+
+		// Depth 0 streams occupy a single sector, otherwise there are one or two levels of sector tables
+		if(depth == 0) { sectors = scratch().allocate<uint32_t>(1); sectors[sectorcount++] = firstsector; }
+		else if(depth == 1) { sectors = scratch().allocate<uint32_t>(SECTOR_ENTRIES); sectorcount = read_sectors(firstsector, sectors); }
+		else if(depth == 2) {
+
+			uint32_t* tables = scratch().allocate<uint32_t>(SECTOR_ENTRIES);
+			size_t tablecount = read_sectors(firstsector, tables);
+
+			sectors = scratch().allocate<uint32_t>(tablecount * SECTOR_ENTRIES);
+			for(size_t index = 0; index < tablecount; index++) sectorcount += read_sectors(tables[index], &sectors[sectorcount]);
+		}
+		else throw string_exception(__func__, ": unsupported sector table depth ", depth);
+
+		// The high bit of the length indicates if the stream uses small sectors
+		int sectorbits = (length & (1ULL << 63)) ? SECTOR_BITS : BIGSECTOR_BITS;
+		length &= 0xFFFFFFFFFFFFULL;
+		length = std::min(length, static_cast<uint64_t>(sectorcount) << sectorbits);
+		if(length > MAX_STREAM_LENGTH) throw string_exception(__func__, ": attribute stream length ", length, " is too large");
+
+		// Read the stream into memory one sector at a time
+		streamlength = static_cast<size_t>(length);
+		stream = scratch().allocate<uint8_t>(streamlength);
+		for(size_t offset = 0; offset < streamlength;) {
+
+			size_t within = offset & ((static_cast<size_t>(1) << sectorbits) - 1);
+			size_t chunk = std::min(streamlength - offset, (static_cast<size_t>(1) << sectorbits) - within);
+
+			read_file(file, (static_cast<uint64_t>(sectors[offset >> sectorbits]) << SECTOR_BITS) + within, &stream[offset], chunk);
+			offset += chunk;
+		}
+
+		CloseHandle(file);
+	}
+
+	catch(...) { CloseHandle(file); throw; }
+
+	// Decode the attributes, and keep them as the raw metadata; the binary attributes (like the thumbnail)
+	// are never decoded so they are left out rather than stored with every recording
+	parse(stream, streamlength, metadata);
+	metadata.format = name();
+
+	for(size_t offset = 0; offset + 24 <= streamlength;) {
+
+		if(memcmp(&stream[offset], METADATA_GUID, sizeof(METADATA_GUID)) != 0) break;
+
+		uint32_t type = get_le32(&stream[offset + 16]);
+		uint32_t valuelength = get_le32(&stream[offset + 20]);
+		if(valuelength == 0) break;
+
+		size_t next = offset + 24;
+		while((next + 2 <= streamlength) && (get_le16(&stream[next]) != 0)) next += 2;
+		if((next + 2 > streamlength) || (valuelength > streamlength - next - 2)) break;
+		next += 2 + valuelength;
+
+		if(type != 6) metadata.raw.append(reinterpret_cast<char const*>(&stream[offset]), next - offset);
+		offset = next;
+	}
+}
+
+//---------------------------------------------------------------------------
+// wtvprovider::name
+//
+// Gets the name of the provider
+//
+// Arguments:
+//
+//	NONE
+
+char const* wtvprovider::name(void) const
+{
+	return "wtv";
+}
+
+//---------------------------------------------------------------------------
+// wtvprovider::parse (private)
+//
+// Provider specific implementation of decode()
+//
+// Arguments:
+//
+//	data		- Pointer to the attribute stream
+//	length		- Length of the attribute stream
+//	metadata	- Metadata to be decoded
+
+void wtvprovider::parse(uint8_t const* data, size_t length, recording_metadata& metadata)
+{
+	// Each attribute is a GUID, a type, a value length, a null-terminated UTF-16LE name and the value
+	for(size_t offset = 0; offset + 24 <= length;) {
+
+		if(memcmp(&data[offset], METADATA_GUID, sizeof(METADATA_GUID)) != 0) break;
+
+		uint32_t type = get_le32(&data[offset + 16]);
+		uint32_t valuelength = get_le32(&data[offset + 20]);
+		if(valuelength == 0) break;
+		offset += 24;
+
+		size_t namestart = offset;
+		while((offset + 2 <= length) && (get_le16(&data[offset]) != 0)) offset += 2;
+		if(offset + 2 > length) break;
+
+		char const* name = utf16le_to_utf8(&data[namestart], offset - namestart);
+		offset += 2;
+
+		if(valuelength > length - offset) break;
+		uint8_t const* value = &data[offset];
+
+		if((type == 0) && (valuelength == 4)) set_attribute(metadata, name, get_le32(value));
+		else if(type == 1) set_attribute(metadata, name, utf16le_to_utf8(value, valuelength));
+		else if((type == 3) && (valuelength == 4)) set_attribute(metadata, name, (get_le32(value) != 0) ? 1ULL : 0ULL);
+		else if((type == 4) && (valuelength == 8)) set_attribute(metadata, name, get_le64(value));
+		else if((type == 5) && (valuelength == 2)) set_attribute(metadata, name, get_le16(value));
+
+		offset += valuelength;
+	}
+}
+
+//---------------------------------------------------------------------------
+// wtvprovider::priority
+//
+// Gets the static priority of the provider; lower values are tried first
+//
+// Arguments:
+//
+//	NONE
+
+int wtvprovider::priority(void) const
+{
+	return 0;		// Native reader of the WTV format; always tried before the fallback providers
+}
+
+//---------------------------------------------------------------------------
+
+#pragma warning(pop)